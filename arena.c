@@ -0,0 +1,175 @@
+/*
+ * Arena allocator for particle and cell storage
+ *
+ * Memory is taken from the operating system in blocks of at least
+ * ARENA_BLOCK_SIZE and handed out in ARENA_ALIGN aligned pieces. Nothing is
+ * freed individually: ArenaReset() makes the whole arena available again
+ * without returning the blocks, so re-allocating the same arrays after a
+ * reset yields the same (already mapped) memory.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+
+#ifdef _WINDOWS
+#	include <windows.h>
+#else
+#	include <sys/mman.h>
+#endif
+
+#include "in_vdefs.h"
+#include "simulation.h"
+#include "arena.h"
+
+#define RoundUp(n, m)  (((n) + (m) - 1) / (m) * (m))
+
+struct ArenaBlock {
+	ArenaBlock *next;
+	size_t size, used;  // usable bytes after the header / bytes handed out
+	size_t mapped;      // bytes obtained from the operating system
+};
+
+// Space taken by the block header, keeps the data ARENA_ALIGN aligned
+#define BLOCK_HEADER  RoundUp (sizeof (ArenaBlock), ARENA_ALIGN)
+
+
+// Get size bytes (a multiple of ARENA_BLOCK_SIZE) from the operating system.
+// If the requested page type is not available, *pages is changed to the type
+// that was used instead.
+static void *PagesAlloc (size_t size, int *pages)
+{
+	void *p;
+
+#ifdef _WINDOWS
+	// Large pages need the "Lock pages in memory" privilege
+	if (*pages == ARENA_PAGES_EXPLICIT) {
+		p = VirtualAlloc (NULL, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+				PAGE_READWRITE);
+		if (p) return p;
+	}
+	// There are no transparent huge pages on Windows
+	*pages = ARENA_PAGES_NORMAL;
+	return VirtualAlloc (NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+	char *q, *aligned;
+
+#	ifdef MAP_HUGETLB
+	// Explicit huge pages must be reserved first, e.g. in /proc/sys/vm/nr_hugepages
+	if (*pages == ARENA_PAGES_EXPLICIT) {
+		p = mmap (NULL, size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED) return p;
+	}
+#	endif
+#	ifdef MADV_HUGEPAGE
+	if (*pages != ARENA_PAGES_NORMAL) {
+		*pages = ARENA_PAGES_TRANSPARENT;
+
+		// Transparent huge pages are only used for 2 MB aligned memory, so
+		// map one block extra and cut off the unaligned ends
+		q = mmap (NULL, size + ARENA_BLOCK_SIZE, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (q == MAP_FAILED) return NULL;
+		aligned = (char *) RoundUp ((uintptr_t) q, ARENA_BLOCK_SIZE);
+		if (aligned > q) munmap (q, aligned - q);
+		if (q + ARENA_BLOCK_SIZE > aligned)
+			munmap (aligned + size, q + ARENA_BLOCK_SIZE - aligned);
+		madvise (aligned, size, MADV_HUGEPAGE);
+		return aligned;
+	}
+#	endif
+	*pages = ARENA_PAGES_NORMAL;
+	p = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return (p == MAP_FAILED) ? NULL : p;
+#endif
+}
+
+static void PagesFree (void *p, size_t size)
+{
+#ifdef _WINDOWS
+	VirtualFree (p, 0, MEM_RELEASE);
+#else
+	munmap (p, size);
+#endif
+}
+
+// Append a new block with room for at least size bytes to the arena
+static ArenaBlock *BlockAlloc (Arena *a, size_t size)
+{
+	ArenaBlock *b, **tail;
+	size_t mapped;
+	int pages;
+
+	mapped = RoundUp (BLOCK_HEADER + size, ARENA_BLOCK_SIZE);
+	pages = a->pages;
+	b = PagesAlloc (mapped, &pages);
+	if (!b) return NULL;
+	if (pages != a->pages) {
+		LogWarn("Warning: requested huge pages are not available, using %s pages\n",
+				(pages == ARENA_PAGES_TRANSPARENT) ? "transparent huge" : "normal");
+		a->pages = pages;
+	}
+
+	b->next = NULL;
+	b->size = mapped - BLOCK_HEADER;
+	b->used = 0;
+	b->mapped = mapped;
+	for (tail = &a->first; *tail; tail = &(*tail)->next)
+		;
+	*tail = b;
+	a->reserved += mapped;
+	return b;
+}
+
+void ArenaInit (Arena *a, int pages)
+{
+	a->first = a->cur = NULL;
+	a->pages = pages;
+	a->used = a->peak = a->reserved = 0;
+}
+
+// Return: ARENA_ALIGN aligned memory for size bytes, or NULL when out of memory
+void *ArenaAlloc (Arena *a, size_t size)
+{
+	ArenaBlock *b;
+	char *p;
+
+	size = RoundUp (size, ARENA_ALIGN);
+
+	// Take the current block or the first following one with enough room.
+	// After ArenaReset() this retraces the blocks of the previous round.
+	for (b = a->cur; b && b->used + size > b->size; b = b->next)
+		;
+	if (!b && !(b = BlockAlloc (a, size))) {
+		LogError("Error: could not allocate %lu bytes\n", (unsigned long) size);
+		return NULL;
+	}
+
+	a->cur = b;
+	p = (char *) b + BLOCK_HEADER + b->used;
+	b->used += size;
+	a->used += size;
+	a->peak = Max (a->peak, a->used);
+	return p;
+}
+
+// Release everything allocated so far, but keep the blocks for reuse
+void ArenaReset (Arena *a)
+{
+	ArenaBlock *b;
+
+	for (b = a->first; b; b = b->next) b->used = 0;
+	a->cur = a->first;
+	a->used = 0;
+}
+
+// Return all blocks to the operating system
+void ArenaFree (Arena *a)
+{
+	ArenaBlock *b, *next;
+
+	for (b = a->first; b; b = next) {
+		next = b->next;
+		PagesFree (b, b->mapped);
+	}
+	ArenaInit (a, a->pages);
+}
@@ -0,0 +1,35 @@
+/*
+ * Arena allocator for particle and cell storage
+ */
+#ifndef __MD_ARENA_H__
+#define __MD_ARENA_H__
+
+#include <stddef.h>
+
+// Alignment of every allocation: a cache line, and enough for any SIMD load
+#define ARENA_ALIGN  64
+
+// Size of the blocks requested from the operating system (one huge page)
+#define ARENA_BLOCK_SIZE  (2 * 1024 * 1024)
+
+// Page types used for the blocks (see hugePages in simulation.c)
+#define ARENA_PAGES_NORMAL       0
+#define ARENA_PAGES_TRANSPARENT  1
+#define ARENA_PAGES_EXPLICIT     2
+
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct {
+	ArenaBlock *first, *cur;
+	int pages;        // page type of new blocks, one of ARENA_PAGES_*
+	size_t used;      // bytes handed out since the last ArenaReset()
+	size_t peak;      // maximum of used since ArenaInit()
+	size_t reserved;  // bytes obtained from the operating system
+} Arena;
+
+void  ArenaInit (Arena *a, int pages);
+void *ArenaAlloc (Arena *a, size_t size);
+void  ArenaReset (Arena *a);
+void  ArenaFree (Arena *a);
+
+#endif /* __MD_ARENA_H__ */
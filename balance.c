@@ -0,0 +1,150 @@
+/*
+ * Load balancing
+ *
+ * The work of a cell is taken to be that of the force loop: a pair test
+ * for every molecule in the cell with every molecule in the cells around
+ * it, plus BALANCE_CELL_WORK for every molecule and neighbour cell it
+ * visits. Thread t then gets the rows from where the work summed over the
+ * rows before reaches t / nThreadsUsed of the total. A cell row is the
+ * smallest block handed out, since the row sums of reproSums and the shear
+ * slabs are each written by a single thread. With several ranks, the rows
+ * of the slab of the rank are divided, see domain.h.
+ *
+ * The load imbalance is the work of the busiest thread over the mean, so 1
+ * is perfect balance and nThreadsUsed the worst case. At every balancing it
+ * is found for the old division (how far the balance drifted since the
+ * last one), for the new one, and for an even division of the rows.
+ */
+#include <stdio.h>
+
+#include "in_vdefs.h"
+#include "in_mddefs.h"
+#include "threads.h"
+#include "simulation.h"
+#include "balance.h"
+#include "domain.h"
+
+// Work of visiting a cell, relative to that of a pair test
+#define BALANCE_CELL_WORK  1.
+
+// Input: steps between balancing, 0 to keep the even division
+int balancePeriod = 200;
+
+int *cellCount;
+double *rowWork;
+
+// Imbalance summed over the balancing since the last summary: of the old,
+// the new and the even division
+double driftSum, balancedSum, evenSum;
+int nBalance;
+
+
+// Set up for the current system, taking the memory from arena a
+void BalanceInit (Arena *a)
+{
+	driftSum = balancedSum = evenSum = 0.;
+	nBalance = 0;
+	cellCount = NULL;
+	if (!balancePeriod || nThreadsUsed == 1) return;
+	AllocMemArena (a, cellCount, VProd (cells), int);
+	AllocMemArena (a, rowWork, cells.y, double);
+}
+
+static void EstimateWork (void)
+{
+	VecI m1v, m2v, range;
+	double w;
+	int c, dx, dy, j, n, nb, nVisit, y, yHi;
+
+	// The slab and its ghost rows
+	y = nRanks > 1 ? domRowLo - 1 : 0;
+	yHi = nRanks > 1 ? domRowHi + 1 : cells.y;
+	for (; y < yHi; y ++) {
+		for (m1v.x = 0; m1v.x < cells.x; m1v.x ++) {
+			m1v.y = (y + cells.y) % cells.y;
+			c = VLinear (m1v, cells);
+			n = 0;
+			for (j = cellList[nMol + c]; j >= 0; j = cellList[j]) ++ n;
+			cellCount[c] = n;
+		}
+	}
+	VSet (range, cells.x > 1, cells.y > 1);
+	nVisit = (2 * range.x + 1) * (2 * range.y + 1);
+	for (m1v.y = domRowLo; m1v.y < domRowHi; m1v.y ++) {
+		w = 0.;
+		for (m1v.x = 0; m1v.x < cells.x; m1v.x ++) {
+			nb = 0;
+			for (dy = - range.y; dy <= range.y; dy ++) {
+				m2v.y = (m1v.y + dy + cells.y) % cells.y;
+				for (dx = - range.x; dx <= range.x; dx ++) {
+					m2v.x = (m1v.x + dx + cells.x) % cells.x;
+					nb += cellCount[VLinear (m2v, cells)];
+				}
+			}
+			n = cellCount[VLinear (m1v, cells)];
+			w += n * (nb + BALANCE_CELL_WORK * nVisit) + BALANCE_CELL_WORK;
+		}
+		rowWork[m1v.y] = w;
+	}
+}
+
+// Return: the imbalance of the division where thread t has the rows
+// lo[t] .. lo[t + 1] - 1
+static double Imbalance (const int *lo)
+{
+	double max, total, w;
+	int t, y;
+
+	max = total = 0.;
+	for (t = 0; t < nThreadsUsed; t ++) {
+		w = 0.;
+		for (y = lo[t]; y < lo[t + 1]; y ++) w += rowWork[y];
+		max = Max (max, w);
+		total += w;
+	}
+	return total > 0. ? max * nThreadsUsed / total : 1.;
+}
+
+// Divide the cell rows among the threads by their work; the cells must be
+// up to date
+void BalanceRows (void)
+{
+	double done, target, total;
+	int lo[MAX_THREADS + 1], nRows, t, y;
+
+	if (!cellCount) return;
+	EstimateWork ();
+	nRows = domRowHi - domRowLo;
+	lo[nThreadsUsed] = domRowHi;
+	for (t = 0; t < nThreadsUsed; t ++) lo[t] = threadInfo[t].rowLo;
+	driftSum += Imbalance (lo);
+	for (t = 0; t < nThreadsUsed; t ++) lo[t] = domRowLo + (long) t * nRows / nThreadsUsed;
+	evenSum += Imbalance (lo);
+
+	total = 0.;
+	for (y = domRowLo; y < domRowHi; y ++) total += rowWork[y];
+	// A row goes to the later thread once more than half of it lies
+	// beyond the target of the earlier one
+	done = 0.;
+	y = domRowLo;
+	for (t = 1; t < nThreadsUsed; t ++) {
+		target = total * t / nThreadsUsed;
+		while (y < domRowHi && done + 0.5 * rowWork[y] < target) done += rowWork[y ++];
+		lo[t] = y;
+	}
+	balancedSum += Imbalance (lo);
+	++ nBalance;
+	for (t = 0; t < nThreadsUsed; t ++) {
+		threadInfo[t].rowLo = lo[t];
+		threadInfo[t].rowHi = lo[t + 1];
+	}
+}
+
+void BalanceSummary (void)
+{
+	if (nBalance == 0) return;
+	message("      load imbalance %.3f, %.3f after balancing, %.3f for even rows\n",
+		driftSum / nBalance, balancedSum / nBalance, evenSum / nBalance);
+	driftSum = balancedSum = evenSum = 0.;
+	nBalance = 0;
+}
@@ -0,0 +1,23 @@
+/*
+ * Load balancing
+ *
+ * The force loop and the pair searches divide the cell rows among the
+ * threads. Every balancePeriod steps the work of every row is estimated
+ * from the cells, and the rows are divided again so that each thread gets
+ * about the same share; in a system with dense and dilute regions an even
+ * division leaves most threads waiting for the few with the dense rows.
+ * The molecules, which cost the same wherever they are, stay with the
+ * threads they started with.
+ */
+#ifndef __MD_BALANCE_H__
+#define __MD_BALANCE_H__
+
+#include "arena.h"
+
+extern int balancePeriod;
+
+void BalanceInit (Arena *a);
+void BalanceRows (void);
+void BalanceSummary (void);
+
+#endif /* __MD_BALANCE_H__ */
@@ -0,0 +1,94 @@
+/*
+ * Error of the mean of correlated samples by blocking
+ *
+ * The error of level k is itself uncertain by about err_k / sqrt (2 (n_k - 1)).
+ * The plateau is taken to start at the first level whose error the next
+ * BLOCK_FLAT levels exceed by no more than that; the error there is the
+ * estimate. Short runs fluctuate enough to look flat over a single level
+ * now and then. If there is no such level among those with BLOCK_MIN
+ * blocks, the run is too short for the correlation time and the last of
+ * them gives only a lower bound.
+ */
+#include <math.h>
+
+#include "in_vdefs.h"
+#include "in_mddefs.h"
+#include "blocking.h"
+
+#define BLOCK_FLAT  2
+
+
+void BlockingZero (Blocking *b)
+{
+	int k;
+
+	for (k = 0; k < BLOCK_LEVELS; k ++) {
+		b->sum[k] = b->sum2[k] = b->pending[k] = 0.;
+		b->n[k] = b->hasPending[k] = 0;
+	}
+	b->nLevel = 0;
+}
+
+// Add sample v to level 0, and the blocks it completes to the levels above
+void BlockingAdd (Blocking *b, double v)
+{
+	int k;
+
+	for (k = 0; k < BLOCK_LEVELS; k ++) {
+		b->sum[k] += v;
+		b->sum2[k] += Sqr (v);
+		++ b->n[k];
+		b->nLevel = Max (b->nLevel, k + 1);
+		if (! b->hasPending[k]) {
+			b->pending[k] = v;
+			b->hasPending[k] = 1;
+			break;
+		}
+		b->hasPending[k] = 0;
+		v = 0.5 * (b->pending[k] + v);
+	}
+}
+
+// Return: the mean of the samples
+double BlockingMean (Blocking *b)
+{
+	return b->n[0] > 0 ? b->sum[0] / b->n[0] : 0.;
+}
+
+// Naive error of the mean at level k
+static double LevelError (Blocking *b, int k)
+{
+	double m = b->sum[k] / b->n[k];
+
+	return sqrt (Max (b->sum2[k] / b->n[k] - Sqr (m), 0.) / (b->n[k] - 1));
+}
+
+// Estimate the error of the mean, and the statistical inefficiency: the
+// number of samples that are worth one independent sample.
+// Return: 1 if the errors reached a plateau, 0 if err is only a lower
+// bound, -1 if there are too few samples for any estimate
+int BlockingError (Blocking *b, double *err, double *ineff)
+{
+	double e, e0, tol;
+	int j, k, kMax, plateau;
+
+	*err = 0.;
+	*ineff = 1.;
+	for (kMax = b->nLevel - 1; kMax >= 0 && b->n[kMax] < BLOCK_MIN; kMax --)
+		;
+	if (kMax < 0) return -1;
+	e0 = LevelError (b, 0);
+	for (k = 0; k + BLOCK_FLAT <= kMax; k ++) {
+		e = LevelError (b, k);
+		tol = e * (1. + 1. / sqrt (2. * (b->n[k] - 1)));
+		for (j = k + 1; j <= k + BLOCK_FLAT && LevelError (b, j) <= tol; j ++)
+			;
+		if (j > k + BLOCK_FLAT) break;
+	}
+	// No plateau: the last level with enough blocks bounds it from below
+	plateau = k + BLOCK_FLAT <= kMax;
+	if (!plateau) k = kMax;
+	*err = LevelError (b, k);
+	if (e0 > 0.) *ineff = Sqr (*err / e0);
+	return plateau;
+}
@@ -0,0 +1,32 @@
+/*
+ * Error of the mean of correlated samples by blocking
+ *
+ * The method of Flyvbjerg and Petersen: the samples are averaged in pairs,
+ * the pair averages again in pairs, and so on. Level k holds the averages
+ * of blocks of 2^k samples, and the naive error of the mean from its
+ * variance, sqrt (var_k / (n_k - 1)), grows with k until the blocks are
+ * longer than the correlation time, where it levels off at the true error.
+ * The levels are filled as the samples come, so the memory is fixed and
+ * the work per sample constant.
+ */
+#ifndef __MD_BLOCKING_H__
+#define __MD_BLOCKING_H__
+
+// Levels kept, for up to 2^BLOCK_LEVELS samples, and the fewest blocks a
+// level needs for its error to count
+#define BLOCK_LEVELS  48
+#define BLOCK_MIN     16
+
+typedef struct {
+	double sum[BLOCK_LEVELS], sum2[BLOCK_LEVELS];  // of the block averages
+	double pending[BLOCK_LEVELS];  // first of a pair of blocks, if hasPending
+	int n[BLOCK_LEVELS], hasPending[BLOCK_LEVELS];
+	int nLevel;                    // levels with any blocks
+} Blocking;
+
+void BlockingZero (Blocking *b);
+void BlockingAdd (Blocking *b, double v);
+double BlockingMean (Blocking *b);
+int  BlockingError (Blocking *b, double *err, double *ineff);
+
+#endif /* __MD_BLOCKING_H__ */
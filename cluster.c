@@ -0,0 +1,178 @@
+/*
+ * Cluster analysis
+ *
+ * The clusters are found with a union-find that all threads update at the
+ * same time, without locks. Every tree is linked under the root with the
+ * smaller index, and a link is made by a compare-and-swap on a root, which
+ * fails if another thread got there first; the union is then retried from
+ * the new roots. FindRoot() halves the path as it goes, again by
+ * compare-and-swap, which only ever points a molecule further up its own
+ * tree and so cannot break a concurrent union.
+ */
+#include <stdio.h>
+
+#include "in_vdefs.h"
+#include "in_mddefs.h"
+#include "threads.h"
+#include "simulation.h"
+#include "cluster.h"
+
+// Inputs: steps between samples (0 for none) and the bonding distance
+int clusterPeriod = 0;
+double clusterDist = 1.5;
+
+// clusterParent[n] is the molecule above n in its tree, the root points to
+// itself; clusterSize[n] the size of the cluster with root n
+volatile int *clusterParent;
+int *clusterSize;
+
+// Sums over the samples since the last summary, and over the run
+double clusterSum, largestSum, histSum[CLUSTER_BINS];
+int largestMax, nClusterSample, nClusterTotal;
+FILE *clusterFile;
+
+
+// Set up the union-find, taking its memory from arena a, and start the
+// time series in filename
+void ClusterInit (Arena *a, const char *filename)
+{
+	int b;
+
+	clusterSum = largestSum = 0.;
+	for (b = 0; b < CLUSTER_BINS; b ++) histSum[b] = 0.;
+	largestMax = nClusterSample = nClusterTotal = 0;
+	if (clusterFile) {
+		fclose (clusterFile);
+		clusterFile = NULL;
+	}
+	if (!clusterPeriod) return;
+	AllocMemArena (a, clusterParent, nMol, int);
+	AllocMemArena (a, clusterSize, nMol, int);
+	if (!(clusterFile = fopen (filename, "w"))) {
+		LogError("Error: could not write clusters to %s.\n", filename);
+		return;
+	}
+	fprintf (clusterFile, " Step   Time     clusters largest  histogram (sizes 1, 2-3, 4-7, ...)\n");
+}
+
+static int FindRoot (int n)
+{
+	int p, gp;
+
+	while ((p = clusterParent[n]) != n) {
+		gp = clusterParent[p];
+		if (gp != p) AtomicCAS (&clusterParent[n], p, gp);
+		n = gp;
+	}
+	return n;
+}
+
+static void Union (int n1, int n2)
+{
+	int t;
+
+	while (1) {
+		n1 = FindRoot (n1);
+		n2 = FindRoot (n2);
+		if (n1 == n2) return;
+		if (n1 < n2) {
+			t = n1;
+			n1 = n2;
+			n2 = t;
+		}
+		if (AtomicCAS (&clusterParent[n1], n1, n2)) return;
+	}
+}
+
+// Both molecules of a pair see it, one union is enough
+static void Link (int j1, int j2, VecR *dr, double rr, void *arg)
+{
+	if (j1 < j2) Union (j1, j2);
+}
+
+static void ClusterStart (int tid)
+{
+	int n;
+
+	DO_MOL_OF (tid) {
+		clusterParent[n] = n;
+		clusterSize[n] = 0;
+	}
+}
+
+static void ClusterLink (int tid)
+{
+	VisitPairs (tid, clusterDist, Link, NULL);
+}
+
+// Once all unions are done every molecule can point straight at its root
+static void ClusterFlatten (int tid)
+{
+	int n;
+
+	DO_MOL_OF (tid) clusterParent[n] = FindRoot (n);
+}
+
+void ClusterSample (void)
+{
+	int hist[CLUSTER_BINS];
+	int b, n, nCluster, largest, nBin, s;
+
+	if (!clusterPeriod) return;
+	ThreadsRun (ClusterStart);
+	ThreadsRun (ClusterLink);
+	ThreadsRun (ClusterFlatten);
+
+	DO_MOL ++ clusterSize[clusterParent[n]];
+	for (b = 0; b < CLUSTER_BINS; b ++) hist[b] = 0;
+	nCluster = largest = nBin = 0;
+	DO_MOL {
+		if ((s = clusterSize[n]) == 0) continue;
+		++ nCluster;
+		largest = Max (largest, s);
+		for (b = 0; s > 1; b ++) s >>= 1;
+		++ hist[b];
+		nBin = Max (nBin, b + 1);
+	}
+
+	clusterSum += nCluster;
+	largestSum += largest;
+	largestMax = Max (largestMax, largest);
+	for (b = 0; b < CLUSTER_BINS; b ++) histSum[b] += hist[b];
+	++ nClusterSample;
+	++ nClusterTotal;
+	if (clusterFile) {
+		fprintf (clusterFile, "%5d %8.4f %8d %8d ", stepCount, timeNow, nCluster, largest);
+		for (b = 0; b < nBin; b ++) fprintf (clusterFile, " %d", hist[b]);
+		fprintf (clusterFile, "\n");
+	}
+}
+
+// Averages since the previous summary, printed below its line
+void ClusterSummary (void)
+{
+	char text[16 * CLUSTER_BINS], *t;
+	int b;
+
+	if (!clusterPeriod || nClusterSample == 0) return;
+	t = text;
+	*t = '\0';
+	for (b = 0; b < CLUSTER_BINS; b ++) {
+		if (histSum[b] == 0.) continue;
+		t += sprintf (t, " %d:%.1f", 1 << b, histSum[b] / nClusterSample);
+		histSum[b] = 0.;
+	}
+	message("      clusters %.1f, largest %.1f, by size%s\n",
+		clusterSum / nClusterSample, largestSum / nClusterSample, text);
+	clusterSum = largestSum = 0.;
+	nClusterSample = 0;
+	if (clusterFile) fflush (clusterFile);
+}
+
+void ClusterReport (void)
+{
+	if (!clusterPeriod || nClusterTotal == 0) return;
+	message("Clusters over %d samples: largest %d of %d molecules\n",
+		nClusterTotal, largestMax, nMol);
+	if (clusterFile) fflush (clusterFile);
+}
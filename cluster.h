@@ -0,0 +1,25 @@
+/*
+ * Cluster analysis
+ *
+ * Every clusterPeriod steps the molecules closer than clusterDist are joined
+ * into clusters, using the cell subdivision of the forces to find the pairs.
+ * The number of clusters, the largest one and a histogram of the sizes go
+ * to a file at every sample and, averaged, into the summary.
+ */
+#ifndef __MD_CLUSTER_H__
+#define __MD_CLUSTER_H__
+
+#include "arena.h"
+
+// Histogram bin b holds the clusters of 2^b up to 2^(b+1) - 1 molecules
+#define CLUSTER_BINS  32
+
+extern int clusterPeriod;
+extern double clusterDist;
+
+void ClusterInit (Arena *a, const char *filename);
+void ClusterSample (void);
+void ClusterSummary (void);
+void ClusterReport (void);
+
+#endif /* __MD_CLUSTER_H__ */
@@ -0,0 +1,129 @@
+/*
+ * Multi-tau correlator
+ *
+ * After Ramirez, Sinha, Sanz and Jones, J. Chem. Phys. 133, 154103 (2010).
+ */
+#include <string.h>
+
+#include "in_vdefs.h"
+#include "in_mddefs.h"
+#include "correlator.h"
+
+#define Shift(c, k, j)  ((c)->shift + ((size_t) (k) * CORR_P + (j)) * (c)->nDim)
+#define Accum(c, k)     ((c)->accum + (size_t) (k) * (c)->nDim)
+
+// Take the memory for a correlator of nDim components and nLevel levels
+// from arena a. It still has to be cleared with CorrelatorZero().
+void CorrelatorInit (Correlator *c, Arena *a, int nDim, int nLevel, int mode)
+{
+	c->nDim = nDim;
+	c->nLevel = Max (nLevel, 1);
+	c->mode = mode;
+	AllocMemArena (a, c->in, nDim, double);
+	AllocMemArena (a, c->shift, (size_t) c->nLevel * CORR_P * nDim, double);
+	AllocMemArena (a, c->accum, (size_t) c->nLevel * nDim, double);
+	AllocMemArena (a, c->corr, c->nLevel * CORR_P, double);
+	AllocMemArena (a, c->nCorr, c->nLevel * CORR_P, double);
+	AllocMemArena (a, c->nShift, c->nLevel, int);
+	AllocMemArena (a, c->insert, c->nLevel, int);
+	AllocMemArena (a, c->nAccum, c->nLevel, int);
+}
+
+// Forget all samples
+void CorrelatorZero (Correlator *c)
+{
+	int k;
+
+	memset (c->in, 0, c->nDim * sizeof (double));
+	memset (c->shift, 0, (size_t) c->nLevel * CORR_P * c->nDim * sizeof (double));
+	memset (c->accum, 0, (size_t) c->nLevel * c->nDim * sizeof (double));
+	for (k = 0; k < c->nLevel * CORR_P; k ++) c->corr[k] = c->nCorr[k] = 0.;
+	for (k = 0; k < c->nLevel; k ++) c->nShift[k] = c->insert[k] = c->nAccum[k] = 0;
+}
+
+// Add sample x to level k
+static void Add (Correlator *c, int k, const double *x)
+{
+	double *s, *old, *a, sum;
+	int d, j, slot, nd = c->nDim;
+
+	slot = c->insert[k];
+	s = Shift (c, k, slot);
+	memcpy (s, x, nd * sizeof (double));
+	if (c->nShift[k] < CORR_P) ++ c->nShift[k];
+
+	// Every CORR_M samples their average (or the last of them, for an MSD)
+	// goes to the next level
+	if (k + 1 < c->nLevel) {
+		if (c->mode == CORR_MSD) {
+			if (++ c->nAccum[k] == CORR_M) {
+				Add (c, k + 1, s);
+				c->nAccum[k] = 0;
+			}
+		} else {
+			a = Accum (c, k);
+			for (d = 0; d < nd; d ++) a[d] += s[d];
+			if (++ c->nAccum[k] == CORR_M) {
+				for (d = 0; d < nd; d ++) a[d] *= 1. / CORR_M;
+				Add (c, k + 1, a);
+				for (d = 0; d < nd; d ++) a[d] = 0.;
+				c->nAccum[k] = 0;
+			}
+		}
+	}
+
+	// Lags below CORR_P / CORR_M of the higher levels are done by the lower
+	for (j = k == 0 ? 0 : CORR_P / CORR_M; j < c->nShift[k]; j ++) {
+		old = Shift (c, k, (slot - j + CORR_P) % CORR_P);
+		sum = 0.;
+		if (c->mode == CORR_MSD) {
+			for (d = 0; d < nd; d ++) sum += Sqr (s[d] - old[d]);
+		} else {
+			for (d = 0; d < nd; d ++) sum += s[d] * old[d];
+		}
+		c->corr[k * CORR_P + j] += sum;
+		c->nCorr[k * CORR_P + j] += 1.;
+	}
+	c->insert[k] = (slot + 1) % CORR_P;
+}
+
+// Add the sample in c->in
+void CorrelatorPush (Correlator *c)
+{
+	Add (c, 0, c->in);
+}
+
+// Correlation function of nc correlators with the same number of levels
+// taken together, at the lags (in samples) that have data so far. lag and
+// val need room for nLevel * CORR_P values.
+// Return: the number of lags
+int CorrelatorResult (Correlator *c, int nc, double *lag, double *val)
+{
+	double sum, nSum, scale;
+	int i, j, k, n = 0;
+
+	for (k = 0, scale = 1.; k < c->nLevel; k ++, scale *= CORR_M) {
+		for (j = k == 0 ? 0 : CORR_P / CORR_M; j < CORR_P; j ++) {
+			sum = nSum = 0.;
+			for (i = 0; i < nc; i ++) {
+				sum += c[i].corr[k * CORR_P + j];
+				nSum += c[i].nCorr[k * CORR_P + j] * c[i].nDim;
+			}
+			if (nSum == 0.) continue;
+			lag[n] = j * scale;
+			val[n] = sum / nSum;
+			++ n;
+		}
+	}
+	return n;
+}
+
+// Integral of a correlation function over its n lags, by the trapezoidal rule
+double CorrelatorIntegral (int n, double *lag, double *val)
+{
+	double sum = 0.;
+	int k;
+
+	for (k = 1; k < n; k ++) sum += 0.5 * (val[k] + val[k - 1]) * (lag[k] - lag[k - 1]);
+	return sum;
+}
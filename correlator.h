@@ -0,0 +1,46 @@
+/*
+ * Multi-tau correlator
+ *
+ * Time correlation functions of a stream of samples, computed on the fly
+ * with blocks of logarithmically growing length: level k keeps the last
+ * CORR_P averages of CORR_M^k samples and correlates them at lags of
+ * j * CORR_M^k samples. Memory grows with the number of levels, i.e. the
+ * logarithm of the longest lag, and the work per sample is constant.
+ * A correlator of nDim components gives the average of the nDim
+ * autocorrelation functions.
+ *
+ * In CORR_MSD mode it gives the mean squared difference of the samples
+ * instead, e.g. the mean squared displacement when fed unwrapped positions.
+ * The levels then take every CORR_M-th sample rather than averages, so the
+ * time origins of lag j * CORR_M^k are CORR_M^k samples apart.
+ */
+#ifndef __MD_CORRELATOR_H__
+#define __MD_CORRELATOR_H__
+
+#include "arena.h"
+
+// Values kept per level, and samples averaged into one of the next level
+#define CORR_P  16
+#define CORR_M  2
+
+// What is computed from pairs of samples
+#define CORR_PRODUCT  0  // a(0) a(t)
+#define CORR_MSD      1  // (a(t) - a(0))^2
+
+typedef struct {
+	int nDim, nLevel, mode;
+	double *in;        // [nDim] the next sample, filled in by the user
+	double *shift;     // [nLevel][CORR_P][nDim] recent values of each level
+	double *accum;     // [nLevel][nDim] sums for the next level
+	double *corr;      // [nLevel][CORR_P] sums of products
+	double *nCorr;     // [nLevel][CORR_P] number of products
+	int *nShift, *insert, *nAccum;  // [nLevel]
+} Correlator;
+
+void CorrelatorInit (Correlator *c, Arena *a, int nDim, int nLevel, int mode);
+void CorrelatorZero (Correlator *c);
+void CorrelatorPush (Correlator *c);
+int  CorrelatorResult (Correlator *c, int nc, double *lag, double *val);
+double CorrelatorIntegral (int n, double *lag, double *val);
+
+#endif /* __MD_CORRELATOR_H__ */
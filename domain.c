@@ -0,0 +1,330 @@
+/*
+ * Domain decomposition over MPI ranks
+ *
+ * Rank r has the cell rows from r * cells.y / nRanks on, at least two, so
+ * the ghost rows below and above its slab are different ones. Whether a
+ * molecule is in a row is decided by CellRow(), the same as for the cells,
+ * so the ranks always agree on who owns it and the ghosts land in the
+ * ghost rows. A molecule moves less than a cell row in a step, so it only
+ * migrates to the rank next to it.
+ *
+ * Ghost positions are received straight into mol[].r, through a datatype
+ * that strides over the other members of Mol.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef USE_MPI
+#	include <mpi.h>
+#endif
+
+#include "in_vdefs.h"
+#include "in_mddefs.h"
+#include "simulation.h"
+#include "transport.h"
+#include "structure.h"
+#include "cluster.h"
+#include "hexatic.h"
+#include "replica.h"
+#include "shear.h"
+#include "harddisk.h"
+#include "initconf.h"
+#include "shmexport.h"
+#include "trajectory.h"
+#include "eqcache.h"
+#include "domain.h"
+
+// Room in mol[] for this many times the even share of the molecules in the
+// slab and its ghost rows
+#define DOMAIN_ROOM  2
+
+int nRanks = 1, rankId = 0;
+int domRowLo, domRowHi;
+
+
+// Switch off what does not work with more than one rank; called before
+// the system is set up
+void DomainInit (void)
+{
+	if (nRanks == 1) return;
+	// Told once, by the rank that shows its messages
+	if (rankId == 0 && (corrPeriod || msdPeriod || skPeriod || clusterPeriod || hexPeriod ||
+			nReplicas > 1 || shearRate != 0. || hardDisks || shmName[0] ||
+			trajName[0] || cacheDir[0] || initLattice == INIT_RANDOM))
+		LogWarn("Warning: correlations, MSD, S(k), clusters, psi6, replicas, shear, "
+			"hard discs, random packing, shmName, trajName and cacheDir are off with "
+			"%d ranks\n",
+			nRanks);
+	corrPeriod = msdPeriod = skPeriod = clusterPeriod = hexPeriod = 0;
+	nReplicas = 0;
+	shearRate = 0.;
+	hardDisks = 0;
+	shmName[0] = '\0';
+	trajName[0] = '\0';
+	cacheDir[0] = '\0';
+	if (initLattice == INIT_RANDOM) initLattice = INIT_SQUARE;
+}
+
+// Return: whether position r lies in the slab of this rank
+int DomainOwns (VecR *r)
+{
+	int y = CellRow (r);
+
+	return y >= domRowLo && y < domRowHi;
+}
+
+#ifdef USE_MPI
+
+#define TAG_COUNT    10
+#define TAG_MIGRATE  20
+#define TAG_HALO     30
+
+typedef struct {
+	VecR r, rv;
+	VecI image;
+} Migrant;
+
+// Ranks of the slabs below [0] and above [1]
+int neighbour[2];
+
+// Molecules leaving down [0] and up [1], and arriving from below and above
+Migrant *migrantOut[2], *migrantIn[2];
+int migrantOutMax[2], migrantInMax[2];
+
+// Positions sent down and up as ghosts, the number of ghosts received from
+// below and above, and the transfers in flight
+VecR *haloOut[2];
+int haloOutMax[2], nHaloOut[2], nGhost[2];
+MPI_Request haloReq[4];
+MPI_Datatype molPosType = MPI_DATATYPE_NULL;
+
+// Bytes of the cell rows of every rank and where they start, for
+// DomainGatherRows()
+int *gatherCount, *gatherOffset;
+
+
+static int SlabLo (int r)
+{
+	return (long) r * cells.y / nRanks;
+}
+
+static void Abort (void)
+{
+	LogFlush ();
+	MPI_Abort (MPI_COMM_WORLD, 1);
+}
+
+// Return: buf with room for n elements of the given size, grown if needed
+static void *Room (void *buf, int *max, int n, size_t size)
+{
+	if (n <= *max) return buf;
+	*max = Max (n, 2 * *max);
+	if (!(buf = realloc (buf, (size_t) *max * size))) {
+		LogError("Error: rank %d: out of memory for the exchange buffers\n", rankId);
+		Abort ();
+	}
+	return buf;
+}
+
+static void CheckRoom (int n)
+{
+	if (n > nMolMax) {
+		LogError("Error: rank %d: %d molecules, room for %d; use more cell rows per rank\n",
+			rankId, n, nMolMax);
+		Abort ();
+	}
+}
+
+void DomainStart (int *argc, char ***argv)
+{
+	int provided;
+
+	// Only the main thread talks to the other ranks
+	MPI_Init_thread (argc, argv, MPI_THREAD_FUNNELED, &provided);
+	MPI_Comm_size (MPI_COMM_WORLD, &nRanks);
+	MPI_Comm_rank (MPI_COMM_WORLD, &rankId);
+}
+
+void DomainEnd (void)
+{
+	if (molPosType != MPI_DATATYPE_NULL) MPI_Type_free (&molPosType);
+	MPI_Finalize ();
+}
+
+// Cut the region into slabs, once the cells are known; with more than one
+// rank nMol is 0 afterwards, until the molecules are placed
+void DomainSlabs (void)
+{
+	MPI_Datatype pos;
+
+	domRowLo = 0;
+	domRowHi = cells.y;
+	nMolOwn = nMolMax = nMol;
+	if (nRanks == 1) return;
+	if (cells.y < 2 * nRanks) {
+		LogError("Error: %d cell rows are too few for %d ranks, they need two each\n",
+			cells.y, nRanks);
+		Abort ();
+	}
+	domRowLo = SlabLo (rankId);
+	domRowHi = SlabLo (rankId + 1);
+	neighbour[0] = (rankId + nRanks - 1) % nRanks;
+	neighbour[1] = (rankId + 1) % nRanks;
+	nMolMax = (int) Min ((long long) nMolAll,
+		(long long) DOMAIN_ROOM * (domRowHi - domRowLo + 2) * nMolAll / cells.y + 64);
+	nMol = nMolOwn = 0;
+
+	if (molPosType == MPI_DATATYPE_NULL) {
+		MPI_Type_contiguous (sizeof (VecR) / sizeof (double), MPI_DOUBLE, &pos);
+		MPI_Type_create_resized (pos, 0, sizeof (Mol), &molPosType);
+		MPI_Type_commit (&molPosType);
+		MPI_Type_free (&pos);
+	}
+	if (!gatherCount) {
+		gatherCount = malloc (nRanks * sizeof (int));
+		gatherOffset = malloc (nRanks * sizeof (int));
+		if (!gatherCount || !gatherOffset) {
+			LogError("Error: out of memory for the domains\n");
+			Abort ();
+		}
+	}
+	message("Domains: %d ranks, this one has cell rows %d to %d, room for %d molecules\n",
+		nRanks, domRowLo, domRowHi - 1, nMolMax);
+}
+
+// Hand the molecules that left the slab to the ranks next to it; they must
+// have been wrapped into the region
+void DomainMigrate (void)
+{
+	Migrant *m;
+	int d, k, n, nIn[2], nOut[2], y;
+
+	if (nRanks == 1) return;
+	nOut[0] = nOut[1] = 0;
+	n = 0;
+	while (n < nMolOwn) {
+		y = CellRow (&mol[n].r);
+		if (y >= domRowLo && y < domRowHi) {
+			++ n;
+			continue;
+		}
+		d = y == domRowHi % cells.y;
+		if (! d && y != (domRowLo + cells.y - 1) % cells.y) {
+			LogError("Error: rank %d: a molecule moved more than a cell row in a step\n", rankId);
+			Abort ();
+		}
+		migrantOut[d] = Room (migrantOut[d], &migrantOutMax[d], nOut[d] + 1, sizeof (Migrant));
+		m = &migrantOut[d][nOut[d] ++];
+		m->r = mol[n].r;
+		m->rv = mol[n].rv;
+		m->image = molImage[n];
+		// The last one takes its place, and is looked at next
+		-- nMolOwn;
+		mol[n] = mol[nMolOwn];
+		molImage[n] = molImage[nMolOwn];
+	}
+	for (d = 0; d < 2; d ++) {
+		MPI_Sendrecv (&nOut[d], 1, MPI_INT, neighbour[d], TAG_COUNT + d,
+			&nIn[d], 1, MPI_INT, neighbour[1 - d], TAG_COUNT + d,
+			MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+		migrantIn[d] = Room (migrantIn[d], &migrantInMax[d], nIn[d], sizeof (Migrant));
+		MPI_Sendrecv (migrantOut[d], nOut[d] * (int) sizeof (Migrant), MPI_BYTE,
+			neighbour[d], TAG_MIGRATE + d,
+			migrantIn[d], nIn[d] * (int) sizeof (Migrant), MPI_BYTE,
+			neighbour[1 - d], TAG_MIGRATE + d, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+	}
+	CheckRoom (nMolOwn + nIn[0] + nIn[1]);
+	for (d = 0; d < 2; d ++) {
+		for (k = 0; k < nIn[d]; k ++) {
+			m = &migrantIn[d][k];
+			mol[nMolOwn].r = m->r;
+			mol[nMolOwn].rv = m->rv;
+			molImage[nMolOwn] = m->image;
+			++ nMolOwn;
+		}
+	}
+	nMol = nMolOwn;
+}
+
+// Send the molecules in the outer rows of the slab to the ranks next to it
+// and start receiving theirs as ghosts. Afterwards nMol counts the ghosts,
+// but their positions are only there after DomainHaloFinish().
+void DomainHaloStart (void)
+{
+	int d, n, y;
+
+	if (nRanks == 1) return;
+	nHaloOut[0] = nHaloOut[1] = 0;
+	for (n = 0; n < nMolOwn; n ++) {
+		y = CellRow (&mol[n].r);
+		if (y == domRowLo) d = 0;
+		else if (y == domRowHi - 1) d = 1;
+		else continue;
+		haloOut[d] = Room (haloOut[d], &haloOutMax[d], nHaloOut[d] + 1, sizeof (VecR));
+		haloOut[d][nHaloOut[d] ++] = mol[n].r;
+	}
+	// Ghosts from below arrive with those going up, d = 1
+	for (d = 0; d < 2; d ++) {
+		MPI_Sendrecv (&nHaloOut[d], 1, MPI_INT, neighbour[d], TAG_COUNT + 2 + d,
+			&nGhost[1 - d], 1, MPI_INT, neighbour[1 - d], TAG_COUNT + 2 + d,
+			MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+	}
+	CheckRoom (nMolOwn + nGhost[0] + nGhost[1]);
+	MPI_Irecv (&mol[nMolOwn].r, nGhost[0], molPosType, neighbour[0], TAG_HALO + 1,
+		MPI_COMM_WORLD, &haloReq[0]);
+	MPI_Irecv (&mol[nMolOwn + nGhost[0]].r, nGhost[1], molPosType, neighbour[1], TAG_HALO,
+		MPI_COMM_WORLD, &haloReq[1]);
+	for (d = 0; d < 2; d ++) {
+		MPI_Isend (haloOut[d], nHaloOut[d] * (int) (sizeof (VecR) / sizeof (double)),
+			MPI_DOUBLE, neighbour[d], TAG_HALO + d, MPI_COMM_WORLD, &haloReq[2 + d]);
+	}
+	nMol = nMolOwn + nGhost[0] + nGhost[1];
+}
+
+void DomainHaloFinish (void)
+{
+	if (nRanks == 1) return;
+	MPI_Waitall (4, haloReq, MPI_STATUSES_IGNORE);
+}
+
+// Add up the n values at v over all ranks, in place
+void DomainSum (double *v, int n)
+{
+	if (nRanks == 1) return;
+	MPI_Allreduce (MPI_IN_PLACE, v, n, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+}
+
+// Give every rank the elements of all cell rows of the array rows, of the
+// given size, each rank having filled in those of its slab
+void DomainGatherRows (void *rows, int size)
+{
+	int r;
+
+	if (nRanks == 1) return;
+	for (r = 0; r < nRanks; r ++) {
+		gatherOffset[r] = SlabLo (r) * size;
+		gatherCount[r] = SlabLo (r + 1) * size - gatherOffset[r];
+	}
+	MPI_Allgatherv (MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, rows, gatherCount, gatherOffset,
+		MPI_BYTE, MPI_COMM_WORLD);
+}
+
+#else /* USE_MPI */
+
+void DomainStart (int *argc, char ***argv) { }
+void DomainEnd (void) { }
+
+void DomainSlabs (void)
+{
+	domRowLo = 0;
+	domRowHi = cells.y;
+	nMolOwn = nMolMax = nMol;
+}
+
+void DomainMigrate (void) { }
+void DomainHaloStart (void) { }
+void DomainHaloFinish (void) { }
+void DomainSum (double *v, int n) { }
+void DomainGatherRows (void *rows, int size) { }
+
+#endif /* USE_MPI */
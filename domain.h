@@ -0,0 +1,52 @@
+/*
+ * Domain decomposition over MPI ranks
+ *
+ * Built with -DUSE_MPI (and an MPI compiler, e.g. mpicc) the region is cut
+ * into slabs of whole cell rows, one per rank, and each rank keeps only the
+ * molecules in its slab. Started with a single rank, or built without MPI,
+ * there is one slab covering the region and nothing changes.
+ *
+ * The first nMolOwn entries of mol[] are the molecules of the rank, the
+ * ones after them up to nMol are ghosts: copies of the molecules in the
+ * rows next to the slab, which the neighbouring ranks own. They keep their
+ * (wrapped) place in the region, so the cells and the force loop work on
+ * them as on any other molecule; cells.y counts the rows of the whole
+ * region and a rank only touches those of its slab and the two ghost rows.
+ *
+ * Every step the molecules that left the slab move to the neighbouring
+ * rank, DomainMigrate(), and then the ghosts are sent. DomainHaloStart()
+ * only starts the transfer, the forces in the interior rows of the slab are
+ * computed meanwhile, and DomainHaloFinish() waits for the ghosts needed
+ * by the two outer rows. The sums for the properties are added up over all
+ * ranks; with reproSums the row sums are gathered and every rank adds up
+ * all rows in the same order, so they still do not depend on the number of
+ * threads. They do on the number of ranks, as migration reorders mol[] and
+ * with it the terms of the forces.
+ *
+ * The modules that need all molecules at once (correlations, S(k),
+ * clusters, psi6, replicas, shear, hard discs, random packing, shared
+ * memory export, trajectories, the cache of equilibrated states) are
+ * switched off with more than one rank, see DomainInit().
+ */
+#ifndef __MD_DOMAIN_H__
+#define __MD_DOMAIN_H__
+
+#include "in_vdefs.h"
+
+// Number of ranks and the one of this process
+extern int nRanks, rankId;
+// Cell rows [domRowLo, domRowHi) of the slab of this rank
+extern int domRowLo, domRowHi;
+
+void DomainStart (int *argc, char ***argv);
+void DomainEnd (void);
+void DomainInit (void);
+void DomainSlabs (void);
+int  DomainOwns (VecR *r);
+void DomainMigrate (void);
+void DomainHaloStart (void);
+void DomainHaloFinish (void);
+void DomainSum (double *v, int n);
+void DomainGatherRows (void *rows, int size);
+
+#endif /* __MD_DOMAIN_H__ */
@@ -0,0 +1,193 @@
+/*
+ * Cache of equilibrated configurations
+ *
+ * An entry is a CacheHeader followed by the positions and velocities of
+ * the molecules as doubles. It is written under a temporary name and then
+ * renamed, so runs sharing the directory never read half an entry; its
+ * line in the index is appended afterwards. The closest state point is the
+ * one with the smallest sum of the squared relative differences in density
+ * and temperature.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "in_vdefs.h"
+#include "in_mddefs.h"
+#include "simulation.h"
+#include "shear.h"
+#include "harddisk.h"
+#include "domain.h"
+#include "eqcache.h"
+
+// Inputs: the directory (no cache if empty), steps to re-equilibrate a
+// cached state and whether to keep the final state of a run
+char cacheDir[CACHE_NAME_MAX] = "";
+int  cacheEquil = 500, cacheSave = 1;
+
+// Room for the name of an entry, and for it in the directory
+#define CACHE_ENTRY_MAX  64
+#define CACHE_PATH_MAX   (CACHE_NAME_MAX + CACHE_ENTRY_MAX + 8)
+
+
+// FNV-1a hash of n bytes at p, continuing from h
+static unsigned long long Fnv (unsigned long long h, const void *p, size_t n)
+{
+	const unsigned char *c = p;
+
+	while (n --) h = (h ^ *c ++) * 1099511628211ULL;
+	return h;
+}
+
+// Hash of the system: the number of molecules and the potential
+static unsigned long long CacheSystem (void)
+{
+	unsigned long long h = 14695981039346656037ULL;
+	int dim = n_dimensions;
+
+	h = Fnv (h, &nMol, sizeof (nMol));
+	h = Fnv (h, &dim, sizeof (dim));
+	return Fnv (h, &rCut, sizeof (rCut));
+}
+
+// Hash of the system at the current state point, which names its entry
+static unsigned long long CacheKey (unsigned long long system)
+{
+	unsigned long long h = system;
+
+	h = Fnv (h, &density, sizeof (density));
+	return Fnv (h, &temperature, sizeof (temperature));
+}
+
+static int CacheUsable (void)
+{
+	return cacheDir[0] && !hardDisks && shearRate == 0. && nRanks == 1;
+}
+
+// Find the entry of system closest to the current state point and write
+// its name to name, of CACHE_ENTRY_MAX bytes.
+// Return: 0 if there is one, -1 otherwise
+static int CacheFind (unsigned long long system, char *name)
+{
+	FILE *f;
+	char path[CACHE_PATH_MAX], entry[CACHE_ENTRY_MAX];
+	unsigned long long s;
+	double d, dBest = -1., dens, temp;
+
+	snprintf (path, sizeof (path), "%s/%s", cacheDir, CACHE_INDEX);
+	if (!(f = fopen (path, "r"))) return -1;
+	while (fscanf (f, "%llx %lf %lf %63s", &s, &dens, &temp, entry) == 4) {
+		if (s != system || dens <= 0. || temp <= 0.) continue;
+		d = Sqr (dens / density - 1.) + Sqr (temp / temperature - 1.);
+		if (dBest < 0. || d < dBest) {
+			dBest = d;
+			strcpy (name, entry);
+		}
+	}
+	fclose (f);
+	return dBest < 0. ? -1 : 0;
+}
+
+// Replace the configuration by the cached one closest to the current state
+// point, scaled to it.
+// Return: 1 if there was one, 0 otherwise
+int CacheLoad (void)
+{
+	FILE *f;
+	CacheHeader ch;
+	char name[CACHE_ENTRY_MAX], path[CACHE_PATH_MAX];
+	VecR scale, *buf;
+	double vv, fac;
+	int n, ok;
+
+	if (!CacheUsable () || CacheFind (CacheSystem (), name) != 0) return 0;
+	snprintf (path, sizeof (path), "%s/%s", cacheDir, name);
+	if (!(f = fopen (path, "rb"))) {
+		LogWarn("Warning: could not read the cached state %s, starting afresh\n", path);
+		return 0;
+	}
+	AllocMem (buf, 2 * (size_t) nMol, VecR);
+	ok = buf && fread (&ch, sizeof (ch), 1, f) == 1 && ch.magic == CACHE_MAGIC &&
+		ch.version == CACHE_VERSION && ch.nMol == nMol && ch.system == CacheSystem () &&
+		fread (buf, sizeof (VecR), 2 * (size_t) nMol, f) == 2 * (size_t) nMol;
+	fclose (f);
+	if (!ok) {
+		LogWarn("Warning: could not read the cached state %s, starting afresh\n", path);
+		free (buf);
+		return 0;
+	}
+
+	// Into the current region, at the current temperature
+	VSet (scale, region.x / ch.region[0], region.y / ch.region[1]);
+	VZero (vSum);
+	DO_MOL {
+		VMul (mol[n].r, buf[2 * n], scale);
+		mol[n].rv = buf[2 * n + 1];
+		VVAdd (vSum, mol[n].rv);
+	}
+	free (buf);
+	vv = 0.;
+	DO_MOL {
+		VVSAdd (mol[n].rv, - 1. / nMol, vSum);
+		vv += VLenSq (mol[n].rv);
+	}
+	fac = vv > 0. ? velMag * sqrt (nMol / vv) : 0.;
+	DO_MOL VScale (mol[n].rv, fac);
+	message("Starting from the cached state at density %.4f, temperature %.4f (%s), "
+		"%d steps to settle\n", ch.density, ch.temperature, name, cacheEquil);
+	return 1;
+}
+
+// Keep the current state as the equilibrated one of the current state point
+void CacheSave (void)
+{
+	FILE *f;
+	CacheHeader ch;
+	char found[CACHE_ENTRY_MAX], name[CACHE_ENTRY_MAX], path[CACHE_PATH_MAX],
+		tmp[CACHE_PATH_MAX];
+	int listed, n, ok;
+
+	if (!CacheUsable () || !cacheSave || stepCount == 0) return;
+	memset (&ch, 0, sizeof (ch));
+	ch.magic = CACHE_MAGIC;
+	ch.version = CACHE_VERSION;
+	ch.nMol = nMol;
+	ch.system = CacheSystem ();
+	ch.density = density;
+	ch.temperature = temperature;
+	ch.region[0] = region.x;
+	ch.region[1] = region.y;
+	snprintf (name, sizeof (name), "%016llx.state", CacheKey (ch.system));
+	snprintf (path, sizeof (path), "%s/%s", cacheDir, name);
+	snprintf (tmp, sizeof (tmp), "%s/%s.tmp", cacheDir, name);
+	if (!(f = fopen (tmp, "wb"))) {
+		LogError("Error: could not write the cached state %s\n", tmp);
+		return;
+	}
+	ok = fwrite (&ch, sizeof (ch), 1, f) == 1;
+	for (n = 0; ok && n < nMol; n ++)
+		ok = fwrite (&mol[n].r, sizeof (VecR), 1, f) == 1 &&
+			fwrite (&mol[n].rv, sizeof (VecR), 1, f) == 1;
+	if (fclose (f) != 0) ok = 0;
+	// An entry of the same state point is replaced, and already listed
+	listed = CacheFind (ch.system, found) == 0 && strcmp (found, name) == 0;
+#ifdef _WINDOWS
+	// rename() does not replace files there
+	remove (path);
+#endif
+	if (!ok || rename (tmp, path) != 0) {
+		LogError("Error: could not write the cached state %s\n", path);
+		remove (tmp);
+		return;
+	}
+	message("Final state cached as %s\n", path);
+	if (listed) return;
+	snprintf (tmp, sizeof (tmp), "%s/%s", cacheDir, CACHE_INDEX);
+	if (!(f = fopen (tmp, "a"))) {
+		LogError("Error: could not add to the cache index %s\n", tmp);
+		return;
+	}
+	fprintf (f, "%016llx %.17g %.17g %s\n", ch.system, density, temperature, name);
+	fclose (f);
+}
@@ -0,0 +1,39 @@
+/*
+ * Cache of equilibrated configurations
+ *
+ * With cacheDir set, the final state of every run is kept in that
+ * directory, under a name that is a hash of the system (number of
+ * molecules and potential) and the state point (density, temperature).
+ * The next run of the same system then starts from the cached state
+ * closest to its own state point instead of the lattice: the region and
+ * the positions are scaled to its density, the velocities to its
+ * temperature, and cacheEquil steps with the velocities rescaled after
+ * each let it settle before the run proper. Every entry is also listed in
+ * the file CACHE_INDEX in the directory, which is searched for the closest
+ * one.
+ *
+ * Hard discs and shear use other dynamics and are not cached.
+ */
+#ifndef __MD_EQCACHE_H__
+#define __MD_EQCACHE_H__
+
+#define CACHE_MAGIC     0x43514d4d  // "MMQC"
+#define CACHE_VERSION   1
+#define CACHE_NAME_MAX  256
+#define CACHE_INDEX     "index.txt"
+
+typedef struct {
+	unsigned int magic, version;
+	int nMol, pad;
+	unsigned long long system;   // hash of the system, see CacheSystem()
+	double density, temperature;
+	double region[2];
+} CacheHeader;
+
+extern char cacheDir[CACHE_NAME_MAX];
+extern int  cacheEquil, cacheSave;
+
+int  CacheLoad (void);
+void CacheSave (void);
+
+#endif /* __MD_EQCACHE_H__ */
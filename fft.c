@@ -0,0 +1,94 @@
+/*
+ * Fast Fourier transform
+ */
+#include <math.h>
+
+#ifdef USE_FFTW
+#	include <fftw3.h>
+#endif
+
+#include "fft.h"
+
+// Return: the smallest power of 2 not below n (at least 2), so a grid is
+// never coarser than asked for
+int FftSize (int n)
+{
+	int p = 2;
+
+	while (p < n) p *= 2;
+	return p;
+}
+
+#ifdef USE_FFTW
+
+// The plan is kept for as long as the array and the sizes stay the same
+void Fft2D (double *a, int nx, int ny)
+{
+	static fftw_plan plan;
+	static double *planData;
+	static int planX, planY;
+
+	if (!plan || a != planData || nx != planX || ny != planY) {
+		if (plan) fftw_destroy_plan (plan);
+		plan = fftw_plan_dft_2d (ny, nx, (fftw_complex *) a, (fftw_complex *) a,
+			FFTW_FORWARD, FFTW_ESTIMATE);
+		planData = a;
+		planX = nx;
+		planY = ny;
+	}
+	fftw_execute (plan);
+}
+
+#else
+
+// Transform of the n complex values a[0], a[stride], ... (n a power of 2)
+static void Fft1D (double *a, int n, int stride)
+{
+	double wr, wi, wpr, wpi, tr, ti, t, *p, *q;
+	int i, j, k, m, len;
+
+	// Bit reversal permutation
+	for (i = 0, j = 0; i < n; i ++) {
+		if (i < j) {
+			p = a + 2 * i * stride;
+			q = a + 2 * j * stride;
+			t = p[0]; p[0] = q[0]; q[0] = t;
+			t = p[1]; p[1] = q[1]; q[1] = t;
+		}
+		for (m = n >> 1; m >= 1 && (j & m); m >>= 1) j ^= m;
+		j |= m;
+	}
+
+	// Butterflies, with the twiddle factors by recurrence
+	for (len = 2; len <= n; len <<= 1) {
+		wpr = cos (2. * M_PI / len);
+		wpi = - sin (2. * M_PI / len);
+		wr = 1.;
+		wi = 0.;
+		for (k = 0; k < len / 2; k ++) {
+			for (i = k; i < n; i += len) {
+				p = a + 2 * i * stride;
+				q = a + 2 * (i + len / 2) * stride;
+				tr = wr * q[0] - wi * q[1];
+				ti = wr * q[1] + wi * q[0];
+				q[0] = p[0] - tr;
+				q[1] = p[1] - ti;
+				p[0] += tr;
+				p[1] += ti;
+			}
+			t = wr;
+			wr = wr * wpr - wi * wpi;
+			wi = t * wpi + wi * wpr;
+		}
+	}
+}
+
+void Fft2D (double *a, int nx, int ny)
+{
+	int x, y;
+
+	for (y = 0; y < ny; y ++) Fft1D (a + 2 * nx * y, nx, 1);
+	for (x = 0; x < nx; x ++) Fft1D (a + 2 * x, ny, nx);
+}
+
+#endif /* USE_FFTW */
@@ -0,0 +1,15 @@
+/*
+ * Fast Fourier transform
+ *
+ * In-place forward transform of a two-dimensional complex array, stored
+ * row by row with the real and imaginary parts of each element next to each
+ * other. Built with -DUSE_FFTW this uses FFTW, otherwise the bundled
+ * radix-2 transform, which needs sizes that are powers of 2.
+ */
+#ifndef __MD_FFT_H__
+#define __MD_FFT_H__
+
+void Fft2D (double *a, int nx, int ny);
+int  FftSize (int n);
+
+#endif /* __MD_FFT_H__ */
@@ -0,0 +1,407 @@
+/*
+ * Event-driven dynamics of hard discs
+ *
+ * Every disc has one pending event, the earliest of its next cell crossing
+ * and its first collision with a disc in the neighbouring cells, and the
+ * discs sit in a binary heap ordered by that time. A collision event keeps
+ * the collision count of the partner at the time it was predicted; if the
+ * partner has collided since, the event is stale and the disc just looks
+ * for its next event. So events never have to be removed from the heap.
+ *
+ * Discs are only moved when they take part in an event: mol[n].r is the
+ * position at time discTime[n]. Each disc is listed in the cell of
+ * discCell[n], which changes only at its crossing events, so round-off can
+ * never put a disc in the wrong cell.
+ */
+#include <stdio.h>
+#include <math.h>
+
+#include "in_vdefs.h"
+#include "in_mddefs.h"
+#include "simulation.h"
+#include "replica.h"
+#include "shear.h"
+#include "initconf.h"
+#include "harddisk.h"
+
+// Input: event-driven hard discs instead of the soft potential
+int hardDisks = 0;
+
+#define EVENT_CROSS    0
+#define EVENT_COLLIDE  1
+
+// Pending event of every disc; partner and its collision count for a
+// collision, or the direction (0 .. 3: +x, -x, +y, -y) of a crossing
+double *eventTime;
+int *eventType, *eventPartner, *eventCount;
+
+// Binary heap of the discs by event time, heap[1] first; heapPos[n] is
+// where disc n is
+int *heap, *heapPos;
+
+// Local time, collision count and cell of every disc, and the cells as
+// doubly linked lists
+double *discTime;
+int *collCount, *discCell, *cellHead, *cellNext, *cellPrev;
+VecR cellWid;
+
+// Current time, and sums since the last sample: collisions, virial (the
+// sum of r_ij . dp_i) and its tensor
+double hdTime, hdSampleTime, hdVir;
+Ten2R2 hdTVir, tvir;
+long hdCollisions, hdCollisionsRun, hdEvents;
+double hdRunStart;
+
+
+/*
+ * Heap
+ */
+static void HeapSwap (int a, int b)
+{
+	int t = heap[a];
+
+	heap[a] = heap[b];
+	heap[b] = t;
+	heapPos[heap[a]] = a;
+	heapPos[heap[b]] = b;
+}
+
+// Restore the heap after the event time of disc n changed
+static void HeapUpdate (int n)
+{
+	int k = heapPos[n], c;
+
+	while (k > 1 && eventTime[heap[k / 2]] > eventTime[heap[k]]) {
+		HeapSwap (k, k / 2);
+		k /= 2;
+	}
+	while ((c = 2 * k) <= nMol) {
+		if (c < nMol && eventTime[heap[c + 1]] < eventTime[heap[c]]) ++ c;
+		if (eventTime[heap[c]] >= eventTime[heap[k]]) break;
+		HeapSwap (k, c);
+		k = c;
+	}
+}
+
+
+/*
+ * Cells
+ */
+static void CellAdd (int n, int c)
+{
+	discCell[n] = c;
+	cellPrev[n] = -1;
+	cellNext[n] = cellHead[c];
+	if (cellHead[c] >= 0) cellPrev[cellHead[c]] = n;
+	cellHead[c] = n;
+}
+
+static void CellRemove (int n)
+{
+	if (cellPrev[n] >= 0) cellNext[cellPrev[n]] = cellNext[n];
+	else cellHead[discCell[n]] = cellNext[n];
+	if (cellNext[n] >= 0) cellPrev[cellNext[n]] = cellPrev[n];
+}
+
+
+/*
+ * Prediction
+ */
+
+// Position of disc n at the current time, without moving it
+static void PosNow (VecR *r, int n)
+{
+	VSAdd (*r, mol[n].r, hdTime - discTime[n], mol[n].rv);
+}
+
+// Bring disc n up to the current time
+static void MoveDisc (int n)
+{
+	VVSAdd (mol[n].r, hdTime - discTime[n], mol[n].rv);
+	discTime[n] = hdTime;
+}
+
+// Time from now until discs n1, n2 touch, or a negative value if they
+// never do
+static double CollisionTime (int n1, int n2)
+{
+	VecR r1, r2, dr, dv;
+	double b, d, vv, rr;
+
+	PosNow (&r1, n1);
+	PosNow (&r2, n2);
+	VSub (dr, r1, r2);
+	VWrapAll (dr);
+	VSub (dv, mol[n1].rv, mol[n2].rv);
+	b = VDot (dr, dv);
+	if (b >= 0.) return -1.;
+	rr = VLenSq (dr);
+	// Touching already, after round-off: collide now
+	if (rr <= 1.) return 0.;
+	vv = VLenSq (dv);
+	d = Sqr (b) - vv * (rr - 1.);
+	if (d <= 0.) return -1.;
+	return (- b - sqrt (d)) / vv;
+}
+
+// Find the next event of disc n and put it in the heap
+static void Predict (int n)
+{
+	VecR r, lo;
+	VecI cc, m2v;
+	double t, tc;
+	int c, dx, dy, j, type = EVENT_CROSS, partner = 0;
+
+	// Leaving the cell
+	PosNow (&r, n);
+	cc.x = discCell[n] % cells.x;
+	cc.y = discCell[n] / cells.x;
+	lo.x = - 0.5 * region.x + cc.x * cellWid.x;
+	lo.y = - 0.5 * region.y + cc.y * cellWid.y;
+	t = 1e300;
+	if (mol[n].rv.x > 0.) {
+		t = (lo.x + cellWid.x - r.x) / mol[n].rv.x;
+		partner = 0;
+	} else if (mol[n].rv.x < 0.) {
+		t = (lo.x - r.x) / mol[n].rv.x;
+		partner = 1;
+	}
+	if (mol[n].rv.y > 0.) {
+		tc = (lo.y + cellWid.y - r.y) / mol[n].rv.y;
+		if (tc < t) {
+			t = tc;
+			partner = 2;
+		}
+	} else if (mol[n].rv.y < 0.) {
+		tc = (lo.y - r.y) / mol[n].rv.y;
+		if (tc < t) {
+			t = tc;
+			partner = 3;
+		}
+	}
+	t = Max (t, 0.);
+
+	// Collisions with the discs of this and the neighbouring cells
+	for (dy = - (cells.y > 1); dy <= (cells.y > 1); dy ++) {
+		m2v.y = (cc.y + dy + cells.y) % cells.y;
+		for (dx = - (cells.x > 1); dx <= (cells.x > 1); dx ++) {
+			m2v.x = (cc.x + dx + cells.x) % cells.x;
+			c = VLinear (m2v, cells);
+			for (j = cellHead[c]; j >= 0; j = cellNext[j]) {
+				if (j == n) continue;
+				tc = CollisionTime (n, j);
+				if (tc >= 0. && tc < t) {
+					t = tc;
+					type = EVENT_COLLIDE;
+					partner = j;
+				}
+			}
+		}
+	}
+	eventTime[n] = hdTime + t;
+	eventType[n] = type;
+	eventPartner[n] = partner;
+	if (type == EVENT_COLLIDE) eventCount[n] = collCount[partner];
+	HeapUpdate (n);
+}
+
+
+/*
+ * Events
+ */
+static void Cross (int n, int dir)
+{
+	VecI cc;
+
+	MoveDisc (n);
+	cc.x = discCell[n] % cells.x;
+	cc.y = discCell[n] / cells.x;
+	switch (dir) {
+	case 0:
+		if (++ cc.x == cells.x) {
+			cc.x = 0;
+			mol[n].r.x -= region.x;
+			++ molImage[n].x;
+		}
+		break;
+	case 1:
+		if (-- cc.x < 0) {
+			cc.x = cells.x - 1;
+			mol[n].r.x += region.x;
+			-- molImage[n].x;
+		}
+		break;
+	case 2:
+		if (++ cc.y == cells.y) {
+			cc.y = 0;
+			mol[n].r.y -= region.y;
+			++ molImage[n].y;
+		}
+		break;
+	case 3:
+		if (-- cc.y < 0) {
+			cc.y = cells.y - 1;
+			mol[n].r.y += region.y;
+			-- molImage[n].y;
+		}
+		break;
+	}
+	CellRemove (n);
+	CellAdd (n, VLinear (cc, cells));
+	Predict (n);
+}
+
+static void Collide (int n1, int n2)
+{
+	VecR dr, dv;
+	double b;
+
+	MoveDisc (n1);
+	MoveDisc (n2);
+	VSub (dr, mol[n1].r, mol[n2].r);
+	VWrapAll (dr);
+	VSub (dv, mol[n1].rv, mol[n2].rv);
+	b = VDot (dr, dv) / VLenSq (dr);
+	VScale (dr, b);
+	// dr is now the velocity change of n2, minus that of n1
+	VVSub (mol[n1].rv, dr);
+	VVAdd (mol[n2].rv, dr);
+	// Virial r_12 . dp_1, with r_12 = dr / b and dp_1 = - dr
+	hdVir -= VLenSq (dr) / b;
+	VSCopy (dv, 1. / b, dr);
+	VScale (dr, - 1.);
+	TVVAddDyad (hdTVir, dv, dr);
+	++ collCount[n1];
+	++ collCount[n2];
+	++ hdCollisions;
+	Predict (n1);
+	Predict (n2);
+}
+
+
+/*
+ * Interface
+ */
+
+// Set up the cells and the first events, taking the memory from arena a.
+// Return: 0, or -1 if the discs overlap at the start
+int HardDiskInit (Arena *a)
+{
+	VecR rs, invWid;
+	VecI cc;
+	int c, n;
+
+	hdTime = hdSampleTime = hdRunStart = 0.;
+	hdVir = 0.;
+	TZero (hdTVir);
+	hdCollisions = hdCollisionsRun = hdEvents = 0;
+	if (!hardDisks) return 0;
+	if (nReplicas > 1 || shearRate != 0.) {
+		LogError("Error: replica exchange and shear are not available for hard discs\n");
+		return -1;
+	}
+	if (initMinDist < 1.) {
+		LogError("Error: the discs overlap at the start, lower the density\n");
+		return -1;
+	}
+	AllocMemArena (a, eventTime, nMol, double);
+	AllocMemArena (a, eventType, nMol, int);
+	AllocMemArena (a, eventPartner, nMol, int);
+	AllocMemArena (a, eventCount, nMol, int);
+	AllocMemArena (a, heap, nMol + 1, int);
+	AllocMemArena (a, heapPos, nMol, int);
+	AllocMemArena (a, discTime, nMol, double);
+	AllocMemArena (a, collCount, nMol, int);
+	AllocMemArena (a, discCell, nMol, int);
+	AllocMemArena (a, cellNext, nMol, int);
+	AllocMemArena (a, cellPrev, nMol, int);
+	AllocMemArena (a, cellHead, VProd (cells), int);
+
+	VDiv (cellWid, region, cells);
+	VDiv (invWid, cells, region);
+	for (c = 0; c < VProd (cells); c ++) cellHead[c] = -1;
+	DO_MOL {
+		VSAdd (rs, mol[n].r, 0.5, region);
+		VMul (cc, rs, invWid);
+		cc.x = Clamp (cc.x, 0, cells.x - 1);
+		cc.y = Clamp (cc.y, 0, cells.y - 1);
+		CellAdd (n, VLinear (cc, cells));
+		discTime[n] = 0.;
+		collCount[n] = 0;
+		heap[n + 1] = n;
+		heapPos[n] = n + 1;
+		eventTime[n] = 0.;
+	}
+	DO_MOL Predict (n);
+	message("Hard discs: %d x %d cells\n", cells.x, cells.y);
+	return 0;
+}
+
+// Handle all events up to time t, and bring every disc to that time
+void HardDiskAdvance (double t)
+{
+	int n;
+
+	while (eventTime[n = heap[1]] <= t) {
+		hdTime = eventTime[n];
+		++ hdEvents;
+		if (eventType[n] == EVENT_CROSS) Cross (n, eventPartner[n]);
+		else if (collCount[eventPartner[n]] != eventCount[n]) Predict (n);
+		else Collide (n, eventPartner[n]);
+	}
+	hdTime = t;
+	DO_MOL MoveDisc (n);
+}
+
+// Evaluate the observables, the pressure from the collisions since the
+// previous call
+void HardDiskProps (void)
+{
+	Ten2R2 tvvSum;
+	double dt;
+	int n;
+
+	VZero (vSum);
+	vvSum = 0.;
+	TZero (tvvSum);
+	DO_MOL {
+		VVAdd (vSum, mol[n].rv);
+		vvSum += VLenSq (mol[n].rv);
+		TVAddDyad (tvvSum, mol[n].rv);
+	}
+	// Time averages of the virial, as if from a force
+	dt = hdTime - hdSampleTime;
+	if (dt > 0.) {
+		virSum = hdVir / dt;
+		tvir = hdTVir;
+		TScale (tvir, 1. / dt);
+	}
+	uSum = 0.;
+	kinEnergy.val = 0.5 * vvSum / nMol;
+	totEnergy.val = kinEnergy.val;
+	pressure.val = density * (vvSum + virSum) / (nMol * n_dimensions);
+	pressure_xx.val = density * (tvvSum.xx + tvir.xx) / nMol;
+	pressure_xy.val = density * (tvvSum.xy + tvir.xy) / nMol;
+	pressure_yx.val = density * (tvvSum.yx + tvir.yx) / nMol;
+	pressure_yy.val = density * (tvvSum.yy + tvir.yy) / nMol;
+	hdCollisionsRun += hdCollisions;
+	hdCollisions = 0;
+	hdVir = 0.;
+	TZero (hdTVir);
+	hdSampleTime = hdTime;
+}
+
+void HardDiskReport (void)
+{
+	double t;
+
+	if (!hardDisks) return;
+	t = hdTime - hdRunStart;
+	hdCollisionsRun += hdCollisions;
+	hdCollisions = 0;
+	if (t <= 0. || hdCollisionsRun == 0) return;
+	message("Hard discs: %ld events, %ld collisions, mean free time %.4f\n",
+		hdEvents, hdCollisionsRun, 0.5 * nMol * t / hdCollisionsRun);
+	hdCollisionsRun = hdEvents = 0;
+	hdRunStart = hdTime;
+}
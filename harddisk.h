@@ -0,0 +1,25 @@
+/*
+ * Event-driven dynamics of hard discs
+ *
+ * With hardDisks set, the discs have unit diameter and no other
+ * interaction, and move in straight lines between elastic collisions. The
+ * engine jumps from one event (a collision or a disc entering another cell)
+ * to the next instead of integrating with a time step; a "step" of the
+ * simulation is then just a stretch of deltaT time units, after which all
+ * discs are brought up to date, so deltaT can be much larger than for the
+ * soft discs. The pressure follows from the momentum exchanged in the
+ * collisions.
+ */
+#ifndef __MD_HARDDISK_H__
+#define __MD_HARDDISK_H__
+
+#include "arena.h"
+
+extern int hardDisks;
+
+int  HardDiskInit (Arena *a);
+void HardDiskAdvance (double t);
+void HardDiskProps (void);
+void HardDiskReport (void);
+
+#endif /* __MD_HARDDISK_H__ */
@@ -0,0 +1,203 @@
+/*
+ * Bond-orientational order
+ *
+ * A sample takes three passes over the threads. The first finds the
+ * neighbours of every disc through the cells and adds up its bonds; the
+ * second divides by the number of neighbours and sums psi6 over the discs
+ * of each thread; the third visits all pairs up to hexRange and bins
+ * Re psi6(j) psi6*(k) by distance. Each pass only writes the discs and the
+ * bins of its own thread.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "in_vdefs.h"
+#include "in_mddefs.h"
+#include "threads.h"
+#include "simulation.h"
+#include "hexatic.h"
+
+// Inputs: steps between samples (0 for none), neighbour distance (0 for
+// HexNeighbourCut) and range of g6(r) (0 for HEX_RANGE_MAX or half the box)
+int hexPeriod = 0;
+double hexCut = 0., hexRange = 0.;
+
+// Per-thread partial sums, padded to whole cache lines
+typedef union {
+	struct {
+		double re, im, mag;
+	} s;
+	char pad[64];
+} HexSums;
+
+// psi6[2 n], psi6[2 n + 1]: real and imaginary part for disc n; hexNb[n]
+// its number of neighbours; hexBin[t]: bins of thread t, the pair count and
+// the sum of Re psi6(j) psi6*(k) interleaved
+double *psi6;
+int *hexNb;
+double **hexBin;
+HexSums *hexSums;
+double hexRc, hexRr, hexDr;
+
+// Sums over the samples since the last summary, and over the run
+double psiSum, psiSumRun, psiSqSumRun, localSumRun;
+int nHexSample, nHexSampleRun;
+
+
+// Take the memory from arena a and clear the sums
+void HexaticInit (Arena *a)
+{
+	int b, t;
+
+	psiSum = psiSumRun = psiSqSumRun = localSumRun = 0.;
+	nHexSample = nHexSampleRun = 0;
+	if (!hexPeriod) return;
+	hexRc = hexCut > 0. ? hexCut : HexNeighbourCut (density);
+	hexRr = hexRange > 0. ? hexRange : HEX_RANGE_MAX;
+	hexRr = Min (hexRr, 0.5 * Min (region.x, region.y));
+	hexDr = hexRr / HEX_BINS;
+	AllocMemArena (a, psi6, 2 * nMol, double);
+	AllocMemArena (a, hexNb, nMol, int);
+	AllocMemArena (a, hexSums, nThreadsUsed, HexSums);
+	AllocMemArena (a, hexBin, nThreadsUsed, double *);
+	for (t = 0; t < nThreadsUsed; t ++) {
+		AllocMemArena (a, hexBin[t], 2 * HEX_BINS, double);
+		for (b = 0; b < 2 * HEX_BINS; b ++) hexBin[t][b] = 0.;
+	}
+	message("psi6 with neighbours closer than %.4f, g6(r) up to r = %.4f\n",
+		hexRc, hexRr);
+}
+
+static void HexZero (int tid)
+{
+	int n;
+
+	DO_MOL_OF (tid) {
+		psi6[2 * n] = psi6[2 * n + 1] = 0.;
+		hexNb[n] = 0;
+	}
+}
+
+static void AddBond (int j1, int j2, VecR *dr, double rr, void *arg)
+{
+	double c, s;
+
+	HexBond (dr, rr, &c, &s);
+	psi6[2 * j1] += c;
+	psi6[2 * j1 + 1] += s;
+	++ hexNb[j1];
+}
+
+static void HexBonds (int tid)
+{
+	VisitPairs (tid, hexRc, AddBond, NULL);
+}
+
+static void HexNormalise (int tid)
+{
+	HexSums *hs = &hexSums[tid];
+	double re, im;
+	int n;
+
+	hs->s.re = hs->s.im = hs->s.mag = 0.;
+	DO_MOL_OF (tid) {
+		if (hexNb[n] > 0) {
+			psi6[2 * n] /= hexNb[n];
+			psi6[2 * n + 1] /= hexNb[n];
+		}
+		re = psi6[2 * n];
+		im = psi6[2 * n + 1];
+		hs->s.re += re;
+		hs->s.im += im;
+		hs->s.mag += sqrt (Sqr (re) + Sqr (im));
+	}
+}
+
+static void AddCorrelation (int j1, int j2, VecR *dr, double rr, void *arg)
+{
+	double *bin = arg;
+	int b;
+
+	b = (int) (sqrt (rr) / hexDr);
+	if (b >= HEX_BINS) return;
+	bin[2 * b] += 1.;
+	bin[2 * b + 1] += psi6[2 * j1] * psi6[2 * j2] + psi6[2 * j1 + 1] * psi6[2 * j2 + 1];
+}
+
+static void HexCorrelate (int tid)
+{
+	VisitPairs (tid, hexRr, AddCorrelation, hexBin[tid]);
+}
+
+void HexaticSample (void)
+{
+	double re, im, mag, psi;
+	int t;
+
+	if (!hexPeriod) return;
+	ThreadsRun (HexZero);
+	ThreadsRun (HexBonds);
+	ThreadsRun (HexNormalise);
+	ThreadsRun (HexCorrelate);
+
+	re = im = mag = 0.;
+	for (t = 0; t < nThreadsUsed; t ++) {
+		re += hexSums[t].s.re;
+		im += hexSums[t].s.im;
+		mag += hexSums[t].s.mag;
+	}
+	psi = sqrt (Sqr (re) + Sqr (im)) / nMol;
+	psiSum += psi;
+	psiSumRun += psi;
+	psiSqSumRun += Sqr (psi);
+	localSumRun += mag / nMol;
+	++ nHexSample;
+	++ nHexSampleRun;
+}
+
+// Average |<psi6>| since the previous summary, printed below its line
+void HexaticSummary (void)
+{
+	if (!hexPeriod || nHexSample == 0) return;
+	message("      |<psi6>| %.4f\n", psiSum / nHexSample);
+	psiSum = 0.;
+	nHexSample = 0;
+}
+
+// Print the averages over the run and write g(r) and g6(r) to filename;
+// g6(r) is normalised like g(r), so g6(r) / g(r) is the correlation of
+// the discs at distance r
+void HexaticReport (const char *filename)
+{
+	FILE *f;
+	double *bin, norm, r, g, g6, psi, chi;
+	int b, t;
+
+	if (!hexPeriod || nHexSampleRun == 0) return;
+	psi = psiSumRun / nHexSampleRun;
+	chi = nMol * (psiSqSumRun / nHexSampleRun - Sqr (psi));
+	message("Hexatic order over %d samples: |<psi6>| %.4f, susceptibility %.4f, local |psi6| %.4f\n",
+		nHexSampleRun, psi, chi, localSumRun / nHexSampleRun);
+
+	if (!(bin = calloc (2 * HEX_BINS, sizeof (double)))) return;
+	for (t = 0; t < nThreadsUsed; t ++) {
+		for (b = 0; b < 2 * HEX_BINS; b ++) bin[b] += hexBin[t][b];
+	}
+	if (!(f = fopen (filename, "w"))) {
+		LogError("Error: could not write g6(r) to %s.\n", filename);
+		free (bin);
+		return;
+	}
+	fprintf (f, "   r         g(r)        g6(r)       g6(r)/g(r)\n");
+	for (b = 0; b < HEX_BINS; b ++) {
+		r = (b + 0.5) * hexDr;
+		norm = nHexSampleRun * nMol * density * 2. * M_PI * r * hexDr;
+		g = bin[2 * b] / norm;
+		g6 = bin[2 * b + 1] / norm;
+		fprintf (f, "%9.4f %11.4e %11.4e %11.4e\n", r, g, g6,
+			bin[2 * b] > 0. ? bin[2 * b + 1] / bin[2 * b] : 0.);
+	}
+	fclose (f);
+	free (bin);
+}
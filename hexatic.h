@@ -0,0 +1,43 @@
+/*
+ * Bond-orientational order
+ *
+ * The local hexatic order parameter of a disc is psi6 = < exp(6 i theta) >
+ * over its neighbours, theta being the angle of the bond with the x axis;
+ * it is 1 in a perfect triangular lattice. Every hexPeriod steps psi6 is
+ * worked out for all discs, and the global |<psi6>| and the correlation
+ * g6(r) = < psi6(0) psi6*(r) > are accumulated.
+ */
+#ifndef __MD_HEXATIC_H__
+#define __MD_HEXATIC_H__
+
+#include "in_vdefs.h"
+#include "arena.h"
+
+// Number of bins of g6(r)
+#define HEX_BINS       200
+// Largest r of g6(r), unless half the box is smaller
+#define HEX_RANGE_MAX  10.
+
+extern int hexPeriod;
+extern double hexCut, hexRange;
+
+// Neighbour distance between the first and second shell of a triangular
+// lattice of the given density
+#define HexNeighbourCut(dens)  (0.5 * (1. + sqrt (3.)) * sqrt (2. / (sqrt (3.) * (dens))))
+
+// cos(6 theta) and sin(6 theta) of the bond dr, rr = |dr|^2: the real and
+// imaginary part of (x + i y)^6 / r^6
+static inline void HexBond (const VecR *dr, double rr, double *c, double *s)
+{
+	double x = dr->x, y = dr->y, xx = x * x, yy = y * y, r6 = rr * rr * rr;
+
+	*c = (xx * xx * xx - 15. * xx * yy * (xx - yy) - yy * yy * yy) / r6;
+	*s = x * y * (6. * xx * xx - 20. * xx * yy + 6. * yy * yy) / r6;
+}
+
+void HexaticInit (Arena *a);
+void HexaticSample (void);
+void HexaticSummary (void);
+void HexaticReport (const char *filename);
+
+#endif /* __MD_HEXATIC_H__ */
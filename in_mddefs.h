@@ -17,6 +17,9 @@
 
 #define AllocMem(a, n, t)  a = (t *) malloc ((n) * sizeof (t))
 
+// Allocate n elements of type t from Arena *ar, see arena.h
+#define AllocMemArena(ar, a, n, t)  a = (t *) ArenaAlloc (ar, (n) * sizeof (t))
+
 #define AllocMem2(a, n1, n2, t)                             \
    AllocMem (a, n1, t *);                                   \
    AllocMem (a[0], (n1) * (n2), t);                         \
@@ -27,6 +30,10 @@
 
 // Do statement following DO_MOL for every molecule, counter is n
 #define DO_MOL  for (n = 0; n < nMol; n ++)
+
+// Same, but only for the molecules owned by thread t (see threads.h)
+#define DO_MOL_OF(t)                                        \
+   for (n = threadInfo[t].molLo; n < threadInfo[t].molHi; n ++)
 
 // Wrap component t of vector v to region for periodic boundary
 // caution: v may not be more than two regions from zero
@@ -34,6 +41,16 @@
    if (v.t >= 0.5 * region.t)      v.t -= region.t;         \
    else if (v.t < -0.5 * region.t) v.t += region.t
 
+// Same, counting the boxes crossed in component t of image counter im
+#define VWrapImage(v, im, t)                                \
+   if (v.t >= 0.5 * region.t) {                             \
+      v.t -= region.t;                                      \
+      ++ im.t;                                              \
+   } else if (v.t < -0.5 * region.t) {                      \
+      v.t += region.t;                                      \
+      -- im.t;                                              \
+   }
+
 #if n_dimensions == 2
 /*
  * 2D macros
@@ -45,6 +62,29 @@
 #define VWrapAll(v)                                         \
    {VWrap (v, x);                                           \
    VWrap (v, y);}
+#define VWrapAllImage(v, im)                                \
+   {VWrapImage (v, im, x);                                  \
+   VWrapImage (v, im, y);}
+
+// Lees-Edwards boundaries: the periodic image above the region is moved
+// by shift along x. Wrapping in y shifts x, so y goes first.
+// caution: shift must lie in [-region.x / 2, region.x / 2)
+#define VWrapShear(v, shift)                                \
+   if (v.y >= 0.5 * region.y) {                             \
+      v.x -= shift;                                         \
+      v.y -= region.y;                                      \
+   } else if (v.y < -0.5 * region.y) {                      \
+      v.x += shift;                                         \
+      v.y += region.y;                                      \
+   }
+#define VWrapAllShear(v, shift)                             \
+   {VWrapShear (v, shift);                                  \
+   VWrap (v, x);}
+#define VWrapAllShearImage(v, im, shift)                    \
+   {if (v.y >= 0.5 * region.y) ++ im.y;                     \
+   else if (v.y < -0.5 * region.y) -- im.y;                 \
+   VWrapShear (v, shift);                                   \
+   VWrapImage (v, im, x);}
 
 /* End of 2D macros */
 #endif /* n_dimensions == 2 */
@@ -59,6 +99,10 @@
    {VWrap (v, x);                                           \
    VWrap (v, y);                                            \
    VWrap (v, z);}
+#define VWrapAllImage(v, im)                                \
+   {VWrapImage (v, im, x);                                  \
+   VWrapImage (v, im, y);                                   \
+   VWrapImage (v, im, z);}
 
 /* End of 3D macros */
 #endif /* n_dimensions == 3 */
@@ -71,18 +115,18 @@ typedef struct {
 } Prop;
 
 // Set property v to zero
-#define PropZero(v)  v.sum = v.sum2 = 0.
+#define PropZero(v)  (v).sum = (v).sum2 = 0.
 
 // Accumulate property, use after you have set v.val
-#define PropAccum(v)  v.sum += v.val, v.sum2 += Sqr (v.val)
+#define PropAccum(v)  (v).sum += (v).val, (v).sum2 += Sqr ((v).val)
 
 // Compute the average of property v
 // caution: n must match the number of times you called PropAccum()
 #define PropAvg(v, n) \
-   v.sum /= n, v.sum2 = sqrt (Max (v.sum2 / n - Sqr (v.sum), 0.))
+   (v).sum /= n, (v).sum2 = sqrt (Max ((v).sum2 / n - Sqr ((v).sum), 0.))
 
 // Return: sum and stdev
 // this is used in printf() statements, make sure to have %f twice in the format string
-#define PropEst(v)  v.sum, v.sum2
+#define PropEst(v)  (v).sum, (v).sum2
 
 #endif /* IN_MDDEFS_H */
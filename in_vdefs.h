@@ -147,6 +147,9 @@ typedef VecI2 VecI;
 // Return: sum of compontents of vector v
 #define VCSum(v)                                            \
    ((v).x + (v).y)
+// Return: index of cell p in a grid of s cells, counted row by row
+#define VLinear(p, s)                                       \
+   ((p).y * (s).x + (p).x)
 
 // Increase tensor t by the dyadic product of v with itself
 #define TVAddDyad(t, v) \
@@ -255,6 +258,8 @@ typedef VecI3 VecI;
    VSet (v, a[(n) + 0], a[(n) + 1], a[(n) + 2])
 #define VCSum(v)                                            \
    ((v).x + (v).y + (v).z)
+#define VLinear(p, s)                                       \
+   (((p).z * (s).y + (p).y) * (s).x + (p).x)
    
 /*
  * End of 3D vector macros
@@ -298,4 +303,18 @@ typedef VecI3 VecI;
    (t).yx = 0.0, \
    (t).yy = 0.0
 
+// Add tensor t2 to t1, result in t1
+#define TTAdd(t1, t2)        \
+   (t1).xx += (t2).xx,       \
+   (t1).xy += (t2).xy,       \
+   (t1).yx += (t2).yx,       \
+   (t1).yy += (t2).yy
+
+// Multiply all components of tensor t with scalar s
+#define TScale(t, s)  \
+   (t).xx *= s,       \
+   (t).xy *= s,       \
+   (t).yx *= s,       \
+   (t).yy *= s
+
 #endif /* V_DEFS */
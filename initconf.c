@@ -0,0 +1,293 @@
+/*
+ * Initial configurations
+ *
+ * Lattice sites are numbered row by row, and molecule n goes to site
+ * n * nSites / nMol, so every thread works out its molecules on its own.
+ * With several ranks, each goes through all molecules and keeps those in
+ * its slab.
+ *
+ * The random packing places the molecules one by one at random points,
+ * rejecting points closer than rsaDist to a molecule placed before. The
+ * molecules are shared out evenly over the cells of the force calculation,
+ * so only the neighbouring cells are searched. The threads fill the cells
+ * in nine rounds, by the colour given by CellColour() in x and y; cells of
+ * one colour are never neighbours, so they are filled at the same time
+ * without any locking. Each cell draws from a random sequence of its own,
+ * so the result does not depend on the number of threads.
+ *
+ * Random sequential addition jams at a packing fraction of 0.547, well
+ * below that of a liquid, so rsaDist is smaller than the molecules. The
+ * molecules closer than relaxDist are then pushed apart, each by half the
+ * overlap with every neighbour, until none are left.
+ */
+#include <stdio.h>
+#include <math.h>
+
+#include "in_vdefs.h"
+#include "in_mddefs.h"
+#include "random.h"
+#include "threads.h"
+#include "simulation.h"
+#include "initconf.h"
+#include "domain.h"
+
+// Random points tried for a molecule; if none is free, the one furthest
+// from the others is taken
+#define INIT_TRIES  100
+// Maximum number of rounds of pushing the molecules apart
+#define INIT_SWEEPS  1000
+
+// Inputs: one of INIT_*, and the number of molecules (0 for one on every
+// site of initUcell)
+int initLattice = INIT_SQUARE;
+int initMol = 0;
+
+double initMinDist;
+
+// Lattice: sites along x and y, their spacing, and the shift along x of the
+// even and odd rows, in units of the spacing
+VecI latSites;
+VecR latGap;
+double latShift;
+long long nSites;
+
+// Random packing: the distance of the random addition and the one the
+// molecules are pushed apart to, the seed, the colour of the cells being
+// filled, and per thread the smallest squared distance found
+double rsaDist, relaxDist;
+unsigned long long rsaSeed;
+int rsaColour;
+double rsaMin[MAX_THREADS];
+
+
+// Set nMol and region for the inputs
+void InitConfSize (void)
+{
+	double aspect, fac, g;
+
+	if (initLattice < INIT_SQUARE || initLattice > INIT_RANDOM) {
+		LogError("Error: unknown initLattice %d, using a square lattice\n", initLattice);
+		initLattice = INIT_SQUARE;
+	}
+	aspect = (double) initUcell.x / initUcell.y;
+	nMol = initMol > 0 ? initMol : VProd (initUcell);
+	if (initLattice == INIT_RANDOM) {
+		region.y = sqrt (nMol / (density * aspect));
+		region.x = aspect * region.y;
+		// Packing fractions of 0.4 and at most 0.75, below random close
+		// packing at 0.84
+		relaxDist = Min (rMin, sqrt (3. / (M_PI * density)));
+		rsaDist = Min (relaxDist, sqrt (1.6 / (M_PI * density)));
+		message("Random packing of %d molecules, at least %f apart\n", nMol, relaxDist);
+		return;
+	}
+
+	// Distance between the rows over that between neighbours in a row
+	fac = initLattice == INIT_HEXAGONAL ? 0.5 * sqrt (3.) : 1.;
+	if (initMol > 0) {
+		latSites.y = Max ((int) ceil (sqrt (nMol / (aspect * fac))), 1);
+		if (initLattice == INIT_HEXAGONAL) latSites.y += latSites.y % 2;
+		latSites.x = (nMol + latSites.y - 1) / latSites.y;
+	} else {
+		latSites = initUcell;
+		if (initLattice == INIT_HEXAGONAL) latSites.y += latSites.y % 2;
+		nMol = VProd (latSites);
+	}
+	nSites = (long long) latSites.x * latSites.y;
+	g = sqrt (nMol / (fac * nSites)) / sqrt (density);
+	VSet (latGap, g, fac * g);
+	VMul (region, latSites, latGap);
+	latShift = initLattice == INIT_HEXAGONAL ? 0.25 : 0.;
+	initMinDist = g;
+	message("%s lattice of %d X %d sites, %d molecules, spacing %f\n",
+		initLattice == INIT_HEXAGONAL ? "Hexagonal" : "Square",
+		latSites.x, latSites.y, nMol, g);
+}
+
+// Position of molecule n of all ranks
+static void LatticeSite (int n, VecR *c)
+{
+	long long k;
+	int x, y;
+
+	k = (long long) n * nSites / nMolAll;
+	x = (int) (k % latSites.x);
+	y = (int) (k / latSites.x);
+	VSet (*c, x + 0.5 + (y % 2 ? latShift : - latShift), y + 0.5);
+	VMul (*c, *c, latGap);
+	VVSAdd (*c, -0.5, region);
+}
+
+static void LatticeCoords (int tid)
+{
+	int n;
+
+	DO_MOL_OF (tid) {
+		LatticeSite (n, &mol[n].r);
+		VZero (molImage[n]);
+	}
+}
+
+static void SlabCoords (void)
+{
+	VecR c;
+	int n;
+
+	nMol = 0;
+	for (n = 0; n < nMolAll; n ++) {
+		LatticeSite (n, &c);
+		if (! DomainOwns (&c)) continue;
+		mol[nMol].r = c;
+		VZero (molImage[nMol]);
+		++ nMol;
+	}
+	nMolOwn = nMol;
+}
+
+// Colour 0 or 1 by the parity of the cell, but 2 for the last one of an
+// odd number, whose neighbour across the boundary has the same parity
+static int CellColour (int m, int nc)
+{
+	return (nc % 2 && m == nc - 1) ? 2 : m % 2;
+}
+
+static unsigned long long Mix (unsigned long long z)
+{
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+// Uniform in [0, 1), from the random sequence with state s
+static double Uniform (unsigned long long *s)
+{
+	*s += 0x9e3779b97f4a7c15ULL;
+	return (Mix (*s) >> 11) * (1. / 9007199254740992.);
+}
+
+// Distance from r to the nearest molecule already in the cells around
+// cell m1v, or rsaDist if none is closer
+static double NearestDist (VecR *r, VecI m1v)
+{
+	VecR dr;
+	VecI m2v, range;
+	double rr, rrMin;
+	int dx, dy, j;
+
+	VSet (range, cells.x > 1, cells.y > 1);
+	rrMin = Sqr (rsaDist);
+	for (dy = - range.y; dy <= range.y; dy ++) {
+		m2v.y = (m1v.y + dy + cells.y) % cells.y;
+		for (dx = - range.x; dx <= range.x; dx ++) {
+			m2v.x = (m1v.x + dx + cells.x) % cells.x;
+			for (j = cellList[nMol + VLinear (m2v, cells)]; j >= 0; j = cellList[j]) {
+				VSub (dr, *r, mol[j].r);
+				VWrapAll (dr);
+				rr = VLenSq (dr);
+				if (rr < rrMin) rrMin = rr;
+			}
+		}
+	}
+	return sqrt (rrMin);
+}
+
+// Fill the cells of colour rsaColour in the rows of thread tid
+static void RandomCoords (int tid)
+{
+	VecR r, rBest, wid;
+	VecI m1v;
+	unsigned long long s;
+	double d, dBest;
+	int c, k, n, nc, nHi;
+
+	VDiv (wid, region, cells);
+	nc = VProd (cells);
+	for (m1v.y = threadInfo[tid].rowLo; m1v.y < threadInfo[tid].rowHi; m1v.y ++) {
+		if (CellColour (m1v.y, cells.y) != rsaColour / 3) continue;
+		for (m1v.x = 0; m1v.x < cells.x; m1v.x ++) {
+			if (CellColour (m1v.x, cells.x) != rsaColour % 3) continue;
+			c = VLinear (m1v, cells);
+			s = Mix (rsaSeed + c);
+			nHi = (int) ((long long) (c + 1) * nMol / nc);
+			for (n = (int) ((long long) c * nMol / nc); n < nHi; n ++) {
+				dBest = -1.;
+				for (k = 0; k < INIT_TRIES && dBest < rsaDist; k ++) {
+					VSet (r, (m1v.x + Uniform (&s)) * wid.x, (m1v.y + Uniform (&s)) * wid.y);
+					VVSAdd (r, -0.5, region);
+					d = NearestDist (&r, m1v);
+					if (d > dBest) {
+						dBest = d;
+						rBest = r;
+					}
+				}
+				mol[n].r = rBest;
+				VZero (molImage[n]);
+				cellList[n] = cellList[nMol + c];
+				cellList[nMol + c] = n;
+			}
+		}
+	}
+}
+
+// Add to mol[].ra the push on j1 from a molecule closer than relaxDist;
+// the pushes are aimed a little beyond, or they would take ever longer
+static void Push (int j1, int j2, VecR *dr, double rr, void *arg)
+{
+	double r = sqrt (rr);
+
+	rsaMin[*(int *) arg] = Min (rsaMin[*(int *) arg], rr);
+	if (r < relaxDist) VVSAdd (mol[j1].ra, 0.5 * (1.02 * relaxDist - r) / r, *dr);
+}
+
+static void ClearPush (int tid)
+{
+	int n;
+
+	DO_MOL_OF (tid) VZero (mol[n].ra);
+	rsaMin[tid] = Sqr (relaxDist);
+}
+
+static void PushPairs (int tid)
+{
+	VisitPairs (tid, relaxDist, Push, &tid);
+}
+
+static void Move (int tid)
+{
+	int n;
+
+	DO_MOL_OF (tid) {
+		VVAdd (mol[n].r, mol[n].ra);
+		VWrapAll (mol[n].r);
+	}
+}
+
+// Place the molecules; the cells must be allocated and empty
+void InitConfCoords (void)
+{
+	int sweep, t;
+
+	if (nRanks > 1) {
+		SlabCoords ();
+		return;
+	}
+	if (initLattice != INIT_RANDOM) {
+		ThreadsRun (LatticeCoords);
+		return;
+	}
+	rsaSeed = (unsigned long long) (RandR () * 2147483648.);
+	for (rsaColour = 0; rsaColour < 9; rsaColour ++) ThreadsRun (RandomCoords);
+	for (sweep = 0; sweep < INIT_SWEEPS; sweep ++) {
+		ThreadsRun (ClearPush);
+		ThreadsRun (PushPairs);
+		initMinDist = relaxDist;
+		for (t = 0; t < nThreadsUsed; t ++) initMinDist = Min (initMinDist, sqrt (rsaMin[t]));
+		if (initMinDist >= relaxDist) break;
+		ThreadsRun (Move);
+		BuildCells ();
+	}
+	if (initMinDist < relaxDist)
+		LogWarn("Warning: molecules still %f apart after %d rounds\n", initMinDist, sweep);
+	else
+		message("Random packing done in %d rounds\n", sweep);
+}
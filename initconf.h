@@ -0,0 +1,29 @@
+/*
+ * Initial configurations
+ *
+ * The molecules start on a square or a hexagonal lattice, or at random
+ * positions. Every thread places its own molecules, so their pages end up
+ * on its NUMA node and even very large systems are set up in a moment.
+ *
+ * With initMol = 0 there is a molecule on every site of an initUcell
+ * lattice (with an even number of rows for the hexagonal one). Otherwise
+ * there are initMol molecules, and the lattice is made just large enough
+ * for them with the shape of initUcell, the vacancies spread evenly over
+ * it. The box always fits the lattice, so a hexagonal lattice is periodic
+ * without defects.
+ */
+#ifndef __MD_INITCONF_H__
+#define __MD_INITCONF_H__
+
+#define INIT_SQUARE     0
+#define INIT_HEXAGONAL  1
+#define INIT_RANDOM     2  // random sequential addition, see InitConfCoords()
+
+extern int initLattice, initMol;
+// No two molecules are closer than this at the start
+extern double initMinDist;
+
+void InitConfSize (void);
+void InitConfCoords (void);
+
+#endif /* __MD_INITCONF_H__ */
@@ -0,0 +1,523 @@
+/*
+ * Asynchronous logging
+ *
+ * A message is stored as a record: a header, the arguments, and the bytes
+ * of the strings among them. The writing thread publishes a record by
+ * advancing the head of its ring, the log thread frees it by advancing the
+ * tail, and each of the two is only ever written by one side. Records get
+ * a global sequence number, which the log thread uses to merge the rings in
+ * the order the messages were made.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "logger.h"
+#include "threads.h"
+
+// Time in ms between two looks at the rings by the log thread
+#define LOG_INTERVAL  5
+
+// States of a ring
+#define RING_FREE      0
+#define RING_OWNED     1
+#define RING_RELEASED  2  // given up by its thread, free once it is empty
+
+// Length modifiers of a conversion
+#define LEN_NONE  0
+#define LEN_HH    1
+#define LEN_H     2
+#define LEN_L     3
+#define LEN_LL    4
+#define LEN_BIG_L 5
+#define LEN_Z     6
+#define LEN_J     7
+#define LEN_T     8
+
+#define RecAlign(n)  (((n) + 7) & ~7u)
+#define RecArgs(rec) ((LogArg *) ((char *) (rec) + RecAlign (sizeof (LogRecord))))
+
+typedef struct {
+	unsigned size;      // bytes of the record, including arguments and strings
+	int level, nArg;
+	unsigned seq;
+	const char *fmt;    // NULL for padding up to the end of the ring
+} LogRecord;
+
+typedef union {
+	long long i;
+	unsigned long long u;
+	double d;
+	const void *p;
+	unsigned s;         // offset of a string from the start of the record
+} LogArg;
+
+typedef struct {
+	unsigned head;      // bytes written, only changed by the owner
+	char pad1[60];
+	unsigned tail;      // bytes read, only changed by the log thread
+	int state;
+	char pad2[56];
+	char *buf;
+} LogRing;
+
+// A conversion specification like %-8.3lf
+typedef struct {
+	char flags[8];
+	int width, prec;    // -1 if not given
+	int starWidth, starPrec;
+	int length;
+	char conv;
+} Spec;
+
+int logLevel = LOG_INFO;
+
+// Ring 0 is shared, under a spin lock, by threads that found no free ring
+static LogRing  ring[LOG_MAX_RINGS];
+static int      nRings = 1, sharedLock;
+static THREAD_LOCAL LogRing *myRing;
+
+static unsigned logSeq, logWritten;
+static int      logDropped, logQuit, logRunning;
+static Thread   logThread;
+static FILE    *logFile;
+static void   (*logShow) (int level, const char *text);
+
+
+/*
+ * Conversion specifications
+ */
+
+// Parse the specification following a '%' at p.
+// Return: pointer to the character after it
+static const char *ParseSpec (const char *p, Spec *s)
+{
+	int n = 0;
+
+	while (*p && strchr ("-+ #0", *p) && n < (int) sizeof (s->flags) - 1)
+		s->flags[n ++] = *p ++;
+	s->flags[n] = '\0';
+	s->width = s->prec = -1;
+	s->starWidth = s->starPrec = 0;
+	if (*p == '*') {
+		s->starWidth = 1;
+		++ p;
+	}
+	else if (*p >= '0' && *p <= '9') {
+		for (s->width = 0; *p >= '0' && *p <= '9'; p ++) s->width = 10 * s->width + *p - '0';
+	}
+	if (*p == '.') {
+		++ p;
+		if (*p == '*') {
+			s->starPrec = 1;
+			++ p;
+		}
+		else {
+			for (s->prec = 0; *p >= '0' && *p <= '9'; p ++) s->prec = 10 * s->prec + *p - '0';
+		}
+	}
+	s->length = LEN_NONE;
+	switch (*p) {
+	case 'h': s->length = p[1] == 'h' ? LEN_HH : LEN_H; break;
+	case 'l': s->length = p[1] == 'l' ? LEN_LL : LEN_L; break;
+	case 'L': s->length = LEN_BIG_L; break;
+	case 'z': s->length = LEN_Z; break;
+	case 'j': s->length = LEN_J; break;
+	case 't': s->length = LEN_T; break;
+	}
+	if (s->length == LEN_HH || s->length == LEN_LL) p += 2;
+	else if (s->length != LEN_NONE) ++ p;
+	s->conv = *p;
+	return *p ? p + 1 : p;
+}
+
+// Take the argument for a signed integer conversion
+static long long SignedArg (Spec *s, va_list *ap)
+{
+	switch (s->length) {
+	case LEN_HH: return (signed char) va_arg (*ap, int);
+	case LEN_H:  return (short) va_arg (*ap, int);
+	case LEN_L:  return va_arg (*ap, long);
+	case LEN_LL: return va_arg (*ap, long long);
+	case LEN_Z:  return (long long) va_arg (*ap, size_t);
+	case LEN_J:  return va_arg (*ap, intmax_t);
+	case LEN_T:  return va_arg (*ap, ptrdiff_t);
+	}
+	return va_arg (*ap, int);
+}
+
+// Take the argument for an unsigned integer conversion
+static unsigned long long UnsignedArg (Spec *s, va_list *ap)
+{
+	switch (s->length) {
+	case LEN_HH: return (unsigned char) va_arg (*ap, int);
+	case LEN_H:  return (unsigned short) va_arg (*ap, int);
+	case LEN_L:  return va_arg (*ap, unsigned long);
+	case LEN_LL: return va_arg (*ap, unsigned long long);
+	case LEN_Z:  return va_arg (*ap, size_t);
+	case LEN_J:  return va_arg (*ap, uintmax_t);
+	case LEN_T:  return (unsigned long long) va_arg (*ap, ptrdiff_t);
+	}
+	return va_arg (*ap, unsigned int);
+}
+
+
+/*
+ * Writing side
+ */
+
+// Get a ring for the calling thread
+static LogRing *ClaimRing (void)
+{
+	int k, n;
+
+	for (k = 1; k < LOG_MAX_RINGS; k ++) {
+		if (AtomicLoad (&ring[k].state) != RING_FREE ||
+			!AtomicCAS (&ring[k].state, RING_FREE, RING_OWNED)) continue;
+		if (!ring[k].buf && !(ring[k].buf = malloc (LOG_RING_SIZE))) {
+			AtomicStore (&ring[k].state, RING_FREE);
+			break;
+		}
+		while ((n = AtomicLoad (&nRings)) <= k && !AtomicCAS (&nRings, n, k + 1));
+		return &ring[k];
+	}
+	return &ring[0];
+}
+
+// Store a record in ring r, dropping it if the ring is full and the
+// message is not important enough to wait for
+static void PutRecord (LogRing *r, int level, const char *fmt, int nArg, LogArg *arg,
+	const char **str, size_t *strLen)
+{
+	LogRecord *rec;
+	LogArg *a;
+	unsigned head, tail, pos, pad, size, off;
+	int k;
+
+	size = RecAlign (sizeof (LogRecord)) + nArg * sizeof (LogArg);
+	for (k = 0; k < nArg; k ++) {
+		if (str[k]) size += (unsigned) strLen[k] + 1;
+	}
+	size = RecAlign (size);
+	for (;;) {
+		head = r->head;
+		tail = AtomicLoad (&r->tail);
+		pos = head & (LOG_RING_SIZE - 1);
+		pad = LOG_RING_SIZE - pos < size ? LOG_RING_SIZE - pos : 0;
+		if (LOG_RING_SIZE - (head - tail) >= pad + size) break;
+		if (level < LOG_WARN) {
+			AtomicAdd (&logDropped, 1);
+			return;
+		}
+		ThreadSleep (1);
+	}
+	if (pad) {
+		// The log thread skips a gap too small for a header by itself
+		if (pad >= sizeof (LogRecord)) {
+			rec = (LogRecord *) (r->buf + pos);
+			rec->size = pad;
+			rec->fmt = NULL;
+		}
+		head += pad;
+		pos = 0;
+	}
+
+	rec = (LogRecord *) (r->buf + pos);
+	rec->size = size;
+	rec->level = level;
+	rec->nArg = nArg;
+	rec->fmt = fmt;
+	a = RecArgs (rec);
+	off = RecAlign (sizeof (LogRecord)) + nArg * sizeof (LogArg);
+	for (k = 0; k < nArg; k ++) {
+		a[k] = arg[k];
+		if (str[k]) {
+			memcpy ((char *) rec + off, str[k], strLen[k]);
+			((char *) rec)[off + strLen[k]] = '\0';
+			a[k].s = off;
+			off += (unsigned) strLen[k] + 1;
+		}
+	}
+	rec->seq = AtomicAdd (&logSeq, 1);
+	AtomicStore (&r->head, head + size);
+}
+
+void LogWriteV (int level, const char *fmt, va_list ap)
+{
+	LogArg arg[LOG_MAX_ARGS];
+	const char *str[LOG_MAX_ARGS], *p;
+	size_t strLen[LOG_MAX_ARGS];
+	char text[LOG_MAX_TEXT];
+	va_list aq;
+	Spec s;
+	int n = 0, ok = 1;
+
+	if (!logRunning) {
+		vsnprintf (text, sizeof (text), fmt, ap);
+		fputs (text, stderr);
+		return;
+	}
+	// Take the arguments as the format says, without formatting anything.
+	// We work on a copy, so ap is still there if we have to format it here.
+	va_copy (aq, ap);
+	for (p = fmt; ok && (p = strchr (p, '%')); ) {
+		p = ParseSpec (p + 1, &s);
+		if (s.conv == '%') continue;
+		if (n + s.starWidth + s.starPrec >= LOG_MAX_ARGS) {
+			ok = 0;
+			break;
+		}
+		if (s.starWidth) {
+			str[n] = NULL;
+			arg[n ++].i = va_arg (aq, int);
+		}
+		if (s.starPrec) {
+			str[n] = NULL;
+			arg[n ++].i = va_arg (aq, int);
+		}
+		str[n] = NULL;
+		switch (s.conv) {
+		case 'd': case 'i': case 'c':
+			arg[n].i = SignedArg (&s, &aq);
+			break;
+		case 'u': case 'o': case 'x': case 'X':
+			arg[n].u = UnsignedArg (&s, &aq);
+			break;
+		case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+			arg[n].d = s.length == LEN_BIG_L ? (double) va_arg (aq, long double) :
+				va_arg (aq, double);
+			break;
+		case 's':
+			arg[n].s = 0;
+			if (!(str[n] = va_arg (aq, const char *))) str[n] = "(null)";
+			strLen[n] = strlen (str[n]);
+			if (strLen[n] >= LOG_MAX_TEXT) strLen[n] = LOG_MAX_TEXT - 1;
+			break;
+		case 'p': case 'n':
+			arg[n].p = va_arg (aq, void *);
+			break;
+		default:
+			ok = 0;
+		}
+		++ n;
+	}
+	va_end (aq);
+
+	if (ok) {
+		if (!myRing) myRing = ClaimRing ();
+		if (myRing != &ring[0]) PutRecord (myRing, level, fmt, n, arg, str, strLen);
+		else {
+			while (!AtomicCAS (&sharedLock, 0, 1));
+			PutRecord (myRing, level, fmt, n, arg, str, strLen);
+			AtomicStore (&sharedLock, 0);
+		}
+	}
+	else {
+		// Too many arguments or a conversion we don't know: format it here
+		vsnprintf (text, sizeof (text), fmt, ap);
+		LogWrite (level, "%s", text);
+	}
+}
+
+void LogWrite (int level, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start (ap, fmt);
+	LogWriteV (level, fmt, ap);
+	va_end (ap);
+}
+
+// A general function to print messages, also used in simulation.c, e.g.
+//   message("the value of counter i is now %d\n", i);
+void message (const char *msg, ...)
+{
+	va_list ap;
+
+	if (LOG_INFO < logLevel) return;
+	va_start (ap, msg);
+	LogWriteV (LOG_INFO, msg, ap);
+	va_end (ap);
+}
+
+// Give up the ring of the calling thread, e.g. before the thread ends
+void LogThreadDone (void)
+{
+	if (myRing && myRing != &ring[0]) AtomicStore (&myRing->state, RING_RELEASED);
+	myRing = NULL;
+}
+
+
+/*
+ * Log thread
+ */
+
+// Format record rec into text
+static void Format (LogRecord *rec, char *text)
+{
+	LogArg *a = RecArgs (rec);
+	const char *p, *q;
+	char spec[48], *c;
+	int n = 0, k = 0, len, width, prec;
+	Spec s;
+
+	for (p = rec->fmt; *p && n < LOG_MAX_TEXT - 1; ) {
+		if (*p != '%') {
+			text[n ++] = *p ++;
+			continue;
+		}
+		q = ParseSpec (p + 1, &s);
+		p = q;
+		if (s.conv == '%') {
+			text[n ++] = '%';
+			continue;
+		}
+		width = s.starWidth ? (int) a[k ++].i : s.width;
+		prec = s.starPrec ? (int) a[k ++].i : s.prec;
+
+		// Rebuild the specification, with all integers as long long
+		c = spec + sprintf (spec, "%%%s", s.flags);
+		if (width < 0 && s.starWidth) {
+			*c ++ = '-';
+			width = - width;
+		}
+		if (width >= 0) c += sprintf (c, "%d", width);
+		if (prec >= 0) c += sprintf (c, ".%d", prec);
+		if (strchr ("diuoxX", s.conv)) c += sprintf (c, "ll");
+		*c ++ = s.conv;
+		*c = '\0';
+
+		len = 0;
+		switch (s.conv) {
+		case 'd': case 'i':
+			len = snprintf (text + n, LOG_MAX_TEXT - n, spec, a[k].i);
+			break;
+		case 'u': case 'o': case 'x': case 'X':
+			len = snprintf (text + n, LOG_MAX_TEXT - n, spec, a[k].u);
+			break;
+		case 'c':
+			len = snprintf (text + n, LOG_MAX_TEXT - n, spec, (int) a[k].i);
+			break;
+		case 's':
+			len = snprintf (text + n, LOG_MAX_TEXT - n, spec, (char *) rec + a[k].s);
+			break;
+		case 'p':
+			len = snprintf (text + n, LOG_MAX_TEXT - n, spec, a[k].p);
+			break;
+		case 'n':
+			break;
+		default:
+			len = snprintf (text + n, LOG_MAX_TEXT - n, spec, a[k].d);
+		}
+		++ k;
+		if (len > 0) n = len < LOG_MAX_TEXT - n ? n + len : LOG_MAX_TEXT - 1;
+	}
+	text[n] = '\0';
+}
+
+// Oldest record of ring r not yet written, or NULL
+static LogRecord *Front (LogRing *r)
+{
+	LogRecord *rec;
+	unsigned tail = r->tail, head = AtomicLoad (&r->head), pos;
+
+	for (; tail != head; ) {
+		pos = tail & (LOG_RING_SIZE - 1);
+		if (LOG_RING_SIZE - pos < sizeof (LogRecord)) tail += LOG_RING_SIZE - pos;
+		else if (!(rec = (LogRecord *) (r->buf + pos))->fmt) tail += rec->size;
+		else break;
+	}
+	if (tail != r->tail) AtomicStore (&r->tail, tail);
+	return tail != head ? (LogRecord *) (r->buf + (tail & (LOG_RING_SIZE - 1))) : NULL;
+}
+
+static void Show (int level, const char *text)
+{
+	if (logShow) logShow (level, text);
+	if (logFile) fputs (text, logFile);
+}
+
+// Write all messages there are, oldest first.
+// Return: the number written
+static int Drain (void)
+{
+	LogRecord *rec, *best;
+	LogRing *bestRing = NULL;
+	char text[LOG_MAX_TEXT];
+	int k, n = 0, nr, d;
+
+	for (;;) {
+		best = NULL;
+		nr = AtomicLoad (&nRings);
+		for (k = 0; k < nr; k ++) {
+			if (!(rec = Front (&ring[k]))) continue;
+			if (!best || (int) (rec->seq - best->seq) < 0) {
+				best = rec;
+				bestRing = &ring[k];
+			}
+		}
+		if (!best) break;
+		Format (best, text);
+		Show (best->level, text);
+		AtomicStore (&bestRing->tail, bestRing->tail + best->size);
+		++ n;
+	}
+	if ((d = AtomicExchange (&logDropped, 0)) > 0) {
+		sprintf (text, "Warning: %d log messages were dropped\n", d);
+		Show (LOG_WARN, text);
+	}
+	AtomicStore (&logWritten, logWritten + n);
+
+	// Rings given up and emptied can be used by new threads
+	for (k = 1; k < nr; k ++) {
+		if (AtomicLoad (&ring[k].state) == RING_RELEASED &&
+			ring[k].tail == AtomicLoad (&ring[k].head))
+			AtomicStore (&ring[k].state, RING_FREE);
+	}
+	if (logFile && (n || d)) fflush (logFile);
+	return n;
+}
+
+static void LogThread (void *arg)
+{
+	int quit;
+
+	do {
+		// One more round after we are told to stop, for the last messages
+		quit = AtomicLoad (&logQuit);
+		if (Drain () == 0 && !quit) ThreadSleep (LOG_INTERVAL);
+	} while (!quit);
+}
+
+// Start logging to file (if not NULL) and to show (if not NULL), which are
+// called from the log thread
+void LogInit (FILE *file, void (*show) (int level, const char *text))
+{
+	logFile = file;
+	logShow = show;
+	if (!ring[0].buf && !(ring[0].buf = malloc (LOG_RING_SIZE))) return;
+	logQuit = 0;
+	if (ThreadCreate (&logThread, LogThread, NULL) == 0) AtomicStore (&logRunning, 1);
+}
+
+// Wait until the messages logged so far are written
+void LogFlush (void)
+{
+	unsigned target = AtomicLoad (&logSeq);
+
+	while (AtomicLoad (&logRunning) && (int) (AtomicLoad (&logWritten) - target) < 0)
+		ThreadSleep (1);
+}
+
+// Write the remaining messages and stop the log thread
+void LogFree (void)
+{
+	if (!logRunning) return;
+	AtomicStore (&logQuit, 1);
+	ThreadJoin (logThread);
+	AtomicStore (&logRunning, 0);
+	if (logFile) fflush (logFile);
+}
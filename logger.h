@@ -0,0 +1,59 @@
+/*
+ * Asynchronous logging
+ *
+ * LogWrite() only copies the format pointer and the arguments into a ring
+ * buffer of the calling thread; a background thread does the formatting,
+ * shows the text and writes it to the log file. Each thread has its own
+ * single-producer ring, so no locks are taken on the logging path. The
+ * format must be a string literal (or otherwise outlive the message);
+ * strings passed for %s are copied.
+ *
+ * Messages below logLevel are skipped at run time, messages below
+ * LOG_COMPILED_LEVEL are removed at compile time, e.g. -DLOG_COMPILED_LEVEL=1
+ * removes all LogDebug() calls.
+ */
+#ifndef __MD_LOGGER_H__
+#define __MD_LOGGER_H__
+
+#include <stdio.h>
+#include <stdarg.h>
+
+#define LOG_DEBUG  0
+#define LOG_INFO   1
+#define LOG_WARN   2
+#define LOG_ERROR  3
+
+#ifndef LOG_COMPILED_LEVEL
+#	define LOG_COMPILED_LEVEL  LOG_DEBUG
+#endif
+
+// Size of the ring buffer of each thread, a power of 2
+#define LOG_RING_SIZE  65536
+// Number of threads with a ring of their own; others share one ring
+#define LOG_MAX_RINGS  64
+// Maximum number of arguments of a message, and length of its text
+#define LOG_MAX_ARGS   32
+#define LOG_MAX_TEXT   4096
+
+extern int logLevel;
+
+#define LogAt(level, ...)                                   \
+	do {                                                    \
+		if ((level) >= LOG_COMPILED_LEVEL && (level) >= logLevel) \
+			LogWrite ((level), __VA_ARGS__);                \
+	} while (0)
+#define LogDebug(...)  LogAt (LOG_DEBUG, __VA_ARGS__)
+#define LogInfo(...)   LogAt (LOG_INFO, __VA_ARGS__)
+#define LogWarn(...)   LogAt (LOG_WARN, __VA_ARGS__)
+#define LogError(...)  LogAt (LOG_ERROR, __VA_ARGS__)
+
+void message (const char *msg, ...);
+
+void LogInit (FILE *file, void (*show) (int level, const char *text));
+void LogWrite (int level, const char *fmt, ...);
+void LogWriteV (int level, const char *fmt, va_list ap);
+void LogFlush (void);
+void LogThreadDone (void);
+void LogFree (void);
+
+#endif /* __MD_LOGGER_H__ */
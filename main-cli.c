@@ -0,0 +1,384 @@
+/*
+ * Molecular dynamics simulation command line program
+ *
+ * Runs the simulation without a user interface, e.g. on compute nodes.
+ * Simulation inputs are given as name=value arguments, using the names
+ * listed by PrintNameList(), for example
+ *
+ *   md initUcell.x=100 initUcell.y=100 stepLimit=10000 shmName=md
+ *
+ * With movieName set, a frame is drawn every moviePeriod steps, e.g.
+ *
+ *   md movieName=frame%05d.png moviePeriod=50 movieColour=1
+ *   md movieName=movie.rgba movieWidth=640 && ffmpeg -f rawvideo \
+ *      -pix_fmt rgba -s 640x640 -i movie.rgba movie.mp4
+ *
+ * With benchmark=n the run is timed n times with the per-thread sums and
+ * with the reproducible ones (reproSums), and the best throughput of each
+ * is printed together with a hash of the final state, e.g.
+ *
+ *   md benchmark=3 stepSample=1 nThreads=1
+ *   md benchmark=3 stepSample=1 nThreads=8
+ *
+ * give the same hash for reproSums=1. The hash includes the energy and
+ * virial sums of the last step, which with reproSums=0 depend on the number
+ * of threads.
+ *
+ * With steer=1 the run reads steering commands (see steer.h) from the
+ * terminal, one per line, and applies them between two steps, e.g.
+ *
+ *   (sleep 5; echo temperature 0.5; sleep 5; echo stop) | md steer=1
+ *
+ * Built with -DUSE_MPI by an MPI compiler, the region is divided over the
+ * ranks (see domain.h), e.g. four on one machine:
+ *
+ *   mpicc -DUSE_MPI -O2 -o md ... && mpirun -np 4 md nThreads=1 pinThreads=0
+ *
+ * Only rank 0 writes the log and shows messages, the others show their
+ * warnings and errors. With several ranks there is no movie, and the
+ * benchmark hash only covers the sums, since every rank has part of the
+ * molecules, and no steering, as the commands would have to reach all
+ * ranks at the same step.
+ *
+ * Build with e.g.
+ *   cc -O2 -o md main-cli.c md_api.c simulation.c random.c arena.c \
+ *      threads.c snapshot.c shmexport.c raster.c logger.c correlator.c \
+ *      transport.c fft.c structure.c cluster.c hexatic.c replica.c shear.c \
+ *      harddisk.c initconf.c balance.c domain.c trajectory.c eqcache.c \
+ *      blocking.c steer.c -lm -lpthread -lrt
+ * and add -DUSE_ZLIB ... -lz for compressed PNG files, -DUSE_FFTW ... -lfftw3
+ * to use FFTW for S(k).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <math.h>
+
+#include "simulation.h"
+#include "shmexport.h"
+#include "trajectory.h"
+#include "snapshot.h"
+#include "raster.h"
+#include "threads.h"
+#include "domain.h"
+#include "md_api.h"
+
+FILE *logfile = NULL;
+
+// Whether the simulation is running(1) or should be stopped(0)
+int          running = 0;
+// Whether the simulation publishes snapshots for the movie(1) or not(0)
+int          do_draw_discs = 0;
+unsigned int disc_size = 100; // in percent of potential minimum distance
+unsigned int drawing_period = 100;
+
+// Movie output, off if movieName is empty
+char movieName[MOVIE_NAME_MAX] = "";
+int  movieWidth = 800;
+int  movieColour = RASTER_COLOUR_SPEED;
+int  movieThreads = 2;
+
+// Number of timed runs of each kind, 0 for a normal run
+int  benchmark = 0;
+// Whether steering commands are read from the terminal(1) or not(0)
+int  steer = 0;
+
+Movie movie;
+Image movieImage;
+int   movieSkipped = 0;
+// Whether the movie thread should keep going(1) or finish(0)
+volatile int rendering = 0;
+
+void show(int level, const char *text);
+void show_rank(int level, const char *text);
+
+
+/*
+ * Inputs of this program; those of the engine are set through md_api
+ */
+typedef struct {
+	const char *name;
+	char type;  // 'i' int, 'u' unsigned int, 'd' double, 's' string
+	void *p;
+	int size;   // size of a string buffer
+} Param;
+
+Param param[] = {
+	{ "movieName",      's', movieName, MOVIE_NAME_MAX },
+	{ "moviePeriod",    'u', &drawing_period },
+	{ "movieWidth",     'i', &movieWidth },
+	{ "movieColour",    'i', &movieColour },
+	{ "movieThreads",   'i', &movieThreads },
+	{ "discSize",       'u', &disc_size },
+	{ "benchmark",      'i', &benchmark },
+	{ "steer",          'i', &steer },
+};
+
+#define N_PARAM  (sizeof (param) / sizeof (param[0]))
+
+
+// Set input from an argument name=value.
+// Return: 0 on success, -1 if the argument is not understood
+int set_param(const char *arg)
+{
+	char name[64];
+	const char *value;
+	size_t len;
+	unsigned int k;
+	Param *p;
+
+	if (!(value = strchr(arg, '=')))
+		return -1;
+	len = value - arg;
+	++value;
+
+	for (k = 0; k < N_PARAM; k++) {
+		p = &param[k];
+		if (strlen(p->name) != len || strncmp(p->name, arg, len) != 0)
+			continue;
+		switch (p->type) {
+		case 'i': *(int *) p->p = atoi(value); break;
+		case 'u': *(unsigned int *) p->p = strtoul(value, NULL, 10); break;
+		case 'd': *(double *) p->p = atof(value); break;
+		case 's':
+			strncpy((char *) p->p, value, p->size - 1);
+			((char *) p->p)[p->size - 1] = '\0';
+			break;
+		}
+		return 0;
+	}
+	if (len >= sizeof(name))
+		return -1;
+	memcpy(name, arg, len);
+	name[len] = '\0';
+	return md_set_input(name, value);
+}
+
+// Stop the run after the current step on Ctrl-C, so the output is written
+void interrupted(int sig)
+{
+	AtomicStore(&running, 0);
+}
+
+// Steering thread: queue every line read from the terminal as a command.
+// It is never joined, it may wait for input after the run has ended.
+void steer_run(void *arg)
+{
+	char line[256];
+
+	while (fgets(line, sizeof(line), stdin)) {
+		if (line[strspn(line, " \t\r\n")] == '\0')
+			continue;
+		line[strcspn(line, "\r\n")] = '\0';
+		if (md_steer(line) != 0)
+			LogWarn("Warning: steering command '%s' not understood or not queued\n", line);
+	}
+}
+
+// Movie thread: draw every snapshot the simulation publishes and add it to
+// the movie. The simulation never waits for this; frames published while
+// the previous one is still being drawn are skipped.
+void movie_run(void *arg)
+{
+	RasterStyle style;
+	Snapshot *s;
+	int fresh, last, lastStep = -1;
+
+	style.diameter = rMin * disc_size / 100.0;
+	style.colour = movieColour;
+	style.vMax = 2.0 * sqrt(2.0 * temperature);
+	style.nThreads = movieThreads;
+
+	do {
+		// One more round after we are told to stop, for the final state
+		last = !rendering;
+		s = SnapshotAcquire(&fresh);
+		if (fresh && s->stepCount != lastStep) {
+			if (!movieImage.pixel && ImageInit(&movieImage, movieWidth,
+					(int) (movieWidth * s->region.y / s->region.x + 0.5)) != 0) {
+				LogError("Error: no memory for the movie frames\n");
+				return;
+			}
+			if (lastStep >= 0 && s->stepCount - lastStep > (int) drawing_period)
+				movieSkipped += (s->stepCount - lastStep - 1) / drawing_period;
+			if (RasterDraw(&movieImage, s, &style) != 0 ||
+					MovieFrame(&movie, &movieImage) != 0) {
+				LogError("Error: couldn't write movie frame %d\n", movie.frame);
+				return;
+			}
+			lastStep = s->stepCount;
+		}
+		else if (!last)
+			ThreadSleep(1);
+	} while (!last);
+}
+
+// FNV-1a hash of n bytes at p, continuing from h
+static unsigned long long hash_bytes(unsigned long long h, const void *p, size_t n)
+{
+	const unsigned char *c = p;
+
+	while (n--)
+		h = (h ^ *c++) * 1099511628211ULL;
+	return h;
+}
+
+// Time stepLimit steps with reproSums off and on, best of benchmark runs.
+// The seed is fixed, so all runs start from the same state.
+// Return: 0 on success, -1 if interrupted
+int run_benchmark(void)
+{
+	unsigned long long hash[2];
+	double best[2], sums[3], t;
+	int mode, rep, repro = reproSums;
+
+	if (!randSeed)
+		randSeed = 1;
+	for (rep = 0; rep < benchmark; rep++) {
+		for (mode = 0; mode < 2; mode++) {
+			reproSums = mode;
+			simulation_init();
+			AtomicStore(&running, 1);
+			t = WallClock();
+			if (simulation_steps(stepLimit) < stepLimit) {
+				reproSums = repro;
+				return -1;
+			}
+			t = WallClock() - t;
+			if (rep == 0 || t < best[mode])
+				best[mode] = t;
+			sums[0] = uSum;
+			sums[1] = virSum;
+			sums[2] = vvSum;
+			hash[mode] = 14695981039346656037ULL;
+			if (nRanks == 1)
+				hash[mode] = hash_bytes(hash[mode], mol, nMol * sizeof(Mol));
+			hash[mode] = hash_bytes(hash[mode], sums, sizeof(sums));
+		}
+	}
+	reproSums = repro;
+	message("Benchmark: %d molecules, %d ranks of %d threads, %d steps, best of %d runs\n",
+		nMolAll, nRanks, nThreadsUsed, stepLimit, benchmark);
+	for (mode = 0; mode < 2; mode++)
+		message("  reproSums=%d %9.3f s %11.4g molecule steps/s, state %016llx\n",
+			mode, best[mode], (double) nMolAll * stepLimit / best[mode], hash[mode]);
+	message("  reproducible sums take %+.1f%%\n", 100. * (best[1] / best[0] - 1.));
+	return 0;
+}
+
+// Program entry point: execution starts here
+int main(int argc, char *argv[])
+{
+	Thread movieThread, steerThread;
+	unsigned int k;
+	int i;
+
+	DomainStart(&argc, &argv);
+	// This program owns its main thread, which works as thread 0
+	pinCaller = 1;
+	for (i = 1; i < argc; i++) {
+		if (set_param(argv[i]) != 0) {
+			fprintf(stderr, "Usage: %s [name=value ...]\nInputs:", argv[0]);
+			for (k = 0; md_input_name(k); k++)
+				fprintf(stderr, " %s", md_input_name(k));
+			for (k = 0; k < N_PARAM; k++)
+				fprintf(stderr, " %s", param[k].name);
+			fprintf(stderr, "\n");
+			DomainEnd();
+			return 1;
+		}
+	}
+
+	// Open logfile and start logging, on the first rank only
+	if (rankId == 0) {
+		logfile = fopen("log.txt", "w");
+		LogInit(logfile, show);
+		if (!logfile)
+			LogError("Error: couldn't open logfile 'log.txt'\n");
+	}
+	else
+		LogInit(NULL, show_rank);
+
+	signal(SIGINT, interrupted);
+	if (benchmark > 0) {
+		if (run_benchmark() != 0)
+			message("Benchmark aborted\n");
+		AtomicStore(&running, 0);
+		ShmExportFree();
+		LogFree();
+		if (logfile)
+			fclose(logfile);
+		DomainEnd();
+		return 0;
+	}
+	if (movieName[0] && nRanks > 1) {
+		LogWarn("Warning: no movie with %d ranks\n", nRanks);
+		movieName[0] = '\0';
+	}
+	if (movieName[0]) {
+		if (MovieOpen(&movie, movieName) != 0) {
+			LogError("Error: couldn't open movie '%s'\n", movieName);
+			LogFree();
+			DomainEnd();
+			return 1;
+		}
+		do_draw_discs = drawing_period > 0;
+	}
+	if (steer && nRanks > 1) {
+		LogWarn("Warning: no steering with %d ranks\n", nRanks);
+		steer = 0;
+	}
+	simulation_init();
+	if (steer && ThreadCreate(&steerThread, steer_run, NULL) != 0) {
+		LogError("Error: couldn't start the steering thread\n");
+		steer = 0;
+	}
+	message("Starting simulation, %d steps\n", stepLimit);
+	rendering = do_draw_discs;
+	if (rendering && ThreadCreate(&movieThread, movie_run, NULL) != 0) {
+		LogError("Error: couldn't start the movie thread\n");
+		rendering = 0;
+	}
+	simulation_run();
+	if (rendering) {
+		rendering = 0;
+		ThreadJoin(movieThread);
+		message("Movie: %d frames of %dx%d pixels written to %s, %d skipped\n",
+			movie.frame, movieImage.width, movieImage.height, movieName,
+			movieSkipped);
+	}
+	if (movieName[0])
+		MovieClose(&movie);
+	ImageFree(&movieImage);
+	if (!AtomicLoad(&running))
+		message("Simulation aborted\n");
+	AtomicStore(&running, 0);
+
+	ShmExportFree();
+	TrajFree();
+	LogFree();
+	if (logfile)
+		fclose(logfile);
+	DomainEnd();
+	return 0;
+}
+
+// Nothing is drawn by this program
+void discs_clear(void) { }
+void discs_draw(void) { }
+void gui_draw_begin(void) { }
+void gui_draw_end(void) { }
+
+// Show a logged message on the terminal, called from the log thread
+void show(int level, const char *text)
+{
+	fputs(text, level >= LOG_WARN ? stderr : stdout);
+}
+
+// Same on the other ranks, only warnings and errors
+void show_rank(int level, const char *text)
+{
+	if (level >= LOG_WARN)
+		fprintf(stderr, "[rank %d] %s", rankId, text);
+}
@@ -4,15 +4,19 @@
 #include <ansi_c.h>
 #include <cvirte.h>
 #include <stdio.h>
-#include <stdarg.h>
 #include <windows.h>
 
 #include "simulation.h"
+#include "snapshot.h"
+#include "shmexport.h"
+#include "threads.h"
+#include "steer.h"
 #include "MD1_UI.h"
 
 int hPanel;
 FILE *logfile = NULL;
 HANDLE hThread = 0;
+HANDLE hRenderThread = 0;
 
 /*
  * Purely GUI-related variables
@@ -28,8 +32,16 @@ char init_needed = 0;
 unsigned int disc_size = 100; // in percent of potential minimum distance
 unsigned int drawing_period = 100;
 
+// Whether the drawing thread should keep going(1) or finish(0)
+volatile int rendering = 0;
+// Time between two frames drawn during a simulation, in ms
+#define RENDER_INTERVAL 40
+
 
 DWORD WINAPI gui_simulation_run(LPVOID lpParameter);
+DWORD WINAPI gui_render(LPVOID lpParameter);
+void discs_draw_snapshot(Snapshot *s);
+void show(int level, const char *text);
 
 
 /*
@@ -42,10 +54,11 @@ int main(int argc, char *argv[])
 	if ((hPanel = LoadPanel (0, "MD1_UI.uir", PANEL)) < 0)
 		return -1;
 	
-	// Open logfile
-	if ( !(logfile=fopen("log.txt", "w")) ) {
-		message("Error: couldn't open logfile 'log.txt'\n");
-	}
+	// Open logfile and start logging
+	logfile = fopen("log.txt", "w");
+	LogInit(logfile, show);
+	if (!logfile)
+		LogError("Error: couldn't open logfile 'log.txt'\n");
 	
 	// Set the control values on screen to their defaults
 	SetCtrlVal(hPanel, PANEL_NUM_DISCSIZE, disc_size);
@@ -67,6 +80,8 @@ int main(int argc, char *argv[])
 	RunUserInterface();
 	// And clean it up again
 	DiscardPanel (hPanel);
+	ShmExportFree();
+	LogFree();
 	
 	if (logfile)
 		fclose(logfile);
@@ -87,6 +102,9 @@ int CVICALLBACK end (int panel, int event, void *callbackData,
 int CVICALLBACK control_changed(int panel, int control, int event,
 		void *callbackData, int eventData1, int eventData2)
 {
+	double value;
+	int n;
+
 	if (event!=EVENT_COMMIT)
 		return 0;
 
@@ -107,13 +125,41 @@ int CVICALLBACK control_changed(int panel, int control, int event,
 		GetCtrlVal(panel, control, &do_draw_discs);
 		break;
 
-	// The following make the simulation have to re-init
+	// During a run these are steered, applied between two steps; otherwise
+	// the simulation has to re-init
 
 	case PANEL_NUM_LOGPERIOD:
-		init_needed=1;
-		GetCtrlVal(panel, control, &stepAvg);
+		GetCtrlVal(panel, control, &n);
+		if (AtomicLoad(&running))
+			SteerPost(STEER_STEP_AVG, n);
+		else {
+			stepAvg = n;
+			init_needed=1;
+		}
+		break;
+
+	case PANEL_NUM_DELTAT:
+		GetCtrlVal(panel, control, &value);
+		if (AtomicLoad(&running))
+			SteerPost(STEER_DELTA_T, value);
+		else {
+			deltaT = value;
+			init_needed=1;
+		}
 		break;
 
+	case PANEL_NUM_TEMP:
+		GetCtrlVal(panel, control, &value);
+		if (AtomicLoad(&running))
+			SteerPost(STEER_TEMPERATURE, value);
+		else {
+			temperature = value;
+			init_needed=1;
+		}
+		break;
+
+	// The following make the simulation have to re-init
+
 	case PANEL_NUM_SIZEX:
 		GetCtrlVal(panel, control, &initUcell.x);
 		init_needed=1;
@@ -124,16 +170,6 @@ int CVICALLBACK control_changed(int panel, int control, int event,
 		init_needed=1;
 		break;
 
-	case PANEL_NUM_DELTAT:
-		GetCtrlVal(panel, control, &deltaT);
-		init_needed=1;
-		break;
-
-	case PANEL_NUM_TEMP:
-		GetCtrlVal(panel, control, &temperature);
-		init_needed=1;
-		break;
-
 	case PANEL_NUM_DENSITY:
 		GetCtrlVal(panel, control, &density);
 		init_needed=1;
@@ -148,11 +184,18 @@ int CVICALLBACK control_changed(int panel, int control, int event,
 int CVICALLBACK button_pressed(int panel, int control, int event,
 		void *callbackData, int eventData1, int eventData2)
 {
+	int on;
+
 	if (event!=EVENT_COMMIT)
 		return 0;
 
 	switch(control) {
 	case PANEL_BTN_DRAW:
+		// During a run the drawing thread draws the state taken now
+		if (AtomicLoad(&running)) {
+			SteerPost(STEER_SNAPSHOT, 0.);
+			break;
+		}
 		// Initialize if needed to make sure we draw most recent values
 		if (init_needed) {
 			simulation_init();
@@ -166,8 +209,9 @@ int CVICALLBACK button_pressed(int panel, int control, int event,
 		break;
 
 	case PANEL_BTN_RUN:
-		GetCtrlVal(panel, control, &running);
-		if (running) {
+		GetCtrlVal(panel, control, &on);
+		AtomicStore(&running, on);
+		if (on) {
 			// start simulation thread
 			hThread = CreateThread(NULL, 0, &gui_simulation_run, NULL, 0, NULL);
 		}
@@ -198,8 +242,16 @@ void discs_clear(void)
 	CanvasClear (hPanel, PANEL_CANVAS, VAL_ENTIRE_OBJECT);
 }
 
-// Draw the discs on the canvas
+// Draw the discs of the most recent snapshot on the canvas
 void discs_draw(void)
+{
+	int fresh;
+
+	discs_draw_snapshot(SnapshotAcquire(&fresh));
+}
+
+// Draw the discs of snapshot s on the canvas
+void discs_draw_snapshot(Snapshot *s)
 {
 	int jj;
 	int mulx=400, muly=400;
@@ -210,8 +262,8 @@ void discs_draw(void)
 	SetCtrlAttribute (hPanel, PANEL_CANVAS, ATTR_PEN_COLOR, VAL_BLACK);
 	SetCtrlAttribute (hPanel, PANEL_CANVAS, ATTR_PEN_FILL_COLOR, VAL_RED);
 	
-	Lx=get_x_region();
-	Ly=get_y_region();
+	Lx=s->region.x;
+	Ly=s->region.y;
 	
 	// compute disc size; *2 because it's the diameter
 	size_x = rMin/Lx * (float)mulx * (float)disc_size/100.0;
@@ -220,9 +272,9 @@ void discs_draw(void)
 	// Draw the discs. Note that discs are drawn with their upper left corner
 	// fixed. Also, the field is always drawn as square, even if Lx!=Ly so
 	// circles in reality will be drawn as ovals.
-	for (jj=0;jj<nMol;jj++) {
-		x=get_x_coordinate(jj)+0.5*Lx; x=x/Lx; x=x*mulx;
-		y=get_y_coordinate(jj)+0.5*Ly; y=y/Ly; y=y*muly;
+	for (jj=0;jj<s->nMol;jj++) {
+		x=s->r[jj].x+0.5*Lx; x=x/Lx; x=x*mulx;
+		y=s->r[jj].y+0.5*Ly; y=y/Ly; y=y*muly;
  	  
 		//message("x,y= %7.4f %7.4f\n", x,y);
 
@@ -240,6 +292,31 @@ void gui_draw_end(void)
 	CanvasEndBatchDraw(hPanel, PANEL_CANVAS);
 }
 
+// Drawing thread: while the simulation runs, draw the newest snapshot it
+// published every RENDER_INTERVAL ms. The simulation never waits for this.
+DWORD WINAPI gui_render(LPVOID lpParameter)
+{
+	Snapshot *s;
+	int fresh, last;
+
+	do {
+		// One more round after we are told to stop, for the final state
+		last = !rendering;
+		s = SnapshotAcquire(&fresh);
+		if (fresh && do_draw_discs) {
+			gui_draw_begin();
+			discs_clear();
+			discs_draw_snapshot(s);
+			gui_draw_end();
+		}
+		if (!last)
+			Sleep(RENDER_INTERVAL);
+	} while (!last);
+
+	LogThreadDone();
+	return 0;
+}
+
 DWORD WINAPI gui_simulation_run(LPVOID lpParameter)
 {
 	unsigned t;
@@ -252,33 +329,42 @@ DWORD WINAPI gui_simulation_run(LPVOID lpParameter)
 	message("Starting simulation, %d steps\n", stepLimit);
 	SetCtrlVal(hPanel, PANEL_BTN_RUN, 1);
 
-	// Disable some GUI controls during simulation
-	SetCtrlAttribute(hPanel, PANEL_NUM_LOGPERIOD, ATTR_DIMMED, 1); 
+	// Disable the GUI controls that cannot be steered during simulation
 	SetCtrlAttribute(hPanel, PANEL_NUM_SIZEX, ATTR_DIMMED, 1); 
 	SetCtrlAttribute(hPanel, PANEL_NUM_SIZEY, ATTR_DIMMED, 1); 
-	SetCtrlAttribute(hPanel, PANEL_NUM_DELTAT, ATTR_DIMMED, 1); 
-	SetCtrlAttribute(hPanel, PANEL_NUM_TEMP, ATTR_DIMMED, 1); 
 	SetCtrlAttribute(hPanel, PANEL_NUM_DENSITY, ATTR_DIMMED, 1); 
 
 	ProcessDrawEvents();
 
+	// Start the drawing thread, run, and let it draw the final state
+	rendering = 1;
+	hRenderThread = CreateThread(NULL, 0, &gui_render, NULL, 0, NULL);
 	simulation_run();
+	rendering = 0;
+	WaitForSingleObject(hRenderThread, INFINITE);
+	CloseHandle(hRenderThread);
+	if (!AtomicLoad(&running))
+		message("Simulation aborted\n");
+
+	// From here on the controls set the values directly; apply what was
+	// posted as the run ended, so the controls below show it
+	AtomicStore(&running, 0);
+	SteerFlush();
 
 	// Now enable these controls again
-	SetCtrlAttribute(hPanel, PANEL_NUM_LOGPERIOD, ATTR_DIMMED, 0); 
 	SetCtrlAttribute(hPanel, PANEL_NUM_SIZEX, ATTR_DIMMED, 0); 
 	SetCtrlAttribute(hPanel, PANEL_NUM_SIZEY, ATTR_DIMMED, 0); 
-	SetCtrlAttribute(hPanel, PANEL_NUM_DELTAT, ATTR_DIMMED, 0); 
-	SetCtrlAttribute(hPanel, PANEL_NUM_TEMP, ATTR_DIMMED, 0); 
 	SetCtrlAttribute(hPanel, PANEL_NUM_DENSITY, ATTR_DIMMED, 0); 
 
+	// Show the values the run ended with
+	SetCtrlVal(hPanel, PANEL_NUM_LOGPERIOD, stepAvg);
+	SetCtrlVal(hPanel, PANEL_NUM_DELTAT, deltaT);
+	SetCtrlVal(hPanel, PANEL_NUM_TEMP, temperature);
+
 	
 	SetCtrlVal(hPanel, PANEL_BTN_RUN, 0);
-	if (!running)
-		message("Simulation aborted\n");
-	
-	running = 0;
 	
+	LogThreadDone();
 	return 0;
 }
 
@@ -289,25 +375,13 @@ void gui_simulation_step(void)
 	if ( !(stepCount%25) ) ProcessSystemEvents();
 }*/
 
-/* A general function to print messages, can also used in simulation.c!
- * You don't need to understand how this works, you only need to know that you
- * can use something like
- * 	message("the value of counter i is now %d\n", i);
- * to put something on screen.
+/* Messages are printed with message(), see logger.c, which can also be used
+ * in simulation.c! The log thread formats them and calls this to put them on
+ * screen; it writes the log file itself.
  */
-void message(const char *msg, ...)
+void show(int level, const char *text)
 {
-	char buf[4096];
-	va_list ap;
-
-	// Append message to text control and log file
-	va_start(ap, msg);
-	vsprintf(buf, msg, ap);
-	SetCtrlVal(hPanel, PANEL_MESSAGES, buf);
-	if (logfile) {
-		vfprintf(logfile, msg, ap);
-		fflush(logfile);
-	}
-	va_end(ap);
+	// Append message to text control
+	SetCtrlVal(hPanel, PANEL_MESSAGES, text);
 }
 
@@ -0,0 +1,556 @@
+/*
+ * Analysis of trajectory files
+ *
+ * Reads a trajectory written with trajName=<file> (see trajectory.h) frame
+ * by frame and works out, averaged over the frames,
+ *
+ *   rdf.txt    the radial distribution function g(r) up to rdfRange
+ *   msd.txt    the mean squared displacement, with the diffusion coefficient
+ *   sk.txt     the static structure factor S(k)
+ *   sk-direct.txt  with skCheck=1, S(k) of frame frameFirst summed directly
+ *              over the molecules, to check the FFT against
+ *   vdist.txt  the distributions of |v| and of the velocity components
+ *
+ * (the names get outPrefix in front). Only two frames are held at a time,
+ * and the MSD comes from the engine's multi-tau correlator, whose memory
+ * grows with the logarithm of the run, so files far larger than the memory
+ * are fine. The frames are put in mol[] and analysed with the engine's own
+ * code: the pairs are found by its cells and VisitPairs() with the same
+ * minimum image convention as the forces, S(k) by StructureAdd() and the
+ * MSD by TransportSample(), so the results agree with those of a run.
+ *
+ * While the nThreads workers analyse a frame, a thread of its own reads
+ * the next one, decoding it on readThreads threads, and adds its S(k). The
+ * positions in the file are wrapped into the region; for the MSD they are
+ * unwrapped again by taking the shortest way between successive frames, so
+ * no molecule may move more than half the region from one frame analysed to
+ * the next. A sheared run stores its shear rate and the shift of the
+ * Lees-Edwards boundaries with each frame, and the pairs and the unwrapping
+ * use them like the engine does; a molecule crossing the y boundary is
+ * taken to do so with the shift of the frame after it.
+ *
+ * Usage: md-analyse file [name=value ...], with the inputs in param[] and
+ * those of the engine that apply (nThreads, pinThreads, skGrid, corrLevels),
+ * for example
+ *
+ *   md trajName=run.trj trajPeriod=50 trajPrecision=1e-5
+ *   md-analyse run.trj frameFirst=100 rdfRange=5 nThreads=8
+ *
+ * Build with e.g.
+ *   cc -O2 -o md-analyse md-analyse.c trajreader.c md_api.c simulation.c \
+ *      random.c arena.c threads.c snapshot.c shmexport.c raster.c logger.c \
+ *      correlator.c transport.c fft.c structure.c cluster.c hexatic.c \
+ *      replica.c shear.c harddisk.c initconf.c balance.c domain.c \
+ *      trajectory.c eqcache.c blocking.c steer.c -lm -lpthread -lrt
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "simulation.h"
+#include "arena.h"
+#include "threads.h"
+#include "domain.h"
+#include "structure.h"
+#include "transport.h"
+#include "shear.h"
+#include "trajectory.h"
+#include "md_api.h"
+
+// Room for outPrefix, and for it with a file name after it
+#define OUT_PREFIX_MAX  256
+#define OUT_NAME_MAX    (OUT_PREFIX_MAX + 16)
+
+// The hooks the engine expects from its program, see main-cli.c
+int          running = 0;
+int          do_draw_discs = 0;
+unsigned int disc_size = 100;
+unsigned int drawing_period = 100;
+
+void discs_clear(void) { }
+void discs_draw(void) { }
+void gui_draw_begin(void) { }
+void gui_draw_end(void) { }
+
+// Frames analysed: frameFirst, frameFirst + frameStep, ... up to frameLast,
+// -1 for the last one in the file
+int frameFirst = 0, frameLast = -1, frameStep = 1;
+// Range of g(r), at most (and for 0) half the shorter side of the region,
+// and its bins
+double rdfRange = 5.;
+int rdfBins = 200;
+// Range of the velocity distributions, |v| in [0, vMax) and the components
+// in [-vMax, vMax), and their bins
+double vMax = 5.;
+int vBins = 100;
+// Threads decoding the frames, whether to work out S(k) and whether to
+// check it against the direct sum for the first frame analysed
+int readThreads = 2, doSk = 1, skCheck = 0;
+char outPrefix[OUT_PREFIX_MAX] = "";
+
+typedef struct {
+	const char *name;
+	char type;  // 'i' int, 'd' double, 's' string
+	void *p;
+	int size;   // size of a string buffer
+} Param;
+
+Param param[] = {
+	{ "frameFirst",  'i', &frameFirst },
+	{ "frameLast",   'i', &frameLast },
+	{ "frameStep",   'i', &frameStep },
+	{ "rdfRange",    'd', &rdfRange },
+	{ "rdfBins",     'i', &rdfBins },
+	{ "vMax",        'd', &vMax },
+	{ "vBins",       'i', &vBins },
+	{ "readThreads", 'i', &readThreads },
+	{ "doSk",        'i', &doSk },
+	{ "skCheck",     'i', &skCheck },
+	{ "outPrefix",   's', outPrefix, OUT_PREFIX_MAX },
+};
+
+#define N_PARAM  (sizeof (param) / sizeof (param[0]))
+
+// A frame read ahead: full(1) once read, -1 at the end of the file
+typedef struct {
+	VecR *r, *rv;
+	TrajHeader h;
+	int full;
+} Slot;
+
+TrajReader reader;
+Slot slot[2];
+int frameEnd;
+Mutex slotLock;
+Cond slotCond;
+
+StructureFactor sf;
+Arena arena;
+// Per thread: counts of the pair distances and of the velocities (|v|, vx,
+// vy), and the sum of v^2
+double *rdfHist, *vHist, *vvPart;
+double rdfWidth, vWidth;
+double timeFirst;
+int nFrame, hasVel;
+
+
+// Set input from an argument name=value.
+// Return: 0 on success, -1 if the argument is not understood
+int set_param(const char *arg)
+{
+	char name[64];
+	const char *value;
+	size_t len;
+	unsigned int k;
+	Param *p;
+
+	if (!(value = strchr(arg, '=')))
+		return -1;
+	len = value - arg;
+	++value;
+
+	for (k = 0; k < N_PARAM; k++) {
+		p = &param[k];
+		if (strlen(p->name) != len || strncmp(p->name, arg, len) != 0)
+			continue;
+		switch (p->type) {
+		case 'i': *(int *) p->p = atoi(value); break;
+		case 'd': *(double *) p->p = atof(value); break;
+		case 's':
+			strncpy((char *) p->p, value, p->size - 1);
+			((char *) p->p)[p->size - 1] = '\0';
+			break;
+		}
+		return 0;
+	}
+	if (len >= sizeof(name))
+		return -1;
+	memcpy(name, arg, len);
+	name[len] = '\0';
+	return md_set_input(name, value);
+}
+
+// Show a logged message, called from the log thread
+void show(int level, const char *text)
+{
+	fputs(text, level >= LOG_WARN ? stderr : stdout);
+	fflush(level >= LOG_WARN ? stderr : stdout);
+}
+
+// Read the frames after the first into the slots in turn, adding their
+// S(k), and mark the end with a slot that is not full
+void read_run(void *arg)
+{
+	Slot *s;
+	int frame, i = 1, k, ok;
+
+	for (frame = frameFirst + frameStep; ; frame += frameStep, i ^= 1) {
+		s = &slot[i];
+		MutexLock(&slotLock);
+		while (s->full == 1)
+			CondWait(&slotCond, &slotLock);
+		MutexUnlock(&slotLock);
+
+		ok = frame <= frameEnd;
+		// Skipped frames are still decoded, the next ones may need them
+		for (k = 1; ok && k < frameStep; k++)
+			ok = TrajReaderNext(&reader, NULL, NULL) == 0;
+		ok = ok && TrajReaderNext(&reader, s->r, s->rv) == 0;
+		if (ok) {
+			s->h = reader.h;
+			if (doSk)
+				StructureAdd(&sf, s->r, reader.nMol);
+		}
+
+		MutexLock(&slotLock);
+		s->full = ok ? 1 : -1;
+		CondBroadcast(&slotCond);
+		MutexUnlock(&slotLock);
+		if (!ok)
+			return;
+	}
+}
+
+// Wait until slot s has been read.
+// Return: whether it holds a frame
+int slot_wait(Slot *s)
+{
+	MutexLock(&slotLock);
+	while (s->full == 0)
+		CondWait(&slotCond, &slotLock);
+	MutexUnlock(&slotLock);
+	return s->full == 1;
+}
+
+void slot_release(Slot *s)
+{
+	MutexLock(&slotLock);
+	s->full = 0;
+	CondBroadcast(&slotCond);
+	MutexUnlock(&slotLock);
+}
+
+// Frame being analysed, for the threads
+Slot *cur;
+
+// Take over the molecules of thread tid from the frame, following them
+// across the boundaries, and count their velocities
+void analyse_mols(int tid)
+{
+	VecR dr, *r = cur->r, *rv = cur->rv;
+	double *h = vHist + (size_t) tid * 3 * vBins, vv = 0.;
+	int b, n;
+
+	DO_MOL_OF (tid) {
+		if (nFrame > 0) {
+			VSub(dr, r[n], mol[n].r);
+			// Under shear the image above is shifted along x, so the
+			// shift can take dr.x beyond a whole region
+			if (dr.y >= 0.5 * region.y) {
+				-- molImage[n].y;
+				dr.x -= shearShift;
+			} else if (dr.y < -0.5 * region.y) {
+				++ molImage[n].y;
+				dr.x += shearShift;
+			}
+			molImage[n].x -= (int) floor(dr.x / region.x + 0.5);
+		}
+		else
+			VZero(molImage[n]);
+		mol[n].r = r[n];
+	}
+	TransportSample(tid);
+	if (!hasVel)
+		return;
+	DO_MOL_OF (tid) {
+		mol[n].rv = rv[n];
+		vv += VLenSq(rv[n]);
+		b = (int) (VLen(rv[n]) / vWidth);
+		if (b < vBins) ++ h[b];
+		b = (int) floor((rv[n].x + vMax) / (2. * vWidth));
+		if (b >= 0 && b < vBins) ++ h[vBins + b];
+		b = (int) floor((rv[n].y + vMax) / (2. * vWidth));
+		if (b >= 0 && b < vBins) ++ h[2 * vBins + b];
+	}
+	vvPart[tid] += vv;
+}
+
+void count_pair(int j1, int j2, VecR *dr, double rr, void *arg)
+{
+	++ ((double *) arg)[Min((int) (sqrt(rr) / rdfWidth), rdfBins - 1)];
+}
+
+// Count the pairs whose first molecule lies in the cell rows of thread tid;
+// every pair is counted from both ends
+void analyse_pairs(int tid)
+{
+	VisitPairs(tid, rdfRange, count_pair, rdfHist + (size_t) tid * rdfBins);
+}
+
+// Set up for the first frame, in slot 0.
+// Return: 0 on success, -1 if out of memory
+int analyse_init(void)
+{
+	TrajHeader *h = &slot[0].h;
+
+	nMol = reader.nMol;
+	VSet(region, h->region[0], h->region[1]);
+	shearRate = h->shearRate;
+	if (rdfRange <= 0. || rdfRange > 0.5 * Min(region.x, region.y))
+		rdfRange = 0.5 * Min(region.x, region.y);
+	rdfWidth = rdfRange / rdfBins;
+	vWidth = vMax / vBins;
+	hasVel = (h->flags & TRAJ_VEL) != 0;
+
+	// Cells as in the engine; VisitPairs() searches as many as rdfRange needs
+	rMin = pow(2., 1./6.);
+	VSCopy(cells, 1. / rMin, region);
+	if (cells.x < (shearRate != 0. ? 4 : 3)) cells.x = 1;
+	if (cells.y < 3) cells.y = 1;
+	DomainSlabs();
+	ThreadsInit();
+	Decompose();
+
+	// Every frame is a sample of the MSD, at the time between frames
+	corrPeriod = 0;
+	msdPeriod = 1;
+	stepCount = 0;
+	ArenaInit(&arena, hugePages);
+	AllocMemArena(&arena, mol, nMol, Mol);
+	AllocMemArena(&arena, cellList, nMol + VProd(cells), int);
+	AllocMemArena(&arena, molImage, nMol, VecI);
+	AllocMemArena(&arena, rdfHist, nThreadsUsed * rdfBins, double);
+	AllocMemArena(&arena, vHist, nThreadsUsed * 3 * vBins, double);
+	AllocMemArena(&arena, vvPart, nThreadsUsed, double);
+	if (!mol || !cellList || !molImage || !rdfHist || !vHist || !vvPart)
+		return -1;
+	memset(rdfHist, 0, nThreadsUsed * rdfBins * sizeof(double));
+	memset(vHist, 0, nThreadsUsed * 3 * vBins * sizeof(double));
+	memset(vvPart, 0, nThreadsUsed * sizeof(double));
+	TransportInit(&arena);
+	if (doSk) {
+		StructureInit(&sf, &arena, SkGridPoints(region), region);
+		if (!sf.rho || !sf.nSum)
+			return -1;
+	}
+	message("%d molecules in a %.4f x %.4f region, %d threads, %d x %d cells\n",
+		nMol, region.x, region.y, nThreadsUsed, cells.x, cells.y);
+	if (shearRate != 0.)
+		message("Sheared at rate %.4f, Lees-Edwards boundaries\n", shearRate);
+	return 0;
+}
+
+// Analyse the frame in slot s, after the one before it
+void analyse_frame(Slot *s)
+{
+	cur = s;
+	if (nFrame == 0)
+		timeFirst = s->h.timeNow;
+	else if (nFrame == 1)
+		deltaT = s->h.timeNow - timeNow;
+	else if (nFrame > 1 && fabs(s->h.timeNow - timeNow - deltaT) > 1e-6 * deltaT)
+		LogWarn("Warning: frame at t = %.4f is not %.4f after the one before, the MSD is off\n",
+			s->h.timeNow, deltaT);
+	timeNow = s->h.timeNow;
+	shearShift = s->h.shearShift;
+	ThreadsRun(analyse_mols);
+	BuildCells();
+	ThreadsRun(analyse_pairs);
+	++ nFrame;
+}
+
+// Write name with outPrefix in front to buffer out
+const char *out_name(char *out, const char *name)
+{
+	snprintf(out, OUT_NAME_MAX, "%s%s", outPrefix, name);
+	return out;
+}
+
+// Compare S(k) of the n molecules at r by FFT with the direct sum over
+// them, shell by shell, relative to S(k) or to 0.1 where it is smaller (a
+// lattice has S near 0 between its peaks), and write the direct one to file
+void check_sk(VecR *r, int n, const char *file)
+{
+	StructureFactor fft, direct;
+	double d, dMax = 0., kMax = 0., kPeak, sPeak;
+	int b;
+
+	StructureInit(&fft, &arena, SkGridPoints(region), region);
+	StructureInit(&direct, &arena, SkGridPoints(region), region);
+	if (!fft.nSum || !direct.nSum) {
+		LogError("Error: no memory for the S(k) check\n");
+		return;
+	}
+	StructureAdd(&fft, r, n);
+	StructureDirect(&direct, r, n);
+	for (b = 0; b < direct.nBin; b++) {
+		if (direct.nSum[b] == 0.)
+			continue;
+		d = fabs(fft.sSum[b] - direct.sSum[b]) / Max(direct.sSum[b] / direct.nSum[b], 0.1) /
+			direct.nSum[b];
+		if (d > dMax) {
+			dMax = d;
+			kMax = direct.kSum[b] / direct.nSum[b];
+		}
+	}
+	if (StructureWrite(&direct, file, &kPeak, &sPeak) != 0)
+		LogError("Error: could not write S(k) to %s.\n", file);
+	message("S(k) check on frame %d: FFT and direct sum differ by at most %.2f%% "
+		"(at k = %.3f) up to k = %.2f\n", frameFirst, 100. * dMax, kMax, direct.nBin * direct.dk);
+}
+
+// Add the counts of the threads up into those of thread 0
+void sum_threads(double *h, int n)
+{
+	int b, t;
+
+	for (t = 1; t < nThreadsUsed; t++)
+		for (b = 0; b < n; b++)
+			h[b] += h[(size_t) t * n + b];
+}
+
+void write_rdf(const char *filename)
+{
+	FILE *f;
+	double g, gPeak = 0., r, rPeak = 0., norm;
+	int b;
+
+	if (!(f = fopen(filename, "w"))) {
+		LogError("Error: could not write g(r) to %s.\n", filename);
+		return;
+	}
+	sum_threads(rdfHist, rdfBins);
+	// Pairs counted from both ends, against those of an ideal gas
+	norm = (double) nFrame * nMol * nMol / VProd(region);
+	fprintf(f, "   r         g(r)\n");
+	for (b = 0; b < rdfBins; b++) {
+		r = (b + 0.5) * rdfWidth;
+		g = rdfHist[b] / (norm * M_PI * (Sqr((b + 1) * rdfWidth) - Sqr(b * rdfWidth)));
+		if (g > gPeak) {
+			gPeak = g;
+			rPeak = r;
+		}
+		fprintf(f, "%9.4f %11.4e\n", r, g);
+	}
+	fclose(f);
+	message("g(r) up to r = %.2f: peak %.3f at r = %.3f\n", rdfRange, gPeak, rPeak);
+}
+
+void write_vdist(const char *filename)
+{
+	FILE *f;
+	double norm;
+	int b;
+
+	if (!(f = fopen(filename, "w"))) {
+		LogError("Error: could not write the velocity distribution to %s.\n", filename);
+		return;
+	}
+	sum_threads(vHist, 3 * vBins);
+	sum_threads(vvPart, 1);
+	norm = (double) nFrame * nMol;
+	fprintf(f, "   |v|       P(|v|)       v         P(vx)       P(vy)\n");
+	for (b = 0; b < vBins; b++)
+		fprintf(f, "%9.4f %11.4e %9.4f %11.4e %11.4e\n", (b + 0.5) * vWidth,
+			vHist[b] / (norm * vWidth), -vMax + (2 * b + 1) * vWidth,
+			vHist[vBins + b] / (norm * 2. * vWidth),
+			vHist[2 * vBins + b] / (norm * 2. * vWidth));
+	fclose(f);
+	message("Velocities: temperature %.4f\n", vvPart[0] / (n_dimensions * norm));
+}
+
+// Program entry point: execution starts here
+int main(int argc, char *argv[])
+{
+	char out[OUT_NAME_MAX];
+	Thread readThread;
+	double kPeak, sPeak, t0;
+	unsigned int k;
+	int i, reading;
+
+	for (i = 2; i < argc; i++) {
+		if (set_param(argv[i]) != 0)
+			break;
+	}
+	if (argc < 2 || i < argc || frameStep < 1 || rdfBins < 1 || vBins < 1 || vMax <= 0.) {
+		fprintf(stderr, "Usage: %s file [name=value ...]\nInputs:", argv[0]);
+		for (k = 0; k < N_PARAM; k++)
+			fprintf(stderr, " %s", param[k].name);
+		fprintf(stderr, " nThreads pinThreads skGrid corrLevels\n");
+		return 1;
+	}
+	LogInit(NULL, show);
+	// This program owns its main thread, which works as thread 0
+	pinCaller = 1;
+	if (TrajReaderOpen(&reader, argv[1], readThreads) != 0) {
+		LogError("Error: could not read a trajectory from %s\n", argv[1]);
+		LogFree();
+		return 1;
+	}
+	frameEnd = frameLast < 0 ? reader.nFrame - 1 : Min(frameLast, reader.nFrame - 1);
+	for (i = 0; i < 2; i++) {
+		slot[i].r = malloc(reader.nMol * sizeof(VecR));
+		slot[i].rv = malloc(reader.nMol * sizeof(VecR));
+	}
+	if (!slot[0].r || !slot[0].rv || !slot[1].r || !slot[1].rv) {
+		LogError("Error: no memory for %d molecules\n", reader.nMol);
+		LogFree();
+		return 1;
+	}
+	if (frameFirst > frameEnd || TrajReaderSeek(&reader, frameFirst) != 0 ||
+			TrajReaderNext(&reader, slot[0].r, slot[0].rv) != 0) {
+		LogError("Error: %s has no frames %d to %d\n", argv[1], frameFirst, frameEnd);
+		LogFree();
+		return 1;
+	}
+	slot[0].h = reader.h;
+	slot[0].full = 1;
+	if (analyse_init() != 0) {
+		LogError("Error: no memory for the analysis\n");
+		LogFree();
+		return 1;
+	}
+	if (doSk)
+		StructureAdd(&sf, slot[0].r, nMol);
+	if (doSk && skCheck)
+		check_sk(slot[0].r, nMol, out_name(out, "sk-direct.txt"));
+
+	message("Analysing frames %d to %d of %s, every %d\n", frameFirst, frameEnd,
+		argv[1], frameStep);
+	t0 = WallClock();
+	MutexInit(&slotLock);
+	CondInit(&slotCond);
+	reading = ThreadCreate(&readThread, read_run, NULL) == 0;
+	if (!reading)
+		LogError("Error: could not start the reading thread\n");
+	for (i = 0; slot_wait(&slot[i]); i ^= 1) {
+		analyse_frame(&slot[i]);
+		slot_release(&slot[i]);
+		if (!reading)
+			break;
+	}
+	if (reading)
+		ThreadJoin(readThread);
+	t0 = WallClock() - t0;
+	message("%d frames, t = %.4f to %.4f, in %.2f s: %.3g molecules per second\n",
+		nFrame, timeFirst, timeNow, t0, (double) nFrame * nMol / Max(t0, 1e-9));
+
+	write_rdf(out_name(out, "rdf.txt"));
+	if (nFrame > 1)
+		TransportReport(NULL, out_name(out, "msd.txt"));
+	if (doSk) {
+		if (StructureWrite(&sf, out_name(out, "sk.txt"), &kPeak, &sPeak) == 0)
+			message("S(k) over %d frames: peak %.3f at k = %.3f\n", sf.nSample, sPeak, kPeak);
+		else
+			LogError("Error: could not write S(k) to %s.\n", out);
+	}
+	if (hasVel)
+		write_vdist(out_name(out, "vdist.txt"));
+
+	TrajReaderClose(&reader);
+	ThreadsFree();
+	ArenaFree(&arena);
+	LogFree();
+	return 0;
+}
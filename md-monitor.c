@@ -0,0 +1,82 @@
+/*
+ * Live viewer for a simulation that exports its state to shared memory
+ *
+ * Attaches read-only to the segment of a simulation started with
+ * shmName=<name> and prints its summary lines as they appear, together
+ * with the kinetic energy computed from the exported velocities.
+ *
+ * Build with e.g.
+ *   cc -O2 -o md-monitor md-monitor.c shmreader.c -lrt
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WINDOWS
+#	include <windows.h>
+#	define sleep_ms(t)  Sleep (t)
+#else
+#	include <unistd.h>
+#	define sleep_ms(t)  usleep ((t) * 1000)
+#endif
+
+#include "in_vdefs.h"
+#include "shmexport.h"
+
+int main(int argc, char *argv[])
+{
+	const char *names[SHM_N_SUMMARY] = SHM_SUMMARY_NAMES;
+	ShmReader rd;
+	ShmHeader h;
+	VecR *rv = NULL;
+	double vvSum;
+	int interval, k, n, nAlloc = 0, lastSummary = -1, lastStep = -1;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s name [interval in ms]\n", argv[0]);
+		return 1;
+	}
+	interval = (argc > 2) ? atoi(argv[2]) : 200;
+	if (ShmReaderOpen(&rd, argv[1]) != 0) {
+		fprintf(stderr, "Error: no simulation exports to %s\n", argv[1]);
+		return 1;
+	}
+
+	printf(" Step   Time    Ekin(v)");
+	for (k = 0; k < SHM_N_SUMMARY; k++)
+		printf(" %-15s", names[k]);
+	printf("\n");
+
+	for (;;) {
+		// Peek at the size, then read a consistent copy
+		if (ShmReaderRead(&rd, &h, NULL, NULL, 0) < 0)
+			break;
+		if (h.nMol > nAlloc) {
+			free(rv);
+			nAlloc = h.nMol;
+			rv = malloc(nAlloc * sizeof(VecR));
+		}
+		if ((n = ShmReaderRead(&rd, &h, NULL, rv, nAlloc)) < 0)
+			break;
+
+		if (h.stepCount != lastStep && n > 0) {
+			vvSum = 0.;
+			for (k = 0; k < n; k++)
+				vvSum += VLenSq(rv[k]);
+			printf("%5d %8.4f %7.4f", h.stepCount, h.timeNow, 0.5 * vvSum / n);
+			if (h.summaryStep != lastSummary && h.summaryStep > 0) {
+				for (k = 0; k < SHM_N_SUMMARY; k++)
+					printf(" %7.4f %7.4f", h.summary[k][0], h.summary[k][1]);
+				lastSummary = h.summaryStep;
+			}
+			printf("\n");
+			fflush(stdout);
+			lastStep = h.stepCount;
+		}
+		sleep_ms(interval);
+	}
+
+	printf("Simulation has ended\n");
+	ShmReaderClose(&rd);
+	free(rv);
+	return 0;
+}
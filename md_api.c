@@ -0,0 +1,244 @@
+/*
+ * Programming interface for driving the engine from other programs
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "simulation.h"
+#include "shmexport.h"
+#include "transport.h"
+#include "structure.h"
+#include "cluster.h"
+#include "hexatic.h"
+#include "replica.h"
+#include "shear.h"
+#include "harddisk.h"
+#include "initconf.h"
+#include "balance.h"
+#include "trajectory.h"
+#include "eqcache.h"
+#include "threads.h"
+#include "steer.h"
+#include "md_api.h"
+
+/*
+ * Inputs of the engine, by name
+ */
+typedef struct {
+	const char *name;
+	char type;  // 'i' int, 'd' double, 's' string
+	void *p;
+	int size;   // size of a string buffer
+} Input;
+
+Input input[] = {
+	{ "initUcell.x",    'i', &initUcell.x },
+	{ "initUcell.y",    'i', &initUcell.y },
+	{ "initLattice",    'i', &initLattice },
+	{ "initMol",        'i', &initMol },
+	{ "stepLimit",      'i', &stepLimit },
+	{ "stopError",      'd', &stopError },
+	{ "deltaT",         'd', &deltaT },
+	{ "stepAvg",        'i', &stepAvg },
+	{ "stepSample",     'i', &stepSample },
+	{ "temperature",    'd', &temperature },
+	{ "density",        'd', &density },
+	{ "hugePages",      'i', &hugePages },
+	{ "nThreads",       'i', &nThreads },
+	{ "pinThreads",     'i', &pinThreads },
+	{ "balancePeriod",  'i', &balancePeriod },
+	{ "randSeed",       'i', &randSeed },
+	{ "reproSums",      'i', &reproSums },
+	{ "trajName",       's', trajName, TRAJ_NAME_MAX },
+	{ "trajPeriod",     'i', &trajPeriod },
+	{ "trajKeyPeriod",  'i', &trajKeyPeriod },
+	{ "trajPrecision",  'd', &trajPrecision },
+	{ "trajVelQuantum", 'd', &trajVelQuantum },
+	{ "trajThreads",    'i', &trajThreads },
+	{ "cacheDir",       's', cacheDir, CACHE_NAME_MAX },
+	{ "cacheEquil",     'i', &cacheEquil },
+	{ "cacheSave",      'i', &cacheSave },
+	{ "shmName",        's', shmName, SHM_NAME_MAX },
+	{ "shmPeriod",      'i', &shmPeriod },
+	{ "logLevel",       'i', &logLevel },
+	{ "corrPeriod",     'i', &corrPeriod },
+	{ "corrLevels",     'i', &corrLevels },
+	{ "msdPeriod",      'i', &msdPeriod },
+	{ "skPeriod",       'i', &skPeriod },
+	{ "skGrid",         'i', &skGrid },
+	{ "clusterPeriod",  'i', &clusterPeriod },
+	{ "clusterDist",    'd', &clusterDist },
+	{ "hexPeriod",      'i', &hexPeriod },
+	{ "hexCut",         'd', &hexCut },
+	{ "hexRange",       'd', &hexRange },
+	{ "nReplicas",      'i', &nReplicas },
+	{ "replicaPeriod",  'i', &replicaPeriod },
+	{ "replicaTMax",    'd', &replicaTMax },
+	{ "shearRate",      'd', &shearRate },
+	{ "hardDisks",      'i', &hardDisks },
+};
+
+#define N_INPUT  (sizeof (input) / sizeof (input[0]))
+
+static int generation = 0;
+
+
+static Input *find_input(const char *name)
+{
+	unsigned int k;
+
+	for (k = 0; k < N_INPUT; k++) {
+		if (strcmp(input[k].name, name) == 0)
+			return &input[k];
+	}
+	return NULL;
+}
+
+// Set input name from its value as text.
+// Return: 0 on success, -1 if there is no such input
+int md_set_input(const char *name, const char *value)
+{
+	Input *p;
+
+	if (!(p = find_input(name)))
+		return -1;
+	switch (p->type) {
+	case 'i': *(int *) p->p = atoi(value); break;
+	case 'd': *(double *) p->p = atof(value); break;
+	case 's':
+		strncpy((char *) p->p, value, p->size - 1);
+		((char *) p->p)[p->size - 1] = '\0';
+		break;
+	}
+	return 0;
+}
+
+// Write the value of input name as text to value, of size bytes.
+// Return: 0 on success, -1 if there is no such input
+int md_get_input(const char *name, char *value, int size)
+{
+	Input *p;
+
+	if (!(p = find_input(name)) || size <= 0)
+		return -1;
+	switch (p->type) {
+	case 'i': snprintf(value, size, "%d", *(int *) p->p); break;
+	case 'd':
+		// As short as possible, but reading it back gives the same value
+		snprintf(value, size, "%.15g", *(double *) p->p);
+		if (atof(value) != *(double *) p->p)
+			snprintf(value, size, "%.17g", *(double *) p->p);
+		break;
+	case 's': snprintf(value, size, "%s", (char *) p->p); break;
+	}
+	return 0;
+}
+
+// Return: the name of input k, NULL after the last one
+const char *md_input_name(int k)
+{
+	return k >= 0 && k < (int) N_INPUT ? input[k].name : NULL;
+}
+
+
+/*
+ * Run control
+ */
+
+// Start from the initial state with the current inputs; all views made
+// before become invalid
+void md_init(void)
+{
+	simulation_init();
+	++generation;
+}
+
+// Take nSteps steps, with the sampling and output due on them. Replica
+// exchange only runs whole, with md_run().
+// Return: the number of steps taken, fewer if md_stop() was called, -1
+// with nReplicas > 1
+int md_step(int nSteps)
+{
+	if (nReplicas > 1) {
+		LogError("Error: replica exchange runs with md_run() only\n");
+		return -1;
+	}
+	AtomicStore(&running, 1);
+	return simulation_steps(nSteps);
+}
+
+// Run stepLimit steps and report, like the command line program
+void md_run(void)
+{
+	message("Starting simulation, %d steps\n", stepLimit);
+	simulation_run();
+}
+
+// Stop md_step() or md_run() after the current step; may be called from
+// any thread or a signal handler
+void md_stop(void)
+{
+	AtomicStore(&running, 0);
+}
+
+// Queue a steering command such as "temperature 0.8", applied before the
+// next step; may be called from any thread, also while md_step() runs.
+// Return: 0 on success, -1 if the command is not understood or the queue
+// is full
+int md_steer(const char *command)
+{
+	return SteerParse(command);
+}
+
+// Return: a number that changes whenever the views become invalid
+int md_generation(void)
+{
+	return generation;
+}
+
+
+/*
+ * Views and status
+ */
+
+// Fill in v for array (one of MD_POSITIONS etc.).
+// Return: 0 on success, -1 before md_init() or for an unknown array
+int md_view_get(int array, md_view *v)
+{
+	if (!mol || generation == 0)
+		return -1;
+	switch (array) {
+	case MD_POSITIONS:     v->data = &mol[0].r.x; break;
+	case MD_VELOCITIES:    v->data = &mol[0].rv.x; break;
+	case MD_ACCELERATIONS: v->data = &mol[0].ra.x; break;
+	default: return -1;
+	}
+	v->n = nMol;
+	v->dim = n_dimensions;
+	v->stride = sizeof(Mol);
+	v->itemStride = offsetof(VecR, y) - offsetof(VecR, x);
+	v->generation = generation;
+	return 0;
+}
+
+// Return: whether view v may still be used
+int md_view_valid(const md_view *v)
+{
+	return v->generation == generation && generation > 0;
+}
+
+void md_status_get(md_status *s)
+{
+	memset(s, 0, sizeof(*s));
+	s->stepCount = stepCount;
+	s->nMol = nMol;
+	s->dim = n_dimensions;
+	s->time = timeNow;
+	s->region[0] = region.x;
+	s->region[1] = region.y;
+	s->kinEnergy = kinEnergy.val;
+	s->totEnergy = totEnergy.val;
+	s->pressure = pressure.val;
+}
@@ -0,0 +1,58 @@
+/*
+ * Programming interface for driving the engine from other programs
+ *
+ * The particle arrays are exposed as strided views into the engine's own
+ * memory: element (n, d) of a view is the double at
+ *   (char *) v.data + n * v.stride + d * v.itemStride,
+ * so callers read (and may change) the state without copying it. A view
+ * stays valid until the next md_init(); md_view_valid() tells.
+ *
+ * Inputs are set by name, with the names listed by PrintNameList(), and
+ * take effect at the next md_init(); md_steer() changes a few of them while
+ * steps are being taken, see steer.h. The steps run on the calling thread,
+ * which acts as thread 0 of the engine's pool; the program must define the
+ * display hooks of simulation.h like main-cli.c does.
+ */
+#ifndef __MD_API_H__
+#define __MD_API_H__
+
+#include <stddef.h>
+
+// Arrays that can be viewed
+#define MD_POSITIONS      0
+#define MD_VELOCITIES     1
+#define MD_ACCELERATIONS  2
+
+#define MD_MAX_DIM  3
+
+typedef struct {
+	double *data;          // component 0 of molecule 0
+	int n, dim;            // number of molecules and of components
+	ptrdiff_t stride;      // bytes from one molecule to the next
+	ptrdiff_t itemStride;  // bytes from one component to the next
+	int generation;        // md_generation() when the view was made
+} md_view;
+
+typedef struct {
+	int stepCount, nMol, dim;
+	double time;
+	double region[MD_MAX_DIM];
+	double kinEnergy, totEnergy, pressure;  // of the last sample step
+} md_status;
+
+int         md_set_input(const char *name, const char *value);
+int         md_get_input(const char *name, char *value, int size);
+const char *md_input_name(int k);
+
+void md_init(void);
+int  md_step(int nSteps);
+void md_run(void);
+void md_stop(void);
+int  md_steer(const char *command);
+int  md_generation(void);
+
+int  md_view_get(int array, md_view *v);
+int  md_view_valid(const md_view *v);
+void md_status_get(md_status *s);
+
+#endif /* __MD_API_H__ */
@@ -0,0 +1,392 @@
+/*
+ * Python module md: the engine driven from Python
+ *
+ * The particle arrays are returned as View objects that export the
+ * engine's memory through the buffer protocol, as n x dim arrays of
+ * doubles with the strides of md_view; numpy.asarray() or memoryview()
+ * then use that memory directly, without copying. For example
+ *
+ *   import md, numpy
+ *   md.init(density=0.7, temperature=0.5)
+ *   r = numpy.asarray(md.positions())
+ *   while md.step(100) == 100:
+ *       print(md.status()["step"], r[:, 0].mean())
+ *   del r
+ *   md.init(density=0.8)
+ *
+ * Every exported buffer is counted until it is released, and md.init()
+ * raises BufferError while any is alive, as it frees the memory they use;
+ * drop the arrays (del r) first. View objects made before an md.init()
+ * refuse to export. While one thread is in md.init(), md.step() or
+ * md.run(), the others get RuntimeError from those and md.set(); md.stop()
+ * and md.steer() work from any thread. Build with setup.py.
+ */
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <stdio.h>
+
+#include "simulation.h"
+#include "shmexport.h"
+#include "threads.h"
+#include "md_api.h"
+
+// The hooks the engine expects from its program, see main-cli.c
+int          running = 0;
+int          do_draw_discs = 0;
+unsigned int disc_size = 100;
+unsigned int drawing_period = 100;
+
+void discs_clear(void) { }
+void discs_draw(void) { }
+void gui_draw_begin(void) { }
+void gui_draw_end(void) { }
+
+// Show a logged message, called from the log thread
+static void show(int level, const char *text)
+{
+	fputs(text, level >= LOG_WARN ? stderr : stdout);
+	fflush(level >= LOG_WARN ? stderr : stdout);
+}
+
+
+/*
+ * View objects
+ */
+typedef struct {
+	PyObject_HEAD
+	md_view view;
+	Py_ssize_t shape[2], strides[2];
+} ViewObject;
+
+// Buffers exported and not yet released, which md.init() waits for
+static Py_ssize_t nExported = 0;
+
+static int view_getbuffer(PyObject *self, Py_buffer *b, int flags)
+{
+	ViewObject *v = (ViewObject *) self;
+
+	if (!md_view_valid(&v->view)) {
+		PyErr_SetString(PyExc_BufferError, "view is out of date, md.init() was called since");
+		b->obj = NULL;
+		return -1;
+	}
+	if ((flags & PyBUF_STRIDES) != PyBUF_STRIDES) {
+		PyErr_SetString(PyExc_BufferError, "view is not contiguous, ask for strides");
+		b->obj = NULL;
+		return -1;
+	}
+	b->buf = v->view.data;
+	b->obj = self;
+	Py_INCREF(self);
+	b->len = v->shape[0] * v->shape[1] * sizeof(double);
+	b->itemsize = sizeof(double);
+	b->readonly = 0;
+	b->ndim = 2;
+	b->format = (flags & PyBUF_FORMAT) ? "d" : NULL;
+	b->shape = v->shape;
+	b->strides = v->strides;
+	b->suboffsets = NULL;
+	b->internal = NULL;
+	++nExported;
+	return 0;
+}
+
+static void view_releasebuffer(PyObject *self, Py_buffer *b)
+{
+	--nExported;
+}
+
+static PyBufferProcs view_as_buffer = {
+	view_getbuffer,
+	view_releasebuffer,
+};
+
+static PyObject *view_valid(PyObject *self, PyObject *unused)
+{
+	return PyBool_FromLong(md_view_valid(&((ViewObject *) self)->view));
+}
+
+static PyMethodDef view_methods[] = {
+	{ "valid", view_valid, METH_NOARGS, "Whether the view can still be used." },
+	{ NULL }
+};
+
+static PyTypeObject ViewType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "md.View",
+	.tp_basicsize = sizeof(ViewObject),
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_doc = "Strided view of a particle array of the engine (buffer protocol).",
+	.tp_as_buffer = &view_as_buffer,
+	.tp_methods = view_methods,
+};
+
+static PyObject *make_view(int array)
+{
+	ViewObject *v;
+
+	if (!(v = PyObject_New(ViewObject, &ViewType)))
+		return NULL;
+	if (md_view_get(array, &v->view) != 0) {
+		Py_DECREF(v);
+		PyErr_SetString(PyExc_RuntimeError, "no state yet, call md.init() first");
+		return NULL;
+	}
+	v->shape[0] = v->view.n;
+	v->shape[1] = v->view.dim;
+	v->strides[0] = v->view.stride;
+	v->strides[1] = v->view.itemStride;
+	return (PyObject *) v;
+}
+
+
+/*
+ * Module functions
+ */
+
+// Set input name to the text of value
+static int set_input(PyObject *name, PyObject *value)
+{
+	PyObject *text;
+	const char *n, *t;
+	int r;
+
+	if (!(n = PyUnicode_AsUTF8(name)) || !(text = PyObject_Str(value)))
+		return -1;
+	if (!(t = PyUnicode_AsUTF8(text))) {
+		Py_DECREF(text);
+		return -1;
+	}
+	r = md_set_input(n, t);
+	Py_DECREF(text);
+	if (r != 0) {
+		PyErr_Format(PyExc_KeyError, "no input named %s", n);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * The engine runs without the GIL, so other Python threads go on meanwhile;
+ * engineBusy, only touched with the GIL held, keeps them from starting or
+ * re-initialising it under the running steps.
+ */
+static int engineBusy = 0;
+
+// Claim the engine for a call that releases the GIL.
+// Return: 0 on success, -1 with RuntimeError set if it is in use
+static int engine_claim(void)
+{
+	if (engineBusy) {
+		PyErr_SetString(PyExc_RuntimeError, "the engine is busy in another thread");
+		return -1;
+	}
+	engineBusy = 1;
+	return 0;
+}
+
+static PyObject *md_py_set(PyObject *self, PyObject *args)
+{
+	PyObject *name, *value;
+
+	if (engineBusy) {
+		PyErr_SetString(PyExc_RuntimeError, "the engine is busy in another thread");
+		return NULL;
+	}
+	if (!PyArg_ParseTuple(args, "UO", &name, &value) || set_input(name, value) != 0)
+		return NULL;
+	Py_RETURN_NONE;
+}
+
+static PyObject *md_py_get(PyObject *self, PyObject *args)
+{
+	const char *name;
+	char value[256];
+
+	if (!PyArg_ParseTuple(args, "s", &name))
+		return NULL;
+	if (md_get_input(name, value, sizeof(value)) != 0) {
+		PyErr_Format(PyExc_KeyError, "no input named %s", name);
+		return NULL;
+	}
+	return PyUnicode_FromString(value);
+}
+
+static PyObject *md_py_inputs(PyObject *self, PyObject *unused)
+{
+	PyObject *list, *s;
+	int k;
+
+	if (!(list = PyList_New(0)))
+		return NULL;
+	for (k = 0; md_input_name(k); k++) {
+		if (!(s = PyUnicode_FromString(md_input_name(k))) || PyList_Append(list, s) != 0) {
+			Py_XDECREF(s);
+			Py_DECREF(list);
+			return NULL;
+		}
+		Py_DECREF(s);
+	}
+	return list;
+}
+
+static PyObject *md_py_init(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+	PyObject *name, *value;
+	Py_ssize_t pos = 0;
+
+	if (nExported > 0) {
+		PyErr_Format(PyExc_BufferError,
+			"%zd arrays still use the engine's memory, delete them before md.init()",
+			nExported);
+		return NULL;
+	}
+	if (engine_claim() != 0)
+		return NULL;
+	if (kwargs) {
+		while (PyDict_Next(kwargs, &pos, &name, &value)) {
+			if (set_input(name, value) != 0) {
+				engineBusy = 0;
+				return NULL;
+			}
+		}
+	}
+	Py_BEGIN_ALLOW_THREADS
+	md_init();
+	Py_END_ALLOW_THREADS
+	engineBusy = 0;
+	Py_RETURN_NONE;
+}
+
+static PyObject *md_py_step(PyObject *self, PyObject *args)
+{
+	int n = 1, done;
+
+	if (!PyArg_ParseTuple(args, "|i", &n))
+		return NULL;
+	if (md_generation() == 0) {
+		PyErr_SetString(PyExc_RuntimeError, "call md.init() first");
+		return NULL;
+	}
+	if (engine_claim() != 0)
+		return NULL;
+	Py_BEGIN_ALLOW_THREADS
+	done = md_step(n);
+	Py_END_ALLOW_THREADS
+	engineBusy = 0;
+	if (done < 0) {
+		PyErr_SetString(PyExc_RuntimeError, "replica exchange runs with md.run() only");
+		return NULL;
+	}
+	return PyLong_FromLong(done);
+}
+
+static PyObject *md_py_run(PyObject *self, PyObject *unused)
+{
+	if (md_generation() == 0) {
+		PyErr_SetString(PyExc_RuntimeError, "call md.init() first");
+		return NULL;
+	}
+	if (engine_claim() != 0)
+		return NULL;
+	Py_BEGIN_ALLOW_THREADS
+	md_run();
+	Py_END_ALLOW_THREADS
+	engineBusy = 0;
+	Py_RETURN_NONE;
+}
+
+static PyObject *md_py_stop(PyObject *self, PyObject *unused)
+{
+	md_stop();
+	Py_RETURN_NONE;
+}
+
+static PyObject *md_py_steer(PyObject *self, PyObject *args)
+{
+	const char *command;
+
+	if (!PyArg_ParseTuple(args, "s", &command))
+		return NULL;
+	if (md_steer(command) != 0) {
+		PyErr_Format(PyExc_ValueError, "cannot queue steering command '%s'", command);
+		return NULL;
+	}
+	Py_RETURN_NONE;
+}
+
+static PyObject *md_py_positions(PyObject *self, PyObject *unused)
+{
+	return make_view(MD_POSITIONS);
+}
+
+static PyObject *md_py_velocities(PyObject *self, PyObject *unused)
+{
+	return make_view(MD_VELOCITIES);
+}
+
+static PyObject *md_py_accelerations(PyObject *self, PyObject *unused)
+{
+	return make_view(MD_ACCELERATIONS);
+}
+
+static PyObject *md_py_status(PyObject *self, PyObject *unused)
+{
+	md_status s;
+
+	md_status_get(&s);
+	return Py_BuildValue("{s:i,s:d,s:i,s:(dd),s:d,s:d,s:d}",
+		"step", s.stepCount, "time", s.time, "nMol", s.nMol,
+		"region", s.region[0], s.region[1], "kinEnergy", s.kinEnergy,
+		"totEnergy", s.totEnergy, "pressure", s.pressure);
+}
+
+static PyMethodDef md_methods[] = {
+	{ "set", md_py_set, METH_VARARGS, "set(name, value): set an input for the next init()." },
+	{ "get", md_py_get, METH_VARARGS, "get(name): the value of an input, as text." },
+	{ "inputs", md_py_inputs, METH_NOARGS, "inputs(): the names of all inputs." },
+	{ "init", (PyCFunction) (void (*)(void)) md_py_init, METH_VARARGS | METH_KEYWORDS,
+		"init(**inputs): set the inputs given and start from the initial state." },
+	{ "step", md_py_step, METH_VARARGS, "step(n=1): take n steps, return the number taken." },
+	{ "run", md_py_run, METH_NOARGS, "run(): run stepLimit steps and report." },
+	{ "stop", md_py_stop, METH_NOARGS, "stop(): stop step() or run() after the current step." },
+	{ "steer", md_py_steer, METH_VARARGS, "steer(command): queue a command such as 'temperature 0.8' for the next step." },
+	{ "positions", md_py_positions, METH_NOARGS, "positions(): View of the positions." },
+	{ "velocities", md_py_velocities, METH_NOARGS, "velocities(): View of the velocities." },
+	{ "accelerations", md_py_accelerations, METH_NOARGS, "accelerations(): View of the accelerations." },
+	{ "status", md_py_status, METH_NOARGS, "status(): step, time and the last sampled observables." },
+	{ NULL }
+};
+
+static void md_free(void *module)
+{
+	AtomicStore(&running, 0);
+	ShmExportFree();
+	LogFree();
+}
+
+static struct PyModuleDef md_module = {
+	PyModuleDef_HEAD_INIT,
+	.m_name = "md",
+	.m_doc = "Molecular dynamics of two-dimensional discs.",
+	.m_size = -1,
+	.m_methods = md_methods,
+	.m_free = md_free,
+};
+
+PyMODINIT_FUNC PyInit_md(void)
+{
+	PyObject *m;
+
+	if (PyType_Ready(&ViewType) < 0 || !(m = PyModule_Create(&md_module)))
+		return NULL;
+	Py_INCREF(&ViewType);
+	if (PyModule_AddObject(m, "View", (PyObject *) &ViewType) < 0) {
+		Py_DECREF(&ViewType);
+		Py_DECREF(m);
+		return NULL;
+	}
+	LogInit(NULL, show);
+	return m;
+}
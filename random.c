@@ -8,6 +8,7 @@
 #	include <windows.h>
 #else
 #	include <time.h>
+#	include <sys/time.h>
 #endif
 
 #include "in_vdefs.h"
@@ -51,7 +52,7 @@ void InitRand (int randSeedI)
 	message("Random seed = %d (time-based)\n", randSeedP);
 }
 
-double RandR ()
+double RandR (void)
 {
   randSeedP = (randSeedP * IMUL + IADD) & MASK;
   return (randSeedP * SCALE);
@@ -5,6 +5,7 @@
 #define __MD_RANDOM_H__
 
 void InitRand (int randSeedI);
+double RandR (void);
 void VRand (VecR *p);
 
 #endif /* __MD_RANDOM_H__ */
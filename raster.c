@@ -0,0 +1,686 @@
+/*
+ * Offscreen drawing of snapshots into images and movies
+ *
+ * A frame is drawn in three parts: every disc gets its colour and its
+ * position in pixels (with extra copies for discs that stick out of the
+ * periodic box), the discs are sorted into the tiles they overlap, and the
+ * tiles are drawn. The first and last part are shared by the threads in
+ * chunks taken from an atomic counter, so each tile is written by a single
+ * thread and no locks are needed. Discs are drawn in order of molecule
+ * number within each tile, so a frame does not depend on the thread count.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef USE_ZLIB
+#	include <zlib.h>
+#endif
+
+#include "in_vdefs.h"
+#include "in_mddefs.h"
+#include "raster.h"
+#include "hexatic.h"
+#include "threads.h"
+
+// Molecules per chunk when colouring
+#define COLOUR_CHUNK  1024
+
+// Movie file formats
+#define MOVIE_RAW  0
+#define MOVIE_PPM  1
+#define MOVIE_PNG  2
+
+// A disc to draw: centre in pixels and molecule number
+typedef struct {
+	float x, y;
+	int n;
+} Disc;
+
+static const Rgba background = { 255, 255, 255, 255 };
+static const Rgba outline    = {   0,   0,   0, 255 };
+static const Rgba plain      = { 255,   0,   0, 255 };
+
+// State of the frame being drawn, shared by the drawing threads
+static Image       *rImg;
+static Snapshot    *rSnap;
+static RasterStyle *rStyle;
+static double       rScale, rRadius;
+static int          boxX0, boxY0, boxX1, boxY1;  // the box in pixels
+static VecI         nTile, nCell;
+static int          nextChunk, nextTile;
+static void       (*rFunc) (int tid);
+
+// Buffers that are kept from frame to frame and only grow
+static Rgba *molColour;
+static Disc *disc;
+static int  *tileStart, *tileEntry, *cellHead, *cellNext;
+static int   maxColour, maxMol, maxDisc, maxTile, maxEntry, maxCell, nDisc;
+
+
+/*
+ * Images
+ */
+int ImageInit (Image *img, int width, int height)
+{
+	img->width = width;
+	img->height = height;
+	img->pixel = malloc ((size_t) width * height * sizeof (Rgba));
+	return img->pixel ? 0 : -1;
+}
+
+void ImageFree (Image *img)
+{
+	free (img->pixel);
+	img->pixel = NULL;
+}
+
+
+/*
+ * Threads
+ */
+static void RasterWorker (void *arg)
+{
+	rFunc ((int) (intptr_t) arg);
+}
+
+// Run func(tid) on style->nThreads threads, the caller being thread 0
+static void RasterRun (void (*func) (int tid))
+{
+	Thread t[MAX_THREADS];
+	int k, n;
+
+	n = Clamp (rStyle->nThreads, 1, MAX_THREADS);
+	rFunc = func;
+	for (k = 1; k < n; k ++) {
+		if (ThreadCreate (&t[k], RasterWorker, (void *) (intptr_t) k) != 0) break;
+	}
+	func (0);
+	while (-- k > 0) ThreadJoin (t[k]);
+}
+
+// Make sure buffer *p has room for n elements of the given size
+static int Grow (void *p, int *max, int n, size_t size)
+{
+	void *q;
+
+	if (n <= *max) return 0;
+	if (!(q = realloc (*(void **) p, (size_t) n * size))) return -1;
+	*(void **) p = q;
+	*max = n;
+	return 0;
+}
+
+
+/*
+ * Colours
+ */
+
+// Colour on the scale blue - cyan - green - yellow - red, for 0 <= t <= 1
+static Rgba SpeedColour (double t)
+{
+	static const unsigned char scale[5][3] = {
+		{ 0, 0, 255 }, { 0, 255, 255 }, { 0, 255, 0 }, { 255, 255, 0 }, { 255, 0, 0 }
+	};
+	Rgba c;
+	int k;
+	double f;
+
+	t = Clamp (t, 0., 1.) * 4.;
+	k = Min ((int) t, 3);
+	f = t - k;
+	c.r = (unsigned char) (scale[k][0] + f * (scale[k + 1][0] - scale[k][0]));
+	c.g = (unsigned char) (scale[k][1] + f * (scale[k + 1][1] - scale[k][1]));
+	c.b = (unsigned char) (scale[k][2] + f * (scale[k + 1][2] - scale[k][2]));
+	c.a = 255;
+	return c;
+}
+
+// Colour for a disc with nb neighbours; defects of the triangular lattice
+// stand out against the grey of the sixfold coordinated discs
+static Rgba OrderColour (int nb)
+{
+	static const Rgba order[5] = {
+		{  40,  40, 200, 255 },  // 4 or less
+		{ 220,  40,  40, 255 },  // 5
+		{ 200, 200, 200, 255 },  // 6
+		{  40, 170,  40, 255 },  // 7
+		{ 230, 200,  40, 255 },  // 8 or more
+	};
+
+	return order[Clamp (nb, 4, 8) - 4];
+}
+
+// Colour for a disc with local order parameter psi6 = re + i im: the angle
+// of its lattice picks the hue on a colour wheel, as the angle is periodic,
+// and the less ordered the darker it is
+static Rgba HexaticColour (double re, double im)
+{
+	Rgba c;
+	double h, m, f[3];
+	int k;
+
+	h = 3. * (atan2 (im, re) / M_PI + 1.);
+	m = 255. * Min (sqrt (Sqr (re) + Sqr (im)), 1.);
+	for (k = 0; k < 3; k ++) {
+		// Each of r, g, b peaks a third of the way round from the last
+		f[k] = fabs (fmod (h + 6. - 2. * k, 6.) - 3.);
+		f[k] = Clamp (f[k] - 1., 0., 1.);
+	}
+	c.r = (unsigned char) (m * f[0]);
+	c.g = (unsigned char) (m * f[1]);
+	c.b = (unsigned char) (m * f[2]);
+	c.a = 255;
+	return c;
+}
+
+// Put the molecules of the snapshot in cells at least rc wide
+static int BuildNeighbourCells (double rc)
+{
+	Snapshot *s = rSnap;
+	VecR *r = s->r;
+	int c, n;
+
+	nCell.x = (int) (s->region.x / rc);
+	nCell.y = (int) (s->region.y / rc);
+	if (nCell.x < 3) nCell.x = 1;
+	if (nCell.y < 3) nCell.y = 1;
+	if (Grow (&cellHead, &maxCell, VProd (nCell), sizeof (int)) != 0 ||
+		Grow (&cellNext, &maxMol, s->nMol, sizeof (int)) != 0) return -1;
+	for (c = 0; c < VProd (nCell); c ++) cellHead[c] = -1;
+	for (n = 0; n < s->nMol; n ++) {
+		VecI cc;
+
+		cc.x = Clamp ((int) ((r[n].x / s->region.x + 0.5) * nCell.x), 0, nCell.x - 1);
+		cc.y = Clamp ((int) ((r[n].y / s->region.y + 0.5) * nCell.y), 0, nCell.y - 1);
+		c = VLinear (cc, nCell);
+		cellNext[n] = cellHead[c];
+		cellHead[c] = n;
+	}
+	return 0;
+}
+
+// Number of molecules closer than sqrt(rrc) to molecule n; with psi set,
+// also psi6 of molecule n in psi[0] (real) and psi[1] (imaginary part)
+static int CountNeighbours (int n, double rrc, double *psi)
+{
+	Snapshot *s = rSnap;
+	VecR *r = s->r, dr, region = s->region;
+	VecI cc, m2v;
+	double rr, bc, bs;
+	int dx, dy, c, j, nb = 0;
+
+	if (psi) psi[0] = psi[1] = 0.;
+
+	cc.x = Clamp ((int) ((r[n].x / region.x + 0.5) * nCell.x), 0, nCell.x - 1);
+	cc.y = Clamp ((int) ((r[n].y / region.y + 0.5) * nCell.y), 0, nCell.y - 1);
+	for (dy = - (nCell.y > 1); dy <= (nCell.y > 1); dy ++) {
+		for (dx = - (nCell.x > 1); dx <= (nCell.x > 1); dx ++) {
+			m2v.x = (cc.x + dx + nCell.x) % nCell.x;
+			m2v.y = (cc.y + dy + nCell.y) % nCell.y;
+			c = VLinear (m2v, nCell);
+			for (j = cellHead[c]; j >= 0; j = cellNext[j]) {
+				if (j == n) continue;
+				VSub (dr, r[n], r[j]);
+				VWrapAll (dr);
+				rr = VLenSq (dr);
+				if (rr < rrc) {
+					++ nb;
+					if (psi) {
+						HexBond (&dr, rr, &bc, &bs);
+						psi[0] += bc;
+						psi[1] += bs;
+					}
+				}
+			}
+		}
+	}
+	if (psi && nb > 0) {
+		psi[0] /= nb;
+		psi[1] /= nb;
+	}
+	return nb;
+}
+
+// Give the molecules of the next chunks their colour
+static void ColourDiscs (int tid)
+{
+	Snapshot *s = rSnap;
+	double rrc = 0., vMax, psi[2];
+	int n, nLo, nHi;
+
+	if (rStyle->colour == RASTER_COLOUR_ORDER || rStyle->colour == RASTER_COLOUR_HEXATIC) {
+		// Between the first (a) and second (a sqrt(3)) neighbour distance
+		// of the triangular lattice at this density
+		rrc = Sqr (0.5 * (1. + sqrt (3.))) * 2. / sqrt (3.) *
+			VProd (s->region) / s->nMol;
+	}
+	vMax = rStyle->vMax > 0. ? rStyle->vMax : 1.;
+	while ((nLo = AtomicAdd (&nextChunk, COLOUR_CHUNK)) < s->nMol) {
+		nHi = Min (nLo + COLOUR_CHUNK, s->nMol);
+		for (n = nLo; n < nHi; n ++) {
+			switch (rStyle->colour) {
+			case RASTER_COLOUR_SPEED:
+				molColour[n] = SpeedColour (VLen (s->rv[n]) / vMax);
+				break;
+			case RASTER_COLOUR_ORDER:
+				molColour[n] = OrderColour (CountNeighbours (n, rrc, NULL));
+				break;
+			case RASTER_COLOUR_HEXATIC:
+				CountNeighbours (n, rrc, psi);
+				molColour[n] = HexaticColour (psi[0], psi[1]);
+				break;
+			default:
+				molColour[n] = plain;
+			}
+		}
+	}
+}
+
+
+/*
+ * Tiles
+ */
+
+// Add the disc of molecule n, and its periodic copies if it sticks out
+// of the box, to the list of discs
+static void AddDiscs (int n)
+{
+	VecR p;
+	double w, h, sx[2], sy[2];
+	int i, j, kx = 1, ky = 1;
+
+	w = boxX1 - boxX0;
+	h = boxY1 - boxY0;
+	p.x = boxX0 + (rSnap->r[n].x / rSnap->region.x + 0.5) * w;
+	p.y = boxY0 + (0.5 - rSnap->r[n].y / rSnap->region.y) * h;
+	sx[0] = sy[0] = 0.;
+	if (p.x - rRadius < boxX0) sx[kx ++] = w;
+	else if (p.x + rRadius > boxX1) sx[kx ++] = - w;
+	if (p.y - rRadius < boxY0) sy[ky ++] = h;
+	else if (p.y + rRadius > boxY1) sy[ky ++] = - h;
+	for (j = 0; j < ky; j ++) {
+		for (i = 0; i < kx; i ++) {
+			disc[nDisc].x = (float) (p.x + sx[i]);
+			disc[nDisc].y = (float) (p.y + sy[j]);
+			disc[nDisc].n = n;
+			++ nDisc;
+		}
+	}
+}
+
+// Tiles [t0, t1) overlapped by disc d in each direction
+static void DiscTiles (Disc *d, VecI *t0, VecI *t1)
+{
+	t0->x = Clamp ((int) floor ((d->x - rRadius) / RASTER_TILE), 0, nTile.x - 1);
+	t0->y = Clamp ((int) floor ((d->y - rRadius) / RASTER_TILE), 0, nTile.y - 1);
+	t1->x = Clamp ((int) floor ((d->x + rRadius) / RASTER_TILE), 0, nTile.x - 1) + 1;
+	t1->y = Clamp ((int) floor ((d->y + rRadius) / RASTER_TILE), 0, nTile.y - 1) + 1;
+}
+
+// Sort the discs into the tiles they overlap, by counting sort
+static int SortDiscs (void)
+{
+	VecI t0, t1, t;
+	int k, c, nEntry;
+
+	for (c = 0; c <= VProd (nTile); c ++) tileStart[c] = 0;
+	for (k = 0; k < nDisc; k ++) {
+		DiscTiles (&disc[k], &t0, &t1);
+		for (t.y = t0.y; t.y < t1.y; t.y ++) {
+			for (t.x = t0.x; t.x < t1.x; t.x ++) ++ tileStart[VLinear (t, nTile) + 1];
+		}
+	}
+	for (c = 0; c < VProd (nTile); c ++) tileStart[c + 1] += tileStart[c];
+	nEntry = tileStart[VProd (nTile)];
+	if (Grow (&tileEntry, &maxEntry, nEntry, sizeof (int)) != 0) return -1;
+	for (k = 0; k < nDisc; k ++) {
+		DiscTiles (&disc[k], &t0, &t1);
+		for (t.y = t0.y; t.y < t1.y; t.y ++) {
+			for (t.x = t0.x; t.x < t1.x; t.x ++) tileEntry[tileStart[VLinear (t, nTile)] ++] = k;
+		}
+	}
+	// Filling moved every start to the next tile's start
+	for (c = VProd (nTile); c > 0; c --) tileStart[c] = tileStart[c - 1];
+	tileStart[0] = 0;
+	return 0;
+}
+
+// Draw the discs of tile c, clipped to the box
+static void DrawTile (int c)
+{
+	Image *img = rImg;
+	Rgba *row, colour;
+	Disc *d;
+	VecI p0, p1, q0, q1, p;
+	double rr, rrIn, dx, dy, dd;
+	int k;
+
+	p0.x = (c % nTile.x) * RASTER_TILE;
+	p0.y = (c / nTile.x) * RASTER_TILE;
+	p1.x = Min (p0.x + RASTER_TILE, img->width);
+	p1.y = Min (p0.y + RASTER_TILE, img->height);
+	for (p.y = p0.y; p.y < p1.y; p.y ++) {
+		row = img->pixel + (size_t) p.y * img->width;
+		for (p.x = p0.x; p.x < p1.x; p.x ++) row[p.x] = background;
+	}
+	p0.x = Max (p0.x, boxX0);
+	p0.y = Max (p0.y, boxY0);
+	p1.x = Min (p1.x, boxX1);
+	p1.y = Min (p1.y, boxY1);
+
+	// Discs of a few pixels get no outline, it would hide the colour
+	rr = Sqr (rRadius);
+	rrIn = rRadius >= 3. ? Sqr (rRadius - 1.) : rr;
+	for (k = tileStart[c]; k < tileStart[c + 1]; k ++) {
+		d = &disc[tileEntry[k]];
+		colour = molColour[d->n];
+		q0.x = Max (p0.x, (int) floor (d->x - rRadius));
+		q0.y = Max (p0.y, (int) floor (d->y - rRadius));
+		q1.x = Min (p1.x, (int) ceil (d->x + rRadius));
+		q1.y = Min (p1.y, (int) ceil (d->y + rRadius));
+		for (p.y = q0.y; p.y < q1.y; p.y ++) {
+			row = img->pixel + (size_t) p.y * img->width;
+			dy = p.y + 0.5 - d->y;
+			for (p.x = q0.x; p.x < q1.x; p.x ++) {
+				dx = p.x + 0.5 - d->x;
+				dd = dx * dx + dy * dy;
+				if (dd < rr) row[p.x] = dd < rrIn ? colour : outline;
+			}
+		}
+	}
+}
+
+static void DrawTiles (int tid)
+{
+	int c;
+
+	while ((c = AtomicAdd (&nextTile, 1)) < VProd (nTile)) DrawTile (c);
+}
+
+// Draw the discs of snapshot s into img, keeping the aspect ratio of the
+// box and with the y axis pointing up.
+// Return: 0 on success, -1 if out of memory
+int RasterDraw (Image *img, Snapshot *s, RasterStyle *style)
+{
+	double w, h;
+	int n;
+
+	rImg = img;
+	rSnap = s;
+	rStyle = style;
+	rScale = Min (img->width / s->region.x, img->height / s->region.y);
+	rRadius = Max (0.5 * style->diameter * rScale, 1.);
+	w = s->region.x * rScale;
+	h = s->region.y * rScale;
+	boxX0 = (int) (0.5 * (img->width - w));
+	boxY0 = (int) (0.5 * (img->height - h));
+	boxX1 = boxX0 + (int) (w + 0.5);
+	boxY1 = boxY0 + (int) (h + 0.5);
+	nTile.x = (img->width + RASTER_TILE - 1) / RASTER_TILE;
+	nTile.y = (img->height + RASTER_TILE - 1) / RASTER_TILE;
+
+	if (Grow (&molColour, &maxColour, s->nMol, sizeof (Rgba)) != 0 ||
+		Grow (&disc, &maxDisc, 4 * s->nMol, sizeof (Disc)) != 0 ||
+		Grow (&tileStart, &maxTile, VProd (nTile) + 1, sizeof (int)) != 0) return -1;
+	if ((style->colour == RASTER_COLOUR_ORDER || style->colour == RASTER_COLOUR_HEXATIC) &&
+		BuildNeighbourCells (sqrt (2. / sqrt (3.) * VProd (s->region) / s->nMol)) != 0)
+		return -1;
+
+	nextChunk = 0;
+	RasterRun (ColourDiscs);
+	nDisc = 0;
+	for (n = 0; n < s->nMol; n ++) AddDiscs (n);
+	if (SortDiscs () != 0) return -1;
+	nextTile = 0;
+	RasterRun (DrawTiles);
+	return 0;
+}
+
+
+/*
+ * Files
+ */
+
+// Write img as binary PPM, which has no alpha channel.
+// Return: 0 on success, -1 on error
+int ImageWritePPM (Image *img, const char *file)
+{
+	FILE *f;
+	unsigned char *row;
+	Rgba *p;
+	int x, y, ok;
+
+	if (!(f = fopen (file, "wb"))) return -1;
+	if (!(row = malloc (3 * img->width))) {
+		fclose (f);
+		return -1;
+	}
+	ok = fprintf (f, "P6\n%d %d\n255\n", img->width, img->height) > 0;
+	for (y = 0; ok && y < img->height; y ++) {
+		p = img->pixel + (size_t) y * img->width;
+		for (x = 0; x < img->width; x ++) {
+			row[3 * x] = p[x].r;
+			row[3 * x + 1] = p[x].g;
+			row[3 * x + 2] = p[x].b;
+		}
+		ok = fwrite (row, 3, img->width, f) == (size_t) img->width;
+	}
+	free (row);
+	if (fclose (f) != 0) ok = 0;
+	return ok ? 0 : -1;
+}
+
+static void Put32 (unsigned char *p, unsigned long v)
+{
+	p[0] = (unsigned char) (v >> 24);
+	p[1] = (unsigned char) (v >> 16);
+	p[2] = (unsigned char) (v >> 8);
+	p[3] = (unsigned char) v;
+}
+
+// CRC-32 as used by PNG
+static unsigned long Crc32 (unsigned long crc, const unsigned char *p, size_t n)
+{
+	static unsigned long table[256];
+	static int haveTable;
+	unsigned long c;
+	int k, b;
+
+	if (!haveTable) {
+		for (k = 0; k < 256; k ++) {
+			c = k;
+			for (b = 0; b < 8; b ++) c = c & 1 ? 0xedb88320UL ^ (c >> 1) : c >> 1;
+			table[k] = c;
+		}
+		haveTable = 1;
+	}
+	crc ^= 0xffffffffUL;
+	while (n --) crc = table[(crc ^ *p ++) & 0xff] ^ (crc >> 8);
+	return crc ^ 0xffffffffUL;
+}
+
+static int PngChunk (FILE *f, const char *type, const unsigned char *data, size_t n)
+{
+	unsigned char b[8];
+	unsigned long crc;
+
+	Put32 (b, (unsigned long) n);
+	memcpy (b + 4, type, 4);
+	crc = Crc32 (0, b + 4, 4);
+	crc = Crc32 (crc, data, n);
+	if (fwrite (b, 1, 8, f) != 8 || (n && fwrite (data, 1, n, f) != n)) return -1;
+	Put32 (b, crc);
+	return fwrite (b, 1, 4, f) == 4 ? 0 : -1;
+}
+
+#ifndef USE_ZLIB
+// Wrap data in a zlib stream of uncompressed blocks.
+// Return: the size of the stream in z, which must have ZlibStoredSize() bytes
+static size_t ZlibStored (unsigned char *z, const unsigned char *data, size_t n)
+{
+	unsigned long s1 = 1, s2 = 0;
+	size_t k, len, i = 0;
+	unsigned char *q = z;
+
+	*q ++ = 0x78;
+	*q ++ = 0x01;
+	do {
+		len = Min (n - i, 65535);
+		*q ++ = i + len == n;
+		*q ++ = (unsigned char) len;
+		*q ++ = (unsigned char) (len >> 8);
+		*q ++ = (unsigned char) ~len;
+		*q ++ = (unsigned char) (~len >> 8);
+		memcpy (q, data + i, len);
+		q += len;
+		i += len;
+	} while (i < n);
+	// Adler-32, reduced often enough that s2 cannot overflow
+	for (k = 0; k < n; k ++) {
+		s1 += data[k];
+		s2 += s1;
+		if ((k & 4095) == 4095) {
+			s1 %= 65521;
+			s2 %= 65521;
+		}
+	}
+	Put32 (q, (s2 % 65521) << 16 | (s1 % 65521));
+	return q + 4 - z;
+}
+
+#define ZlibStoredSize(n)  (2 + (n) + 5 * ((n) / 65535 + 1) + 4)
+#endif
+
+// Write img as an 8 bit RGBA PNG file, compressed if built with zlib.
+// Return: 0 on success, -1 on error
+int ImageWritePNG (Image *img, const char *file)
+{
+	static const unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+	FILE *f;
+	unsigned char ihdr[13], *raw, *z;
+	size_t rowSize, rawSize, zSize;
+	int y, ok;
+
+	rowSize = 1 + 4 * (size_t) img->width;
+	rawSize = rowSize * img->height;
+#ifdef USE_ZLIB
+	zSize = compressBound ((uLong) rawSize);
+#else
+	zSize = ZlibStoredSize (rawSize);
+#endif
+	raw = malloc (rawSize);
+	z = malloc (zSize);
+	if (!raw || !z || !(f = fopen (file, "wb"))) {
+		free (raw);
+		free (z);
+		return -1;
+	}
+
+	// Every row starts with filter type 0 (none)
+	for (y = 0; y < img->height; y ++) {
+		raw[y * rowSize] = 0;
+		memcpy (raw + y * rowSize + 1, img->pixel + (size_t) y * img->width,
+			4 * (size_t) img->width);
+	}
+#ifdef USE_ZLIB
+	{
+		uLongf len = (uLongf) zSize;
+
+		ok = compress2 (z, &len, raw, (uLong) rawSize, Z_DEFAULT_COMPRESSION) == Z_OK;
+		zSize = len;
+	}
+#else
+	zSize = ZlibStored (z, raw, rawSize);
+	ok = 1;
+#endif
+
+	Put32 (ihdr, img->width);
+	Put32 (ihdr + 4, img->height);
+	ihdr[8] = 8;   // bits per sample
+	ihdr[9] = 6;   // RGBA
+	ihdr[10] = ihdr[11] = ihdr[12] = 0;
+	ok = ok && fwrite (signature, 1, 8, f) == 8 &&
+		PngChunk (f, "IHDR", ihdr, 13) == 0 &&
+		PngChunk (f, "IDAT", z, zSize) == 0 &&
+		PngChunk (f, "IEND", NULL, 0) == 0;
+	free (raw);
+	free (z);
+	if (fclose (f) != 0) ok = 0;
+	return ok ? 0 : -1;
+}
+
+
+/*
+ * Movies
+ */
+
+// Whether name holds exactly one conversion for an int, like %05d
+static int FramePattern (const char *name)
+{
+	const char *p;
+	int n = 0;
+
+	for (p = name; (p = strchr (p, '%')); ) {
+		++ p;
+		if (*p == '%') {
+			++ p;
+			continue;
+		}
+		if (*p == '0') ++ p;
+		if (*p >= '1' && *p <= '9') ++ p;
+		if (*p >= '0' && *p <= '9') ++ p;
+		if (*p != 'd') return -1;
+		++ n;
+	}
+	return n;
+}
+
+// Return: 0 on success, -1 if name is not usable
+int MovieOpen (Movie *m, const char *name)
+{
+	size_t len = strlen (name);
+	int n;
+
+	if (len >= MOVIE_NAME_MAX || (n = FramePattern (name)) < 0 || n > 1) return -1;
+	strcpy (m->name, name);
+	m->frame = 0;
+	m->f = NULL;
+	if (n == 0) {
+		m->format = MOVIE_RAW;
+		return (m->f = fopen (name, "wb")) ? 0 : -1;
+	}
+	m->format = len > 4 && strcmp (name + len - 4, ".ppm") == 0 ? MOVIE_PPM : MOVIE_PNG;
+	return 0;
+}
+
+// Add img as the next frame.
+// Return: 0 on success, -1 on error
+int MovieFrame (Movie *m, Image *img)
+{
+	char file[MOVIE_NAME_MAX + 16];
+	size_t n;
+	int err;
+
+	n = (size_t) img->width * img->height;
+	if (m->format == MOVIE_RAW) {
+		err = fwrite (img->pixel, sizeof (Rgba), n, m->f) != n;
+		if (!err) err = fflush (m->f) != 0;
+	}
+	else {
+		sprintf (file, m->name, m->frame);
+		err = (m->format == MOVIE_PPM ? ImageWritePPM (img, file) :
+			ImageWritePNG (img, file)) != 0;
+	}
+	if (err) return -1;
+	++ m->frame;
+	return 0;
+}
+
+void MovieClose (Movie *m)
+{
+	if (m->f) fclose (m->f);
+	m->f = NULL;
+}
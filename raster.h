@@ -0,0 +1,66 @@
+/*
+ * Offscreen drawing of snapshots into images and movies
+ *
+ * RasterDraw() draws the discs of a snapshot into an RGBA image in memory,
+ * without any windowing system, so frames can be made on headless nodes.
+ * The image is cut into tiles that are drawn by several threads. Images are
+ * written as PPM or PNG files, or appended as raw RGBA video frames to a
+ * single file (e.g. a pipe into a video encoder).
+ */
+#ifndef __MD_RASTER_H__
+#define __MD_RASTER_H__
+
+#include <stdio.h>
+
+#include "snapshot.h"
+
+// Width and height of a tile in pixels
+#define RASTER_TILE  64
+
+// How the discs are coloured
+#define RASTER_COLOUR_PLAIN    0  // all red, like the GUI
+#define RASTER_COLOUR_SPEED    1  // by speed, blue (slow) to red (fast)
+#define RASTER_COLOUR_ORDER    2  // by number of neighbours, 6 is grey
+#define RASTER_COLOUR_HEXATIC  3  // by psi6, hue for the lattice angle, dark if disordered
+
+typedef struct {
+	unsigned char r, g, b, a;
+} Rgba;
+
+typedef struct {
+	int width, height;
+	Rgba *pixel;       // row by row, top row first
+} Image;
+
+typedef struct {
+	double diameter;   // disc diameter in units of length
+	int colour;        // one of RASTER_COLOUR_*
+	double vMax;       // speed with the last colour of the speed scale
+	int nThreads;      // threads used for drawing
+} RasterStyle;
+
+int  ImageInit (Image *img, int width, int height);
+void ImageFree (Image *img);
+int  ImageWritePPM (Image *img, const char *file);
+int  ImageWritePNG (Image *img, const char *file);
+
+int  RasterDraw (Image *img, Snapshot *s, RasterStyle *style);
+
+/*
+ * Movies: a name containing a printf conversion for the frame number, e.g.
+ * "frame%05d.png", gives one PNG or PPM file per frame; any other name
+ * gives a single file of raw RGBA frames.
+ */
+#define MOVIE_NAME_MAX  256
+
+typedef struct {
+	char name[MOVIE_NAME_MAX];
+	int format, frame;
+	FILE *f;
+} Movie;
+
+int  MovieOpen (Movie *m, const char *name);
+int  MovieFrame (Movie *m, Image *img);
+void MovieClose (Movie *m);
+
+#endif /* __MD_RASTER_H__ */
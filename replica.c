@@ -0,0 +1,270 @@
+/*
+ * Replica exchange (parallel tempering)
+ *
+ * All copies share the engine: at its turn a replica is copied into mol[]
+ * and molImage[] (by all threads, each its own molecules), advanced, and
+ * copied back. Its velocities are rescaled to the temperature of its slot
+ * on every sample step, the last step of a turn always being one, so the
+ * potential energy uSum used for the swaps is that of the final state.
+ *
+ * A swap of the replicas a at T_k and b at T_k+1 is accepted with
+ * probability min (1, exp ((1 / T_k - 1 / T_k+1) (U_a - U_b))); the two
+ * then trade slots and their velocities are scaled to the new temperature.
+ * Even and odd pairs of slots take turns, so every pair is tried every
+ * second round.
+ */
+#include <stdio.h>
+#include <math.h>
+
+#include "in_vdefs.h"
+#include "in_mddefs.h"
+#include "random.h"
+#include "threads.h"
+#include "simulation.h"
+#include "transport.h"
+#include "shear.h"
+#include "steer.h"
+#include "replica.h"
+
+// Inputs: number of replicas (0 or 1 for a single run), steps per turn and
+// the highest temperature
+int nReplicas = 0, replicaPeriod = 100;
+double replicaTMax = 2.;
+
+typedef struct {
+	Mol *mol;
+	VecI *image;
+	double uSum;       // potential energy at the end of its last turn
+} Replica;
+
+Replica replica[MAX_REPLICAS];
+int nReplicaUsed;
+
+// slotReplica[k]: replica at temperature slotTemp[k]. nTry[k] and
+// nAccept[k] count the swaps between slots k and k + 1.
+int slotReplica[MAX_REPLICAS];
+double slotTemp[MAX_REPLICAS];
+int nTry[MAX_REPLICAS], nAccept[MAX_REPLICAS];
+
+// Potential energy, kinetic energy and pressure of the samples taken at
+// each temperature, over the run and since the last summary
+Prop slotU[MAX_REPLICAS], slotK[MAX_REPLICAS], slotP[MAX_REPLICAS];
+double slotUSum[MAX_REPLICAS];
+int nSlotSample[MAX_REPLICAS], nSlotSum[MAX_REPLICAS];
+
+// Arguments of the thread functions
+static int curReplica;
+static double velFac;
+
+
+static void LoadReplica (int tid)
+{
+	Replica *rp = &replica[curReplica];
+	int n;
+
+	DO_MOL_OF (tid) {
+		mol[n] = rp->mol[n];
+		molImage[n] = rp->image[n];
+	}
+}
+
+static void SaveReplica (int tid)
+{
+	Replica *rp = &replica[curReplica];
+	int n;
+
+	DO_MOL_OF (tid) {
+		rp->mol[n] = mol[n];
+		rp->image[n] = molImage[n];
+	}
+}
+
+static void ScaleVels (int tid)
+{
+	int n;
+
+	DO_MOL_OF (tid) VScale (mol[n].rv, velFac);
+}
+
+static void ScaleReplicaVels (int tid)
+{
+	Replica *rp = &replica[curReplica];
+	int n;
+
+	DO_MOL_OF (tid) VScale (rp->mol[n].rv, velFac);
+}
+
+// Set up the replicas, taking their memory from arena a. All start from
+// the initial state, with the velocities scaled to their temperature.
+void ReplicaInit (Arena *a)
+{
+	int k;
+
+	nReplicaUsed = 0;
+	if (nReplicas <= 1) return;
+	if (nReplicas > MAX_REPLICAS) {
+		LogWarn("Warning: at most %d replicas, using that many\n", MAX_REPLICAS);
+	}
+	nReplicaUsed = Min (nReplicas, MAX_REPLICAS);
+	replicaPeriod = Max (replicaPeriod, 1);
+	for (k = 0; k < nReplicaUsed; k ++) {
+		slotTemp[k] = temperature * pow (replicaTMax / temperature,
+			k / (nReplicaUsed - 1.));
+		slotReplica[k] = k;
+		nTry[k] = nAccept[k] = 0;
+		PropZero (slotU[k]);
+		PropZero (slotK[k]);
+		PropZero (slotP[k]);
+		slotUSum[k] = 0.;
+		nSlotSample[k] = nSlotSum[k] = 0;
+		AllocMemArena (a, replica[k].mol, nMol, Mol);
+		AllocMemArena (a, replica[k].image, nMol, VecI);
+		replica[k].uSum = 0.;
+		curReplica = k;
+		ThreadsRun (SaveReplica);
+		velFac = sqrt (slotTemp[k] / temperature);
+		ThreadsRun (ScaleReplicaVels);
+	}
+	message("Replica exchange: %d replicas from T = %.4f to %.4f, swaps every %d steps\n",
+		nReplicaUsed, slotTemp[0], slotTemp[nReplicaUsed - 1], replicaPeriod);
+}
+
+// Try to swap the replicas of slots k, k + 1 for k = parity, parity + 2, ...
+static void AttemptSwaps (int parity)
+{
+	double delta;
+	int a, b, k;
+
+	for (k = parity; k + 1 < nReplicaUsed; k += 2) {
+		a = slotReplica[k];
+		b = slotReplica[k + 1];
+		delta = (1. / slotTemp[k] - 1. / slotTemp[k + 1]) *
+			(replica[a].uSum - replica[b].uSum);
+		++ nTry[k];
+		if (delta < 0. && RandR () >= exp (delta)) continue;
+		++ nAccept[k];
+		slotReplica[k] = b;
+		slotReplica[k + 1] = a;
+		curReplica = a;
+		velFac = sqrt (slotTemp[k + 1] / slotTemp[k]);
+		ThreadsRun (ScaleReplicaVels);
+		curReplica = b;
+		velFac = 1. / velFac;
+		ThreadsRun (ScaleReplicaVels);
+	}
+}
+
+// Room for a " %8.4f" column of any value, and for one per replica
+#define REPLICA_COLUMN  16
+#define REPLICA_TEXT    (REPLICA_COLUMN * MAX_REPLICAS + 1)
+
+// Append column v to the text at *t, which ends at end
+static void AddColumn (char **t, char *end, double v)
+{
+	int n;
+
+	n = snprintf (*t, end - *t, " %8.4f", v);
+	if (n > 0) *t += Min (n, (int) (end - *t) - 1);
+}
+
+// Potential energy per molecule at each temperature since the previous
+// summary
+static void ReplicaSummary (void)
+{
+	char text[REPLICA_TEXT], *t;
+	int k;
+
+	t = text;
+	*t = '\0';
+	for (k = 0; k < nReplicaUsed; k ++) {
+		if (nSlotSum[k] > 0) AddColumn (&t, text + sizeof (text), slotUSum[k] / nSlotSum[k]);
+		slotUSum[k] = 0.;
+		nSlotSum[k] = 0;
+	}
+	message("%5d %8.4f%s\n", stepCount, timeNow, text);
+}
+
+// Run stepLimit steps of every replica. The engine's other samplers see
+// a different replica at every turn, so they are left out; afterwards
+// mol[] holds the replica at the lowest temperature.
+void ReplicaRun (void)
+{
+	char text[REPLICA_TEXT], *t;
+	double shift;
+	int base, k, round, nRound, nStep, step;
+
+	if (nReplicaUsed <= 1) return;
+	t = text;
+	*t = '\0';
+	for (k = 0; k < nReplicaUsed; k ++) AddColumn (&t, text + sizeof (text), slotTemp[k]);
+	message(" Step   Time     potential energy at T =%s\n", text);
+	nRound = (stepLimit + replicaPeriod - 1) / replicaPeriod;
+	for (round = 0; round < nRound && AtomicLoad (&running); round ++) {
+		// Steering commands wait for the end of a round, when all replicas
+		// are at the same step; a pause holds the run here
+		SteerPoll ();
+		if (!AtomicLoad (&running)) break;
+		base = stepCount;
+		shift = shearShift;
+		// The last round is short if stepLimit is no multiple of the period
+		nStep = Min (replicaPeriod, stepLimit - round * replicaPeriod);
+		for (k = 0; k < nReplicaUsed; k ++) {
+			curReplica = slotReplica[k];
+			ThreadsRun (LoadReplica);
+			stepCount = base;
+			shearShift = shift;
+			for (step = 0; step < nStep; step ++) {
+				if (step == nStep - 1) forceSample = 1;
+				simulation_step ();
+				if (!sampleStep) continue;
+				slotU[k].val = uSum / nMol;
+				slotK[k].val = kinEnergy.val;
+				slotP[k].val = pressure.val;
+				PropAccum (slotU[k]);
+				PropAccum (slotK[k]);
+				PropAccum (slotP[k]);
+				++ nSlotSample[k];
+				slotUSum[k] += uSum / nMol;
+				++ nSlotSum[k];
+				// Back to the temperature of the slot
+				velFac = sqrt (n_dimensions * (1. - 1. / nMol) * slotTemp[k] /
+					(vvSum / nMol));
+				ThreadsRun (ScaleVels);
+			}
+			replica[curReplica].uSum = uSum;
+			ThreadsRun (SaveReplica);
+		}
+		AttemptSwaps (round % 2);
+		if (stepAvg && stepCount / stepAvg != base / stepAvg) ReplicaSummary ();
+	}
+	curReplica = slotReplica[0];
+	ThreadsRun (LoadReplica);
+}
+
+// Averages at each temperature and the acceptance of the swaps
+void ReplicaReport (void)
+{
+	Prop u, ke, p;
+	int k, n;
+
+	if (nReplicaUsed <= 1) return;
+	message("Replica exchange averages:\n");
+	message("  T         U/N                 Ekin                Pressure            accepted\n");
+	for (k = 0; k < nReplicaUsed; k ++) {
+		if ((n = nSlotSample[k]) == 0) continue;
+		u = slotU[k];
+		ke = slotK[k];
+		p = slotP[k];
+		PropAvg (u, n);
+		PropAvg (ke, n);
+		PropAvg (p, n);
+		if (k + 1 < nReplicaUsed) {
+			message("  %7.4f %8.4f %8.4f  %8.4f %8.4f  %8.4f %8.4f  %5.3f of %d\n",
+				slotTemp[k], PropEst (u), PropEst (ke), PropEst (p),
+				nTry[k] ? nAccept[k] / (double) nTry[k] : 0., nTry[k]);
+		} else {
+			message("  %7.4f %8.4f %8.4f  %8.4f %8.4f  %8.4f %8.4f\n",
+				slotTemp[k], PropEst (u), PropEst (ke), PropEst (p));
+		}
+	}
+}
@@ -0,0 +1,24 @@
+/*
+ * Replica exchange (parallel tempering)
+ *
+ * With nReplicas > 1, a run follows that many copies of the system at
+ * temperatures from temperature up to replicaTMax, spaced geometrically.
+ * The copies take turns on the threads, each running replicaPeriod steps
+ * with its velocities rescaled to its temperature; then copies at
+ * neighbouring temperatures attempt a swap with the Metropolis criterion.
+ */
+#ifndef __MD_REPLICA_H__
+#define __MD_REPLICA_H__
+
+#include "arena.h"
+
+#define MAX_REPLICAS  64
+
+extern int nReplicas, replicaPeriod;
+extern double replicaTMax;
+
+void ReplicaInit (Arena *a);
+void ReplicaRun (void);
+void ReplicaReport (void);
+
+#endif /* __MD_REPLICA_H__ */
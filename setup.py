@@ -0,0 +1,24 @@
+"""Build the Python module md, see mdmodule.c:  python setup.py build_ext --inplace"""
+import sys
+from setuptools import setup, Extension
+
+sources = [
+    'mdmodule.c', 'md_api.c', 'simulation.c', 'random.c', 'arena.c',
+    'threads.c', 'snapshot.c', 'shmexport.c', 'logger.c', 'correlator.c',
+    'transport.c', 'fft.c', 'structure.c', 'cluster.c', 'hexatic.c',
+    'replica.c', 'shear.c', 'harddisk.c', 'initconf.c', 'balance.c',
+    'domain.c', 'trajectory.c', 'eqcache.c', 'blocking.c', 'steer.c',
+]
+
+if sys.platform == 'win32':
+    macros, libraries = [('_WINDOWS', None)], []
+else:
+    macros, libraries = [], ['m', 'pthread', 'rt']
+
+setup(
+    name='md',
+    version='1.0',
+    description='Molecular dynamics of two-dimensional discs',
+    ext_modules=[Extension('md', sources, define_macros=macros,
+                           libraries=libraries, extra_compile_args=['-O2'] if sys.platform != 'win32' else [])],
+)
@@ -0,0 +1,171 @@
+/*
+ * Planar shear flow (non-equilibrium MD)
+ *
+ * The thermostat does not assume the flow is the imposed linear profile:
+ * the box is cut into slabs along y (one per row of cells), the mean
+ * velocity of every slab is measured, and only the velocities relative to
+ * it are rescaled to the temperature. A slab mean removes n_dimensions
+ * degrees of freedom. The slab means, which should stay near zero, are
+ * averaged and written out with the flow profile. Each slab is added up
+ * from its cells by the thread owning the row, so the thermostat does not
+ * depend on the number of threads.
+ */
+#include <stdio.h>
+#include <math.h>
+
+#include "in_vdefs.h"
+#include "in_mddefs.h"
+#include "threads.h"
+#include "simulation.h"
+#include "shear.h"
+
+// Input: shear rate, 0 for equilibrium runs
+double shearRate = 0.;
+
+double shearShift;
+
+// Sums over the molecules of each slab: count, velocity and squared velocity
+typedef struct {
+	double n, vvSum;
+	VecR vSum;
+} SlabSums;
+
+SlabSums *slabSums;
+VecR *slabVel, *slabVelSum;
+int nSlab, nSlabSample;
+double velFac;
+
+// Shear stress over the run
+double stressSum, stressSqSum;
+int nStressSample;
+
+
+// Set up for the current system, taking the memory from arena a
+void ShearInit (Arena *a)
+{
+	int s;
+
+	shearShift = 0.;
+	stressSum = stressSqSum = 0.;
+	nStressSample = nSlabSample = 0;
+	if (shearRate == 0.) return;
+	nSlab = cells.y;
+	AllocMemArena (a, slabSums, nSlab, SlabSums);
+	AllocMemArena (a, slabVel, nSlab, VecR);
+	AllocMemArena (a, slabVelSum, nSlab, VecR);
+	for (s = 0; s < nSlab; s ++) VZero (slabVelSum[s]);
+	message("Shear rate %.4f, thermostat over %d slabs\n", shearRate, nSlab);
+}
+
+// Move the images above and below the region on by one step; the shift is
+// kept in range as it goes, so neither a long run nor a change of deltaT
+// spoils it
+void ShearAdvance (void)
+{
+	double d;
+
+	d = fmod (shearShift + shearRate * region.y * deltaT, region.x);
+	if (d >= 0.5 * region.x) d -= region.x;
+	else if (d < -0.5 * region.x) d += region.x;
+	shearShift = d;
+}
+
+// The slabs are the rows of cells, which were built for the positions of
+// this step
+static void SumSlabs (int tid)
+{
+	SlabSums *ss;
+	int c, n, s;
+
+	for (s = threadInfo[tid].rowLo; s < threadInfo[tid].rowHi; s ++) {
+		ss = &slabSums[s];
+		ss->n = ss->vvSum = 0.;
+		VZero (ss->vSum);
+		for (c = nMol + s * cells.x; c < nMol + (s + 1) * cells.x; c ++) {
+			for (n = cellList[c]; n >= 0; n = cellList[n]) {
+				ss->n += 1.;
+				VVAdd (ss->vSum, mol[n].rv);
+				ss->vvSum += VLenSq (mol[n].rv);
+			}
+		}
+	}
+}
+
+static void ScaleThermal (int tid)
+{
+	VecR *u;
+	int c, n, s;
+
+	for (s = threadInfo[tid].rowLo; s < threadInfo[tid].rowHi; s ++) {
+		u = &slabVel[s];
+		for (c = nMol + s * cells.x; c < nMol + (s + 1) * cells.x; c ++) {
+			for (n = cellList[c]; n >= 0; n = cellList[n]) {
+				VVSub (mol[n].rv, *u);
+				VScale (mol[n].rv, velFac);
+				VVAdd (mol[n].rv, *u);
+			}
+		}
+	}
+}
+
+// Rescale the velocities relative to the slab means to the temperature
+void ShearThermostat (void)
+{
+	SlabSums *ss;
+	VecR v;
+	double thermal;
+	int s;
+
+	ThreadsRun (SumSlabs);
+	thermal = 0.;
+	for (s = 0; s < nSlab; s ++) {
+		ss = &slabSums[s];
+		v = ss->vSum;
+		if (ss->n > 0.) VScale (v, 1. / ss->n);
+		slabVel[s] = v;
+		VVAdd (slabVelSum[s], v);
+		thermal += ss->vvSum - ss->n * VLenSq (v);
+	}
+	++ nSlabSample;
+	if (thermal <= 0.) return;
+	velFac = sqrt (n_dimensions * (nMol - nSlab) * temperature / thermal);
+	ThreadsRun (ScaleThermal);
+}
+
+// Add the shear stress of a sample step
+void ShearSample (void)
+{
+	double p;
+
+	p = 0.5 * (pressure_xy.val + pressure_yx.val);
+	stressSum += p;
+	stressSqSum += Sqr (p);
+	++ nStressSample;
+}
+
+// Print the viscosity and write the flow profile to filename
+void ShearReport (const char *filename)
+{
+	FILE *f;
+	double p, sd, y;
+	int s;
+
+	if (shearRate == 0. || nStressSample == 0) return;
+	p = stressSum / nStressSample;
+	sd = sqrt (Max (stressSqSum / nStressSample - Sqr (p), 0.));
+	message("Shear at rate %.4f over %d samples: P_xy %.4f (sd %.4f), viscosity %.4f\n",
+		shearRate, nStressSample, p, sd, - p / shearRate);
+
+	if (!(f = fopen (filename, "w"))) {
+		LogError("Error: could not write the flow profile to %s.\n", filename);
+		return;
+	}
+	fprintf (f, "   y         v_x         v_x - rate y  v_y\n");
+	for (s = 0; s < nSlab; s ++) {
+		y = ((s + 0.5) / nSlab - 0.5) * region.y;
+		fprintf (f, "%9.4f %11.4e %11.4e %11.4e\n", y,
+			shearRate * y + slabVelSum[s].x / nSlabSample,
+			slabVelSum[s].x / nSlabSample, slabVelSum[s].y / nSlabSample);
+	}
+	fclose (f);
+}
@@ -0,0 +1,25 @@
+/*
+ * Planar shear flow (non-equilibrium MD)
+ *
+ * With shearRate set the system is sheared along x with the flow velocity
+ * shearRate * y, using the SLLOD equations of motion and Lees-Edwards
+ * sliding boundaries; mol[].rv is then the velocity relative to the flow.
+ * A profile-unbiased thermostat keeps the temperature, and the viscosity
+ * follows from the average shear stress, eta = - <P_xy> / shearRate.
+ */
+#ifndef __MD_SHEAR_H__
+#define __MD_SHEAR_H__
+
+#include "arena.h"
+
+extern double shearRate;
+// x offset of the periodic image above the region, in [-region.x / 2, region.x / 2)
+extern double shearShift;
+
+void ShearInit (Arena *a);
+void ShearAdvance (void);
+void ShearThermostat (void);
+void ShearSample (void);
+void ShearReport (const char *filename);
+
+#endif /* __MD_SHEAR_H__ */
@@ -0,0 +1,235 @@
+/*
+ * Live state export through shared memory
+ *
+ * See shmexport.h for the layout of the segment and the locking protocol.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WINDOWS
+#	include <windows.h>
+#else
+#	include <fcntl.h>
+#	include <unistd.h>
+#	include <sys/mman.h>
+#endif
+
+#include "in_vdefs.h"
+#include "in_mddefs.h"
+#include "simulation.h"
+#include "threads.h"
+#include "shmexport.h"
+
+#define RoundUp(n, m)  (((n) + (m) - 1) / (m) * (m))
+
+char shmName[SHM_NAME_MAX] = "";
+int  shmPeriod = 10;
+
+// The segment we write, NULL when not exporting
+ShmHeader *shm = NULL;
+long long shmMapped;
+char shmOpenName[SHM_NAME_MAX + 1];
+#ifdef _WINDOWS
+HANDLE shmHandle;
+#else
+int shmFd = -1;
+#endif
+
+
+// Start and end a change of the segment, see the sequence lock in shmexport.h
+static void SeqBegin (void)
+{
+	*(volatile unsigned int *) &shm->seq = shm->seq + 1;
+	MemoryFence ();
+}
+
+static void SeqEnd (void)
+{
+	MemoryFence ();
+	*(volatile unsigned int *) &shm->seq = shm->seq + 1;
+}
+
+// POSIX names start with a slash, add it if the user did not
+static void SegmentName (char *dst, const char *name)
+{
+#ifdef _WINDOWS
+	strcpy (dst, name);
+#else
+	sprintf (dst, "%s%.*s", (name[0] == '/') ? "" : "/", SHM_NAME_MAX - 2, name);
+#endif
+}
+
+static void SegmentUnmap (void)
+{
+#ifdef _WINDOWS
+	UnmapViewOfFile (shm);
+	CloseHandle (shmHandle);
+#else
+	munmap (shm, shmMapped);
+#endif
+	shm = NULL;
+	shmMapped = 0;
+}
+
+// Map a segment of at least size bytes, growing it if it exists already
+static int SegmentMap (long long size)
+{
+#ifdef _WINDOWS
+	// A mapping cannot grow, and while viewers still have the old one
+	// open we would get that one back
+	shmHandle = CreateFileMappingA (INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+			(DWORD) (size >> 32), (DWORD) size, shmOpenName);
+	if (!shmHandle) return -1;
+	if (GetLastError () == ERROR_ALREADY_EXISTS) {
+		LogError("Error: shared memory %s is still in use, close its viewers first\n",
+			shmOpenName);
+		CloseHandle (shmHandle);
+		return -1;
+	}
+	shm = MapViewOfFile (shmHandle, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	if (!shm) {
+		CloseHandle (shmHandle);
+		return -1;
+	}
+#else
+	void *p;
+
+	if (shmFd < 0) {
+		shmFd = shm_open (shmOpenName, O_CREAT | O_RDWR, 0644);
+		if (shmFd < 0) return -1;
+	}
+	// Never shrink it, viewers may still have the larger size mapped
+	if (ftruncate (shmFd, size) != 0) return -1;
+	p = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, shmFd, 0);
+	if (p == MAP_FAILED) return -1;
+	shm = p;
+#endif
+	shmMapped = size;
+	return 0;
+}
+
+// Create the segment for the current number of molecules, or resize it
+void ShmExportInit (void)
+{
+	char name[SHM_NAME_MAX + 1];
+	long long offR, offRv, size;
+
+	if (!shmName[0]) {
+		ShmExportFree ();
+		return;
+	}
+	SegmentName (name, shmName);
+	if (shm && strcmp (name, shmOpenName) != 0) ShmExportFree ();
+
+	offR = RoundUp ((long long) sizeof (ShmHeader), 64);
+	offRv = offR + RoundUp ((long long) nMol * sizeof (VecR), 64);
+	size = offRv + RoundUp ((long long) nMol * sizeof (VecR), 64);
+
+	if (shm && size > shmMapped) {
+#ifdef _WINDOWS
+		// A mapping cannot grow there: tell the viewers to let go of it
+		SeqBegin ();
+		shm->closed = 1;
+		SeqEnd ();
+		SegmentUnmap ();
+		Sleep (200);
+#else
+		// The segment grows in place and the old mappings stay valid; the
+		// viewers map it again once they see the new size below
+		SegmentUnmap ();
+		if (SegmentMap (size) != 0) {
+			LogError("Error: could not grow shared memory %s\n", shmOpenName);
+			ShmExportFree ();
+			return;
+		}
+#endif
+	}
+	if (!shm) {
+		strcpy (shmOpenName, name);
+		if (SegmentMap (size) != 0) {
+			LogError("Error: could not create shared memory %s\n", shmOpenName);
+			ShmExportFree ();
+			return;
+		}
+		shm->seq = 0;
+	}
+
+	SeqBegin ();
+	shm->magic = SHM_MAGIC;
+	shm->version = SHM_VERSION;
+	shm->closed = 0;
+	shm->size = shmMapped;
+	shm->offsetR = offR;
+	shm->offsetRv = offRv;
+	shm->nMol = 0;
+	shm->stepCount = 0;
+	shm->summaryStep = 0;
+	SeqEnd ();
+	message("Exporting state to shared memory %s (%.2f MB) every %d steps\n",
+		shmOpenName, shmMapped / 1048576., shmPeriod);
+	ShmExportPublish ();
+}
+
+// Copy the molecules of thread tid into the segment
+static void ShmCopy (int tid)
+{
+	VecR *r, *rv;
+	int n;
+
+	r = (VecR *) ((char *) shm + shm->offsetR);
+	rv = (VecR *) ((char *) shm + shm->offsetRv);
+	DO_MOL_OF (tid) {
+		r[n] = mol[n].r;
+		rv[n] = mol[n].rv;
+	}
+}
+
+// Publish the current positions and velocities
+void ShmExportPublish (void)
+{
+	if (!shm) return;
+	SeqBegin ();
+	shm->nMol = nMol;
+	shm->stepCount = stepCount;
+	shm->timeNow = timeNow;
+	shm->region[0] = region.x;
+	shm->region[1] = region.y;
+	ThreadsRun (ShmCopy);
+	SeqEnd ();
+}
+
+// Publish the averages just printed by PrintSummary()
+void ShmExportSummary (void)
+{
+	Prop *prop[SHM_N_SUMMARY] = { &totEnergy, &kinEnergy, &pressure,
+		&pressure_xx, &pressure_xy, &pressure_yx, &pressure_yy };
+	int k;
+
+	if (!shm) return;
+	SeqBegin ();
+	shm->summaryStep = stepCount;
+	shm->vSum = VCSum (vSum) / nMol;
+	for (k = 0; k < SHM_N_SUMMARY; k ++) {
+		shm->summary[k][0] = prop[k]->sum;
+		shm->summary[k][1] = prop[k]->sum2;
+	}
+	SeqEnd ();
+}
+
+// Stop exporting and remove the segment
+void ShmExportFree (void)
+{
+	if (shm) {
+		SeqBegin ();
+		shm->closed = 1;
+		SeqEnd ();
+		SegmentUnmap ();
+	}
+#ifndef _WINDOWS
+	if (shmFd >= 0) {
+		close (shmFd);
+		shm_unlink (shmOpenName);
+		shmFd = -1;
+	}
+#endif
+}
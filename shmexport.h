@@ -0,0 +1,72 @@
+/*
+ * Live state export through shared memory
+ *
+ * When shmName is set, the engine publishes the positions, velocities and
+ * summary observables in a shared memory segment of that name every
+ * shmPeriod steps. Other processes on the same machine can map it read-only
+ * and follow the simulation while it runs.
+ *
+ * The segment starts with a ShmHeader, followed by the positions and the
+ * velocities (nMol x,y pairs of doubles each, at offsetR and offsetRv). The
+ * seq field works as a sequence lock: it is odd while the engine writes, so
+ * a reader has a consistent copy when seq was even and unchanged before and
+ * after copying. ShmReaderRead() does exactly that.
+ */
+#ifndef __MD_SHMEXPORT_H__
+#define __MD_SHMEXPORT_H__
+
+#include "in_vdefs.h"
+
+#define SHM_MAGIC     0x4853444d  // "MDSH"
+#define SHM_VERSION   1
+#define SHM_NAME_MAX  64
+// A reader gives up on a segment written for longer than this, in ms
+#define SHM_READ_TIMEOUT  2000
+
+// Observables in the summary, in the order of PrintSummary()
+#define SHM_N_SUMMARY  7
+#define SHM_SUMMARY_NAMES                                   \
+   { "Etot", "Ekin", "Pressure", "Pressure_xx",             \
+     "Pressure_xy", "Pressure_yx", "Pressure_yy" }
+
+typedef struct {
+	unsigned int magic, version;
+	unsigned int seq;          // even: consistent, odd: being written
+	int closed;                // the engine has gone away
+	long long size;            // bytes in the segment
+	long long offsetR;         // byte offset of the positions
+	long long offsetRv;        // byte offset of the velocities
+	int nMol, stepCount;
+	double timeNow;
+	double region[2];
+	int summaryStep;           // step of the last summary, 0 if none yet
+	int pad;
+	double vSum;               // the Sum(v) column of the summary
+	double summary[SHM_N_SUMMARY][2];  // averages and standard deviations
+} ShmHeader;
+
+// Engine side
+extern char shmName[SHM_NAME_MAX];
+extern int  shmPeriod;
+
+void ShmExportInit (void);
+void ShmExportPublish (void);
+void ShmExportSummary (void);
+void ShmExportFree (void);
+
+// Reader side, in shmreader.c
+typedef struct {
+	ShmHeader *header;
+	long long mapped;
+#ifdef _WINDOWS
+	void *handle;
+#else
+	int fd;
+#endif
+} ShmReader;
+
+int  ShmReaderOpen (ShmReader *rd, const char *name);
+int  ShmReaderRead (ShmReader *rd, ShmHeader *h, VecR *r, VecR *rv, int maxMol);
+void ShmReaderClose (ShmReader *rd);
+
+#endif /* __MD_SHMEXPORT_H__ */
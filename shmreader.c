@@ -0,0 +1,174 @@
+/*
+ * Reading the live state exported through shared memory
+ *
+ * This is the viewer side of shmexport.c, kept apart so that viewers can
+ * be built without the simulation. See shmexport.h for the layout of the
+ * segment and the locking protocol.
+ */
+#include <string.h>
+#include <stdio.h>
+
+#ifdef _WINDOWS
+#	include <windows.h>
+#else
+#	include <fcntl.h>
+#	include <sched.h>
+#	include <time.h>
+#	include <unistd.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#endif
+
+#include "in_vdefs.h"
+#include "threads.h"
+#include "shmexport.h"
+
+// Milliseconds on a clock that only goes forward
+static double ReaderClock (void)
+{
+#ifdef _WINDOWS
+	return (double) GetTickCount64 ();
+#else
+	struct timespec t;
+
+	clock_gettime (CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e3 + t.tv_nsec * 1e-6;
+#endif
+}
+
+// POSIX names start with a slash, add it if the user did not
+static void SegmentName (char *dst, const char *name)
+{
+#ifdef _WINDOWS
+	strcpy (dst, name);
+#else
+	sprintf (dst, "%s%.*s", (name[0] == '/') ? "" : "/", SHM_NAME_MAX - 2, name);
+#endif
+}
+
+// Return: 0 when the segment called name was mapped, -1 otherwise
+int ShmReaderOpen (ShmReader *rd, const char *name)
+{
+	char segName[SHM_NAME_MAX + 1];
+
+	SegmentName (segName, name);
+	rd->header = NULL;
+#ifdef _WINDOWS
+	rd->handle = OpenFileMappingA (FILE_MAP_READ, FALSE, segName);
+	if (!rd->handle) return -1;
+	rd->header = MapViewOfFile (rd->handle, FILE_MAP_READ, 0, 0, 0);
+	if (!rd->header) {
+		CloseHandle (rd->handle);
+		return -1;
+	}
+	rd->mapped = rd->header->size;
+#else
+	struct stat st;
+	void *p;
+
+	rd->fd = shm_open (segName, O_RDONLY, 0);
+	if (rd->fd < 0) return -1;
+	if (fstat (rd->fd, &st) != 0 || st.st_size < (off_t) sizeof (ShmHeader) ||
+			(p = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, rd->fd, 0)) == MAP_FAILED) {
+		close (rd->fd);
+		return -1;
+	}
+	rd->header = p;
+	rd->mapped = st.st_size;
+#endif
+	if (rd->header->magic != SHM_MAGIC || rd->header->version != SHM_VERSION) {
+		ShmReaderClose (rd);
+		return -1;
+	}
+	return 0;
+}
+
+// Map the whole segment again after the engine has grown it
+static int ShmReaderRemap (ShmReader *rd)
+{
+#ifdef _WINDOWS
+	return -1;
+#else
+	struct stat st;
+	void *p;
+
+	if (fstat (rd->fd, &st) != 0) return -1;
+	p = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, rd->fd, 0);
+	if (p == MAP_FAILED) return -1;
+	munmap (rd->header, rd->mapped);
+	rd->header = p;
+	rd->mapped = st.st_size;
+	return 0;
+#endif
+}
+
+// Return: whether n molecules at byte offset off lie inside the mapping
+static int ShmFits (ShmReader *rd, long long off, int n)
+{
+	return off >= (long long) sizeof (ShmHeader) &&
+		off + (long long) n * (long long) sizeof (VecR) <= rd->mapped;
+}
+
+// Copy a consistent state into *h and, if not NULL, the first maxMol
+// positions and velocities into r and rv.
+// Return: the number of molecules copied, -1 when the engine has gone away
+// or left seq odd for SHM_READ_TIMEOUT ms, having died while writing
+int ShmReaderRead (ShmReader *rd, ShmHeader *h, VecR *r, VecR *rv, int maxMol)
+{
+	volatile ShmHeader *sh;
+	unsigned int seq, seqStuck = 0;
+	double deadline = 0.;
+	int n;
+
+	for (;;) {
+		sh = rd->header;
+		seq = sh->seq;
+		if (seq & 1) {
+			// An engine that died while writing leaves seq odd for good;
+			// one that is alive moves it on
+			if (deadline == 0. || seq != seqStuck) {
+				seqStuck = seq;
+				deadline = ReaderClock () + SHM_READ_TIMEOUT;
+			}
+			else if (ReaderClock () > deadline) return -1;
+#ifdef _WINDOWS
+			SwitchToThread ();
+#else
+			sched_yield ();
+#endif
+			continue;
+		}
+		MemoryFence ();
+		if (sh->closed) return -1;
+		if (sh->size > rd->mapped) {
+			if (ShmReaderRemap (rd) != 0) return -1;
+			continue;
+		}
+		memcpy (h, (const void *) sh, sizeof (ShmHeader));
+		n = Min (h->nMol, maxMol);
+		// A header copied while the engine wrote it may point anywhere
+		if (n < 0 || (r && !ShmFits (rd, h->offsetR, n)) ||
+				(rv && !ShmFits (rd, h->offsetRv, n))) {
+			MemoryFence ();
+			if (sh->seq == seq) return -1;
+			continue;
+		}
+		if (r) memcpy (r, (char *) rd->header + h->offsetR, n * sizeof (VecR));
+		if (rv) memcpy (rv, (char *) rd->header + h->offsetRv, n * sizeof (VecR));
+		MemoryFence ();
+		if (sh->seq == seq) return n;
+	}
+}
+
+void ShmReaderClose (ShmReader *rd)
+{
+	if (!rd->header) return;
+#ifdef _WINDOWS
+	UnmapViewOfFile (rd->header);
+	CloseHandle (rd->handle);
+#else
+	munmap (rd->header, rd->mapped);
+	close (rd->fd);
+#endif
+	rd->header = NULL;
+}
@@ -1,7 +1,7 @@
 /*
  * Molecular dynamics simulation
  *
- * pr_02_1 - all pairs, two dimensions
+ * pr_02_2 - cell subdivision, two dimensions, run on a pool of threads
  *
  *
  * (C)2004	D. C. Rapaport
@@ -17,12 +17,26 @@
 #include "in_vdefs.h"
 #include "in_mddefs.h"
 #include "random.h"
+#include "arena.h"
+#include "threads.h"
 
 #include "simulation.h"
-
-typedef struct {
-	VecR r, rv, ra;
-} Mol;
+#include "snapshot.h"
+#include "shmexport.h"
+#include "transport.h"
+#include "structure.h"
+#include "cluster.h"
+#include "hexatic.h"
+#include "replica.h"
+#include "shear.h"
+#include "harddisk.h"
+#include "initconf.h"
+#include "balance.h"
+#include "domain.h"
+#include "trajectory.h"
+#include "eqcache.h"
+#include "blocking.h"
+#include "steer.h"
 
 
 // These variables are input to the simulation
@@ -31,6 +45,12 @@ double deltaT = 0.005;
 double density = 0.8;
 double temperature = 1.0;
 int stepAvg = 100, stepLimit = 1000;
+int stepSample = 1;
+int hugePages = ARENA_PAGES_NORMAL;
+int nThreads = 0, pinThreads = 1;
+int randSeed = 0;
+int reproSums = 0;
+double stopError = 0.;
 
 
 // The following variables are computed during simulation
@@ -39,7 +59,7 @@ Prop pressure;
 Prop pressure_xx, pressure_xy, pressure_yx, pressure_yy;
 double timeNow;
 Mol *mol = NULL;
-int nMol;
+int nMol, nMolAll, nMolOwn, nMolMax;
 VecR region, vSum;
 int stepCount;
 double rCut, rMin, uCut;
@@ -47,21 +67,103 @@ double uSum, velMag, vvSum;
 double virSum;
 Ten2R2 tvirSum;
 
+// Cell subdivision: cellList[nMol + c] is the first molecule in cell c and
+// cellList[n] the molecule after n in the same cell, -1 ends the list
+VecI cells;
+int *cellList;
+
+// Periodic images: molecule n has crossed the box molImage[n] times, so its
+// unwrapped position is mol[n].r + molImage[n] * region
+VecI *molImage;
+
+// Sums for the properties, over the molecules of a thread or a cell row
+typedef struct {
+	double uSum, virSum, vvSum;
+	Ten2R2 tvirSum, tvvSum;
+	VecR vSum;
+} Sums;
+
+// Partial sums of one thread, padded to whole cache lines
+typedef union {
+	Sums s;
+	char pad[128];
+} PartSums;
+
+PartSums *partSums;
+
+/*
+ * Reproducible sums
+ *
+ * With reproSums set, the sums are taken per cell row instead of per thread
+ * and the rows are added up pairwise in a fixed tree, see SumProps(). The
+ * order of every addition then depends on the cells alone, so the results,
+ * and the trajectory of thermostatted runs, are the same bit for bit for
+ * any number of threads.
+ */
+Sums *rowSums;
+
+// All per-particle and per-cell arrays live in this arena
+Arena simArena;
+int nMolArena = -1, hugePagesArena;
+
 
 // Variables related to timing
 time_t time_computations;
 
 
+/*
+ * Observables
+ *
+ * Every property printed in the summary is registered together with the
+ * number of steps between its samples. On steps where none of them is due,
+ * EvalProps() is skipped and the lean force kernel is used, which leaves out
+ * the energy and virial sums. All samples of the run also go to a blocking
+ * analysis, which gives the error of the mean; with stopError set the run
+ * ends once that of every target is below it, see Converged(). Replica
+ * exchange takes the samples of all temperatures in turn, so it has no
+ * blocking analysis (and no stopError); it reports per temperature itself.
+ */
+typedef struct {
+	Prop *prop;
+	const char *name;
+	int *period;       // steps between samples, may change during the run
+	int nSample;
+	int target;        // whether the run waits for its error, see stopError
+	Blocking blk;
+} Observable;
+
+#define MAX_OBSERVABLES 16
+
+Observable observable[MAX_OBSERVABLES];
+int nObservable;
+int sampleStep, corrStep, forceSample;
+int hdReady;
+// Time and step at the last change of the time step, see SetTimeStep()
+static double timeBase;
+static int stepBase;
+
+
 // Local function definitions
-void ComputeForces (void);
-void LeapfrogStep (int part);
-void ApplyBoundaryCond (void);
-void InitCoords (void);
+void ComputeForces (int tid, int full);
+static void ForceSumsZero (int tid);
+static void ForceRows (int tid, int full, int yLo, int yHi);
+void LeapfrogStep (int part, int tid);
+void ApplyBoundaryCond (int tid);
+void BuildCells (void);
+static void ClearCells (void);
+static void LinkCells (int nLo, int nHi);
+void InitCells (int tid);
 void InitVels (void);
-void InitAccels (void);
-void EvalProps (void);
-void write_velocities(const char *filename);
-void write_distances(const char *filename);
+void InitAccels (int tid);
+void EvalProps (int tid);
+void SumProps (void);
+static void Equilibrate (int nSteps);
+void Decompose (void);
+void DecomposeMols (void);
+void RegisterObservable (Prop *prop, const char *name, int *period, int target);
+static int  Converged (void);
+static void BlockingReport (void);
+int  SampleDue (void);
 
 double get_x_coordinate(int iMol)
 {
@@ -85,14 +187,20 @@ double get_y_region(void)
 
 void simulation_init(void)
 {
+	int warm;
+
 	message("-----------------------------------------------------------------------\n");
 	message("Initializing simulation\n");
+	SteerInit ();
 	
 	// Display simulation parameters
 	PrintNameList();
 	
 	// Initialize random number generator
-	InitRand(0); // 0 to use time as random seed
+	// Initialize random number generator, with a sequence of its own on
+	// every rank
+	InitRand(randSeed ? randSeed + rankId : 0); // 0 to use time as random seed
+	DomainInit ();
 
 	// Calculate parameters
 	rMin = pow (2., 1./6.);
@@ -101,58 +209,276 @@ void simulation_init(void)
 	//uCut = 4. * (pow(rCut, 1./12.) - pow(rCut, 1./6.));
 	uCut = 4. * (pow(rCut, -12.) - pow(rCut, -6.));
 	message("Ucut = %8.4f\n", uCut);
-	VSCopy (region, 1. / sqrt (density), initUcell);
-	nMol = VProd (initUcell);
-	velMag = sqrt (n_dimensions * (1. - 1. / nMol) * temperature);
+	InitConfSize ();
+	nMolAll = nMol;
+	velMag = sqrt (n_dimensions * (1. - 1. / nMolAll) * temperature);
+
+	// Cells are at least rCut wide. With fewer than three in a direction
+	// the neighbour cells would overlap, so use a single one instead.
+	// Under shear the rows across the y boundary are searched over four
+	// columns, see ForceKernel().
+	VSCopy (cells, 1. / rCut, region);
+	if (cells.x < (shearRate != 0. ? 4 : 3)) cells.x = 1;
+	if (cells.y < 3) cells.y = 1;
+	DomainSlabs ();
 
-	// Initialize data structures
-	if (mol) free(mol);
-	AllocMem (mol, nMol, Mol);
+	// Start the threads and divide the molecules and cells among them
+	ThreadsInit ();
+	Decompose ();
+
+	// Initialize data structures. The arena keeps its memory when the
+	// number of molecules is unchanged, so a reset does not touch the
+	// operating system. The trajectory writer may still use it.
+	TrajFree ();
+	if (nMolMax != nMolArena || hugePages != hugePagesArena) {
+		ArenaFree (&simArena);
+		ArenaInit (&simArena, hugePages);
+		nMolArena = nMolMax;
+		hugePagesArena = hugePages;
+	}
+	ArenaReset (&simArena);
+	AllocMemArena (&simArena, mol, nMolMax, Mol);
+	AllocMemArena (&simArena, cellList, nMolMax + VProd (cells), int);
+	AllocMemArena (&simArena, molImage, nMolMax, VecI);
+	AllocMemArena (&simArena, partSums, nThreadsUsed, PartSums);
+	AllocMemArena (&simArena, rowSums, cells.y, Sums);
+	SnapshotInit (&simArena);
+	TransportInit (&simArena);
+	SkSamplerInit (&simArena);
+	ClusterInit (&simArena, "clusters.txt");
+	HexaticInit (&simArena);
+	ShearInit (&simArena);
+	BalanceInit (&simArena);
+	TrajInit (&simArena);
+	message("Memory: %.2f MB in use, %.2f MB reserved\n",
+		simArena.used / 1048576., simArena.reserved / 1048576.);
+	ThreadsReport ();
 	stepCount = 0;
-	InitCoords ();
+	stepBase = 0;
+	timeBase = 0.;
+
+	// Every thread writes its own molecules and cells first, so on a NUMA
+	// machine their pages are placed on that thread's node
+	message("Box size: %f %f \n",region.x, region.y );
+	ThreadsRun (InitCells);
+	InitConfCoords ();
+	if (nRanks > 1) DecomposeMols ();
 	InitVels ();
-	InitAccels ();
+	warm = CacheLoad ();
+	ThreadsRun (InitAccels);
+	BuildCells ();
+	BalanceRows ();
+	if (warm) Equilibrate (cacheEquil);
+	SnapshotPublish ();
+	TrajSample ();
+	ReplicaInit (&simArena);
+	if (nReplicas > 1 && stopError > 0.)
+		LogWarn("Warning: stopError does not apply to replica exchange, running %d steps\n",
+			stepLimit);
+	hdReady = HardDiskInit (&simArena) == 0;
+
+	// Register the observables shown by PrintSummary()
+	nObservable = 0;
+	// The run waits for the errors of the pressures, and of the total energy
+	// with the thermostat of shear; otherwise that is conserved but for a
+	// slow drift, whose blocked error never levels off
+	RegisterObservable (&totEnergy, "Etot", &stepSample, shearRate != 0.);
+	RegisterObservable (&kinEnergy, "Ekin", &stepSample, 0);
+	RegisterObservable (&pressure, "Pressure", &stepSample, 1);
+	RegisterObservable (&pressure_xx, "Pressure_xx", &stepSample, 1);
+	// The off-diagonal pressure also feeds the viscosity correlator
+	RegisterObservable (&pressure_xy, "Pressure_xy", corrPeriod ? &corrPeriod : &stepSample, 1);
+	RegisterObservable (&pressure_yx, "Pressure_yx", corrPeriod ? &corrPeriod : &stepSample, 1);
+	RegisterObservable (&pressure_yy, "Pressure_yy", &stepSample, 1);
 	AccumProps (0);
+
+	ShmExportInit ();
 }
 
 void simulation_run(void)
 {
-	unsigned int step;
-	
-	PrintSummaryHeader();
+	// Replica exchange prints a table of its own
+	if (nReplicas <= 1) PrintSummaryHeader();
 	
 	// Reset time counters
 	time_computations = 0;
 
 	// Run simulation steps. This just continues where the previous simulation
 	// left off, use simulation_init() to restart from the initial condition.
-	running=1;
-	for (step=0; step<stepLimit && running; step++) {
+	AtomicStore(&running, 1);
+	if (nReplicas > 1) ReplicaRun();
+	else simulation_steps(stepLimit);
+	simulation_report();
+}
+
+// Run nSteps steps with all the sampling and output that is due on them,
+// or fewer if running is cleared meanwhile or the errors reach stopError.
+// Return: the number of steps taken
+int simulation_steps(int nSteps)
+{
+	int step;
+
+	for (step=0; step<nSteps && AtomicLoad(&running); step++) {
+		// Commands queued by the display or the terminal; a pause waits here
+		SteerPoll();
+		if ( !AtomicLoad(&running) ) break;
 		simulation_step();
 		
-		// Update display every drawing_period steps
-		if ( do_draw_discs && drawing_period && ( (step%drawing_period) == 0 ) ) {
-			gui_draw_begin();
-    		discs_clear();
-			discs_draw();
-			gui_draw_end();
+		// Done once the means are known well enough
+		if ( stopError > 0. && sampleStep && Converged() ) {
+			message("Errors below %g after %d steps, stopping\n", stopError, stepCount);
+			++step;
+			break;
+		}
+		
+		// Hand the positions to the display every drawing_period steps, it
+		// draws them in its own thread
+		if ( do_draw_discs && drawing_period && ( (stepCount%drawing_period) == 0 ) ) {
+			SnapshotPublish();
+		}
+		if ( trajPeriod && (stepCount%trajPeriod) == 0 ) {
+			TrajSample();
+		}
+		// Publish the state for external viewers every shmPeriod steps
+		if ( shmPeriod && (stepCount%shmPeriod) == 0 ) {
+			ShmExportPublish();
+		}
+		// S(k) is worked out in its own thread
+		if ( skPeriod && (stepCount%skPeriod) == 0 ) {
+			SkSamplerSample();
+		}
+		// Cluster sizes, from the cells of the last step
+		if ( clusterPeriod && (stepCount%clusterPeriod) == 0 ) {
+			ClusterSample();
+		}
+		if ( hexPeriod && (stepCount%hexPeriod) == 0 ) {
+			HexaticSample();
 		}
 		// average reporting
-		if ( stepAvg && (((step+1)%stepAvg) == 0) ) {
+		if ( stepAvg && ((stepCount%stepAvg) == 0) ) {
 			AccumProps(2);	// Accumulate averages
 			PrintSummary();	// Print averages
+			ClusterSummary();
+			HexaticSummary();
+			BalanceSummary();
+			ShmExportSummary();
 			AccumProps(0);	// Clear averages
 		}
 		// give the gui time to do something during run, if needed
 		//gui_simulation_step();
 	}
-	
+	return step;
+}
+
+// Print the results of the run so far and write the output files
+void simulation_report(void)
+{
 	// Print time counters
 	message("Computations took %.4f s\n", time_computations/(float)CLOCKS_PER_SEC );
-	
-	// Finally write velocities and distances to a text file
-	write_velocities("velocities.txt");
-	write_distances("distances.txt");
+	message("Peak memory use %.2f MB\n", simArena.peak / 1048576.);
+	TransportReport("correlations.txt", "msd.txt");
+	SkSamplerReport("sk.txt");
+	ClusterReport();
+	HexaticReport("hexatic.txt");
+	BlockingReport();
+	ReplicaReport();
+	ShearReport("profile.txt");
+	HardDiskReport();
+	TrajReport();
+
+	// Leave the final state for the display; g(r) and the velocity
+	// distribution come from the trajectory, see md-analyse.c
+	SnapshotPublish();
+	CacheSave();
+}
+
+// The parts of a step that are divided among the threads, see simulation_step()
+static void StepPart1 (int tid)
+{
+	LeapfrogStep (1, tid);
+	ApplyBoundaryCond (tid);
+}
+
+static void StepPart2 (int tid)
+{
+	ComputeForces (tid, sampleStep);
+}
+
+// With several ranks, the forces in the interior rows of the slab while
+// the ghosts are on their way, then those in its two outer rows
+static void StepForcesInterior (int tid)
+{
+	ForceSumsZero (tid);
+	ForceRows (tid, sampleStep, domRowLo + 1, domRowHi - 1);
+}
+
+static void StepForcesOuter (int tid)
+{
+	ForceRows (tid, sampleStep, domRowLo, domRowLo + 1);
+	ForceRows (tid, sampleStep, domRowHi - 1, domRowHi);
+}
+
+static void StepPart3 (int tid)
+{
+	LeapfrogStep (2, tid);
+	if (sampleStep && ! reproSums) EvalProps (tid);
+	if (corrStep) TransportSample (tid);
+}
+
+// The row sums read the velocities of molecules of other threads, so they
+// wait until all are updated
+static void StepEvalProps (int tid)
+{
+	EvalProps (tid);
+}
+
+static void StepTransport (int tid)
+{
+	TransportSample (tid);
+}
+
+static double velFac;
+
+static void ScaleVels (int tid)
+{
+	int n;
+
+	DO_MOL_OF (tid) VScale (mol[n].rv, velFac);
+}
+
+// Let a state taken from the cache settle for nSteps steps, rescaling the
+// velocities to the temperature after each. Nothing is sampled and the
+// step counter is left alone, so the run starts afterwards as usual.
+static void Equilibrate (int nSteps)
+{
+	int step;
+
+	sampleStep = 1;
+	corrStep = 0;
+	for (step = 0; step < nSteps; step ++) {
+		ThreadsRun (StepPart1);
+		BuildCells ();
+		ThreadsRun (StepPart2);
+		ThreadsRun (StepPart3);
+		if (reproSums) ThreadsRun (StepEvalProps);
+		SumProps ();
+		velFac = vvSum > 0. ? sqrt (n_dimensions * (1. - 1. / nMol) * temperature /
+			(vvSum / nMol)) : 1.;
+		ThreadsRun (ScaleVels);
+	}
+	sampleStep = 0;
+}
+
+// Go on with time step dt from the current step; the time so far is kept.
+// The blocking analysis starts again, its samples being dt apart.
+void SetTimeStep (double dt)
+{
+	int k;
+
+	timeBase = timeNow;
+	stepBase = stepCount;
+	deltaT = dt;
+	for (k = 0; k < nObservable; k ++) BlockingZero (&observable[k].blk);
 }
 
 void simulation_step(void)
@@ -163,93 +489,353 @@ void simulation_step(void)
 	
 	// Do the real simulation step
 	stepCount++;
-	timeNow = stepCount * deltaT;
-	LeapfrogStep (1);
-	ApplyBoundaryCond ();
-	ComputeForces ();
-	LeapfrogStep (2);
-	EvalProps ();
-	AccumProps (1);
+	timeNow = timeBase + (stepCount - stepBase) * deltaT;
+	sampleStep = forceSample || SampleDue ();
+	forceSample = 0;
+	// The replicas take turns, so their velocities are not correlated
+	corrStep = nReplicas > 1 ? 0 : TransportDue ();
+	if (hardDisks) {
+		// All events up to the end of the step; the cells are only
+		// rebuilt for the analysis
+		if (hdReady) HardDiskAdvance (timeNow);
+		else AtomicStore(&running, 0);
+		BuildCells ();
+		if (corrStep) ThreadsRun (StepTransport);
+		if (sampleStep) {
+			HardDiskProps ();
+			AccumProps (1);
+			if (corrStep) TransportSampleSum ();
+		}
+	} else {
+		if (shearRate != 0.) ShearAdvance ();
+		ThreadsRun (StepPart1);
+		if (nRanks > 1) {
+			DomainMigrate ();
+			DecomposeMols ();
+			DomainHaloStart ();
+			ClearCells ();
+			LinkCells (0, nMolOwn);
+			ThreadsRun (StepForcesInterior);
+			DomainHaloFinish ();
+			LinkCells (nMolOwn, nMol);
+			ThreadsRun (StepForcesOuter);
+			// For the next step, the rows must stay put meanwhile
+			if (balancePeriod && stepCount % balancePeriod == 0) BalanceRows ();
+		} else {
+			BuildCells ();
+			if (balancePeriod && stepCount % balancePeriod == 0) BalanceRows ();
+			ThreadsRun (StepPart2);
+		}
+		ThreadsRun (StepPart3);
+		if (sampleStep && reproSums) ThreadsRun (StepEvalProps);
+		if (shearRate != 0.) ShearThermostat ();
+		if (sampleStep) {
+			SumProps ();
+			AccumProps (1);
+			if (corrStep) TransportSampleSum ();
+			if (shearRate != 0.) ShearSample ();
+		}
+	}
 	
 	// Update time counters
 	clocklast = clock();
 	time_computations += clocklast - clock0;
 }
 
-void ComputeForces ()
+// Divide the molecules of this rank evenly among the threads
+void DecomposeMols (void)
+{
+	int t;
+
+	for (t = 0; t < nThreadsUsed; t ++) {
+		threadInfo[t].molLo = (long) t * nMolOwn / nThreadsUsed;
+		threadInfo[t].molHi = (long) (t + 1) * nMolOwn / nThreadsUsed;
+	}
+}
+
+// Divide the molecules and the cell rows of the slab evenly among the
+// threads; the rows are divided by their work later on, see BalanceRows()
+void Decompose (void)
+{
+	ThreadInfo *ti;
+	int t;
+
+	DecomposeMols ();
+	for (t = 0; t < nThreadsUsed; t ++) {
+		ti = &threadInfo[t];
+		ti->rowLo = domRowLo + (long) t * (domRowHi - domRowLo) / nThreadsUsed;
+		ti->rowHi = domRowLo + (long) (t + 1) * (domRowHi - domRowLo) / nThreadsUsed;
+	}
+}
+
+// Cell row of position r; the domains use it too, so they always agree
+// with the cells
+int CellRow (VecR *r)
 {
-	VecR dr, fc;
-	double fcVal, rr, rrCut, rri, rri3;
-	int j1, j2, n;
+	int y = (r->y + 0.5 * region.y) * (cells.y / region.y);
+
+	return Min (y, cells.y - 1);
+}
+
+// Empty the cells; with several ranks only those of the slab and the ghost
+// rows, the others are not used
+static void ClearCells (void)
+{
+	int c, cHi, y, yHi;
+
+	y = nRanks > 1 ? domRowLo - 1 : 0;
+	yHi = nRanks > 1 ? domRowHi + 1 : cells.y;
+	for (; y < yHi; y ++) {
+		c = nMol + (y + cells.y) % cells.y * cells.x;
+		for (cHi = c + cells.x; c < cHi; c ++) cellList[c] = -1;
+	}
+}
+
+// Add molecules nLo .. nHi - 1 to the cells
+static void LinkCells (int nLo, int nHi)
+{
+	double invWidX;
+	int c, n, x;
+
+	invWidX = cells.x / region.x;
+	for (n = nLo; n < nHi; n ++) {
+		x = (mol[n].r.x + 0.5 * region.x) * invWidX;
+		c = Min (x, cells.x - 1) + CellRow (&mol[n].r) * cells.x + nMol;
+		cellList[n] = cellList[c];
+		cellList[c] = n;
+	}
+}
+
+// Sort the molecules into cells
+void BuildCells (void)
+{
+	ClearCells ();
+	LinkCells (0, nMol);
+}
+
+// Columns of cells by which the cells k boxes above the region are moved
+// under shear: they lie d = k * shearShift further along x, so a search
+// about column m + ShearColumns (d) covers them, with one extra column on
+// the low side for the fraction of a cell
+static int ShearColumns (double d)
+{
+	return - (int) floor (d * cells.x / region.x);
+}
+
+// Force on every molecule in cell rows yLo .. yHi - 1, which thread tid
+// owns. All neighbours of a molecule are visited, so each pair is handled
+// twice (once by each of its molecules) but no two threads write the same
+// molecule. The argument full is a constant at each call site below, so the
+// compiler drops the energy and virial sums from the lean variant; they are
+// added to those of the thread, or with reproSums kept per cell row.
+static inline void ForceKernel (int tid, const int full, int yLo, int yHi)
+{
+	VecR a, dr, fc;
+	VecI m1v, m2v, range;
+	Ten2R2 tvir;
+	double fcVal, rr, rrCut, rri, rri3, u, vir, shift = shearShift;
+	int dx, dy, j1, j2, k, m1, m2, xLo[3], xOff[3];
 
 	rrCut = Sqr (rCut);
-	DO_MOL VZero (mol[n].ra);
-	uSum = 0.;
-	virSum = 0.;
-	TZero (tvirSum);
-	for (j1 = 0; j1 < nMol - 1; j1 ++) {
-		for (j2 = j1 + 1; j2 < nMol; j2 ++) {
-			VSub (dr, mol[j1].r, mol[j2].r);
-			VWrapAll (dr);
-			rr = VLenSq (dr);
-			if (rr < rrCut) {
-				rri = 1. / rr;
-				rri3 = Cube (rri);
-				fcVal = 48. * rri3 * (rri3 - 0.5) * rri;
-				VSCopy (fc, fcVal, dr);
-				VVAdd (mol[j1].ra, fc);
-				VVSub (mol[j2].ra, fc);
-				uSum += 4. * rri3 * (rri3 - 1.) - uCut;
-				virSum += fcVal * rr;
-				TVVAddDyad (tvirSum, dr, fc);
+	VSet (range, cells.x > 1, cells.y > 1);
+	// Column range and offset of the rows below, inside and above the
+	// region; the offsets are kept positive for the modulo
+	for (k = 0; k < 3; k ++) {
+		xLo[k] = - range.x;
+		xOff[k] = cells.x;
+	}
+	if (shearRate != 0. && cells.x > 1) {
+		for (k = 0; k < 3; k += 2) {
+			-- xLo[k];
+			xOff[k] += (ShearColumns ((k - 1) * shift) % cells.x + cells.x) % cells.x;
+		}
+	}
+	u = vir = 0.;
+	TZero (tvir);
+	for (m1v.y = yLo; m1v.y < yHi; m1v.y ++) {
+		for (m1v.x = 0; m1v.x < cells.x; m1v.x ++) {
+			m1 = VLinear (m1v, cells) + nMol;
+			for (j1 = cellList[m1]; j1 >= 0; j1 = cellList[j1]) {
+				VZero (a);
+				for (dy = - range.y; dy <= range.y; dy ++) {
+					m2v.y = m1v.y + dy;
+					k = 1 + (m2v.y >= cells.y) - (m2v.y < 0);
+					m2v.y = (m2v.y + cells.y) % cells.y;
+					for (dx = xLo[k]; dx <= range.x; dx ++) {
+						m2v.x = (m1v.x + dx + xOff[k]) % cells.x;
+						m2 = VLinear (m2v, cells) + nMol;
+						for (j2 = cellList[m2]; j2 >= 0; j2 = cellList[j2]) {
+							if (j2 == j1) continue;
+							VSub (dr, mol[j1].r, mol[j2].r);
+							VWrapAllShear (dr, shift);
+							rr = VLenSq (dr);
+							if (rr < rrCut) {
+								rri = 1. / rr;
+								rri3 = Cube (rri);
+								fcVal = 48. * rri3 * (rri3 - 0.5) * rri;
+								VSCopy (fc, fcVal, dr);
+								VVAdd (a, fc);
+								if (full) {
+									u += 4. * rri3 * (rri3 - 1.) - uCut;
+									vir += fcVal * rr;
+									TVVAddDyad (tvir, dr, fc);
+								}
+							}
+						}
+					}
+				}
+				mol[j1].ra = a;
 			}
 		}
+		if (full && reproSums) {
+			rowSums[m1v.y].uSum = u;
+			rowSums[m1v.y].virSum = vir;
+			rowSums[m1v.y].tvirSum = tvir;
+			u = vir = 0.;
+			TZero (tvir);
+		}
 	}
+	if (full) {
+		partSums[tid].s.uSum += u;
+		partSums[tid].s.virSum += vir;
+		TTAdd (partSums[tid].s.tvirSum, tvir);
+	}
+}
+
+// Forces only, used on steps where no observable is sampled
+static void ComputeForcesLean (int tid, int yLo, int yHi)
+{
+	ForceKernel (tid, 0, yLo, yHi);
+}
+
+// Forces plus potential energy and virial (tensor)
+static void ComputeForcesFull (int tid, int yLo, int yHi)
+{
+	ForceKernel (tid, 1, yLo, yHi);
+}
+
+static void ForceSumsZero (int tid)
+{
+	partSums[tid].s.uSum = partSums[tid].s.virSum = 0.;
+	TZero (partSums[tid].s.tvirSum);
 }
 
+// Forces in those of rows yLo .. yHi - 1 that thread tid owns
+static void ForceRows (int tid, int full, int yLo, int yHi)
+{
+	yLo = Max (yLo, threadInfo[tid].rowLo);
+	yHi = Min (yHi, threadInfo[tid].rowHi);
+	if (yLo >= yHi) return;
+	if (full) ComputeForcesFull (tid, yLo, yHi);
+	else ComputeForcesLean (tid, yLo, yHi);
+}
 
-void LeapfrogStep (int part)
+void ComputeForces (int tid, int full)
+{
+	ForceSumsZero (tid);
+	ForceRows (tid, full, 0, cells.y);
+}
+
+// Call visit() for every pair closer than rc whose first molecule lies in
+// the cell rows of thread tid, so like the forces each pair is visited once
+// from either end. When rc is more than a cell wide the search reaches
+// further out, but never covers a cell twice. Under shear the rows beyond
+// the region are searched like in ForceKernel().
+void VisitPairs (int tid, double rc, PairVisitor visit, void *arg)
+{
+	ThreadInfo *ti = &threadInfo[tid];
+	VecR dr, wid;
+	VecI m1v, m2v, range;
+	double rr, rrc, shift = shearShift;
+	int dx, dy, j1, j2, k, m1, m2, nx, ny, x0, y;
+
+	rrc = Sqr (rc);
+	VDiv (wid, region, cells);
+	VSet (range, (int) ceil (rc / wid.x), (int) ceil (rc / wid.y));
+	ny = Min (2 * range.y + 1, cells.y);
+	for (m1v.y = ti->rowLo; m1v.y < ti->rowHi; m1v.y ++) {
+		for (m1v.x = 0; m1v.x < cells.x; m1v.x ++) {
+			m1 = VLinear (m1v, cells) + nMol;
+			for (j1 = cellList[m1]; j1 >= 0; j1 = cellList[j1]) {
+				for (dy = - range.y; dy < ny - range.y; dy ++) {
+					// Row y lies k boxes above the region
+					y = m1v.y + dy;
+					k = y >= 0 ? y / cells.y : - ((- y - 1) / cells.y) - 1;
+					m2v.y = y - k * cells.y;
+					if (shearRate != 0. && k != 0) {
+						x0 = - range.x - 1 + ShearColumns (k * shift);
+						nx = 2 * range.x + 2;
+					} else {
+						x0 = - range.x;
+						nx = 2 * range.x + 1;
+					}
+					if (nx > cells.x) {
+						x0 = 0;
+						nx = cells.x;
+					}
+					for (dx = x0; dx < x0 + nx; dx ++) {
+						m2v.x = ((m1v.x + dx) % cells.x + cells.x) % cells.x;
+						m2 = VLinear (m2v, cells) + nMol;
+						for (j2 = cellList[m2]; j2 >= 0; j2 = cellList[j2]) {
+							if (j2 == j1) continue;
+							VSub (dr, mol[j1].r, mol[j2].r);
+							VWrapAllShear (dr, shift);
+							rr = VLenSq (dr);
+							if (rr < rrc) visit (j1, j2, &dr, rr, arg);
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+
+void LeapfrogStep (int part, int tid)
 {
 	int n;
 
-	if (part == 1) {
-		DO_MOL {
+	if (shearRate != 0.) {
+		// SLLOD, rv being the velocity relative to the flow shearRate * y
+		DO_MOL_OF (tid) {
+			mol[n].rv.x += 0.5 * deltaT * (mol[n].ra.x - shearRate * mol[n].rv.y);
+			mol[n].rv.y += 0.5 * deltaT * mol[n].ra.y;
+			if (part == 1) {
+				mol[n].r.x += deltaT * (mol[n].rv.x + shearRate * mol[n].r.y);
+				mol[n].r.y += deltaT * mol[n].rv.y;
+			}
+		}
+	} else if (part == 1) {
+		DO_MOL_OF (tid) {
 			VVSAdd (mol[n].rv, 0.5 * deltaT, mol[n].ra);
 			VVSAdd (mol[n].r, deltaT, mol[n].rv);
 		}
 	} else {
-		DO_MOL VVSAdd (mol[n].rv, 0.5 * deltaT, mol[n].ra);
+		DO_MOL_OF (tid) VVSAdd (mol[n].rv, 0.5 * deltaT, mol[n].ra);
 	}
 }
 
 
-void ApplyBoundaryCond (void)
+void ApplyBoundaryCond (int tid)
 {
 	int n;
 
-	DO_MOL VWrapAll (mol[n].r);
+	if (shearRate != 0.) {
+		DO_MOL_OF (tid) VWrapAllShearImage (mol[n].r, molImage[n], shearShift);
+	} else {
+		DO_MOL_OF (tid) VWrapAllImage (mol[n].r, molImage[n]);
+	}
 }
 
 
-void InitCoords (void)
+// Clear the cell list entries of the molecules and cell rows of thread tid
+void InitCells (int tid)
 {
-	VecR c, gap;
-	int n, nx, ny;
+	int c, n;
 
-	VDiv (gap, region, initUcell);
-	message("Initial distance between particles: %f\n", gap);
-	message("Box size: %f %f \n",region.x, region.y );
-											
-	n = 0;
-	for (ny = 0; ny < initUcell.y; ny ++) {
-		for (nx = 0; nx < initUcell.x; nx ++) {
-			VSet (c, nx + 0.5, ny + 0.5);
-			VMul (c, c, gap);
-			VVSAdd (c, -0.5, region);
-			mol[n].r = c;
-			++ n;
-		}
-	}
+	DO_MOL_OF (tid) cellList[n] = -1;
+	for (c = threadInfo[tid].rowLo * cells.x; c < threadInfo[tid].rowHi * cells.x; c ++)
+		cellList[nMol + c] = -1;
 }
 
 
@@ -263,69 +849,192 @@ void InitVels (void)
 		VScale (mol[n].rv, velMag);
 		VVAdd (vSum, mol[n].rv);
 	}
-	DO_MOL VVSAdd (mol[n].rv, - 1. / nMol, vSum);
+	DomainSum ((double *) &vSum, sizeof (VecR) / sizeof (double));
+	DO_MOL VVSAdd (mol[n].rv, - 1. / nMolAll, vSum);
 }
 
 
-void InitAccels (void)
+void InitAccels (int tid)
 {
 	int n;
 
-	DO_MOL VZero (mol[n].ra);
+	DO_MOL_OF (tid) VZero (mol[n].ra);
 }
 
 
-void EvalProps ()
+static void AddVel (Sums *s, VecR *v)
 {
-	double vv, vvMax;
-	int n;
-	Ten2R2 tvvSum;
+	VVAdd (s->vSum, *v);
+	s->vvSum += VLenSq (*v);
+	TVAddDyad (s->tvvSum, *v);
+}
 
-	VZero (vSum);
-	vvSum = 0.;
-	TZero (tvvSum);
-	DO_MOL {
-		VVAdd (vSum, mol[n].rv);
-		vv = VLenSq (mol[n].rv);
-		vvSum += vv;
-		TVAddDyad (tvvSum, mol[n].rv);
+// Velocity sums over the molecules of thread tid, or with reproSums over
+// those of each of its cell rows
+void EvalProps (int tid)
+{
+	Sums *s;
+	int c, cLo, n, y;
+
+	if (! reproSums) {
+		s = &partSums[tid].s;
+		VZero (s->vSum);
+		s->vvSum = 0.;
+		TZero (s->tvvSum);
+		DO_MOL_OF (tid) AddVel (s, &mol[n].rv);
+		return;
+	}
+	for (y = threadInfo[tid].rowLo; y < threadInfo[tid].rowHi; y ++) {
+		s = &rowSums[y];
+		VZero (s->vSum);
+		s->vvSum = 0.;
+		TZero (s->tvvSum);
+		cLo = nMol + y * cells.x;
+		for (c = cLo; c < cLo + cells.x; c ++) {
+			for (n = cellList[c]; n >= 0; n = cellList[n]) AddVel (s, &mol[n].rv);
+		}
+	}
+}
+
+static void SumsAdd (Sums *s, Sums *a)
+{
+	VVAdd (s->vSum, a->vSum);
+	s->vvSum += a->vvSum;
+	TTAdd (s->tvvSum, a->tvvSum);
+	s->uSum += a->uSum;
+	s->virSum += a->virSum;
+	TTAdd (s->tvirSum, a->tvirSum);
+}
+
+
+// Add up the partial sums of the threads, or with reproSums those of the
+// cell rows, over all ranks and evaluate the properties
+void SumProps (void)
+{
+	Sums s;
+	int t, w, y;
+
+	if (reproSums) {
+		DomainGatherRows (rowSums, sizeof (Sums));
+		// Pairwise in place: rows y and y + w, then y and y + 2 w, ...
+		for (w = 1; w < cells.y; w *= 2) {
+			for (y = 0; y + w < cells.y; y += 2 * w) SumsAdd (&rowSums[y], &rowSums[y + w]);
+		}
+		s = rowSums[0];
+	} else {
+		s = partSums[0].s;
+		for (t = 1; t < nThreadsUsed; t ++) SumsAdd (&s, &partSums[t].s);
+		DomainSum ((double *) &s, sizeof (Sums) / sizeof (double));
+	}
+	vSum = s.vSum;
+	vvSum = s.vvSum;
+	// Every pair was counted by both of its molecules
+	uSum = 0.5 * s.uSum;
+	virSum = 0.5 * s.virSum;
+	tvirSum = s.tvirSum;
+	TScale (tvirSum, 0.5);
+
+	kinEnergy.val = 0.5 * vvSum / nMolAll;
+	totEnergy.val = kinEnergy.val + uSum / nMolAll;
+	pressure.val = density * (vvSum + virSum) / (nMolAll * n_dimensions);
+	pressure_xx.val = density * (s.tvvSum.xx + tvirSum.xx) / nMolAll;
+	pressure_xy.val = density * (s.tvvSum.xy + tvirSum.xy) / nMolAll;
+	pressure_yx.val = density * (s.tvvSum.yx + tvirSum.yx) / nMolAll;
+	pressure_yy.val = density * (s.tvvSum.yy + tvirSum.yy) / nMolAll;
+}
+
+
+// Add prop to the list of observables, sampled every *period steps
+void RegisterObservable (Prop *prop, const char *name, int *period, int target)
+{
+	Observable *o;
+
+	if (nObservable >= MAX_OBSERVABLES) {
+		LogError("Error: too many observables, increase MAX_OBSERVABLES\n");
+		return;
+	}
+	o = &observable[nObservable];
+	o->prop = prop;
+	o->name = name;
+	o->period = period;
+	o->nSample = 0;
+	o->target = target;
+	BlockingZero (&o->blk);
+	++ nObservable;
+}
+
+// Return: whether the errors of all targets have levelled off below
+// stopError
+static int Converged (void)
+{
+	Observable *o;
+	double err, ineff;
+	int k;
+
+	for (k = 0; k < nObservable; k ++) {
+		o = &observable[k];
+		if (o->target && (BlockingError (&o->blk, &err, &ineff) != 1 || err > stopError))
+			return 0;
+	}
+	return 1;
+}
+
+// Print the means of the run with their errors, the statistical
+// inefficiencies (samples per independent one) and the integrated
+// correlation times from them, ineff = 1 + 2 tau / (time between samples);
+// ">=" marks errors that are only lower bounds
+static void BlockingReport (void)
+{
+	Observable *o;
+	double err, ineff;
+	int k, r;
+
+	if (nObservable == 0 || observable[0].blk.n[0] == 0) return;
+	if (stepBase > 0) message("Means since the time step changed at step %d, errors by blocking:\n", stepBase);
+	else message("Means over the run, errors by blocking:\n");
+	message("                    mean         error   inefficiency     tau\n");
+	for (k = 0; k < nObservable; k ++) {
+		o = &observable[k];
+		r = BlockingError (&o->blk, &err, &ineff);
+		if (r < 0) {
+			message("  %-12s %12.6f   too few samples\n", o->name, BlockingMean (&o->blk));
+			continue;
+		}
+		message("  %-12s %12.6f %12.6f %s %8.1f %12.4f\n", o->name, BlockingMean (&o->blk),
+			err, r ? "  " : ">=", ineff, 0.5 * Max (ineff - 1., 0.) * Max (*o->period, 1) * deltaT);
 	}
-	kinEnergy.val = 0.5 * vvSum / nMol;
-	totEnergy.val = kinEnergy.val + uSum / nMol;
-	pressure.val = density * (vvSum + virSum) / (nMol * n_dimensions);
-	pressure_xx.val = density * (tvvSum.xx + tvirSum.xx) / nMol;
-	pressure_xy.val = density * (tvvSum.xy + tvirSum.xy) / nMol;
-	pressure_yx.val = density * (tvvSum.yx + tvirSum.yx) / nMol;
-	pressure_yy.val = density * (tvvSum.yy + tvirSum.yy) / nMol;
 }
 
+// Return: whether any observable is sampled in the current step
+int SampleDue (void)
+{
+	int k;
+
+	for (k = 0; k < nObservable; k ++) {
+		if (stepCount % Max (*observable[k].period, 1) == 0) return 1;
+	}
+	return 0;
+}
 
 void AccumProps (int icode)
 {
-	if (icode == 0) {
-		PropZero (totEnergy);
-		PropZero (kinEnergy);
-		PropZero (pressure);
-		PropZero (pressure_xx);
-		PropZero (pressure_xy);
-		PropZero (pressure_yx);
-		PropZero (pressure_yy);
-	} else if (icode == 1) {
-		PropAccum (totEnergy);
-		PropAccum (kinEnergy);
-		PropAccum (pressure);
-		PropAccum (pressure_xx);
-		PropAccum (pressure_xy);
-		PropAccum (pressure_yx);
-		PropAccum (pressure_yy);
-	} else if (icode == 2) {
-		PropAvg (totEnergy, stepAvg);
-		PropAvg (kinEnergy, stepAvg);
-		PropAvg (pressure, stepAvg);
-		PropAvg (pressure_xx, stepAvg);
-		PropAvg (pressure_xy, stepAvg);
-		PropAvg (pressure_yx, stepAvg);
-		PropAvg (pressure_yy, stepAvg);
+	Observable *o;
+	int k;
+
+	for (k = 0; k < nObservable; k ++) {
+		o = &observable[k];
+		if (icode == 0) {
+			PropZero (*o->prop);
+			o->nSample = 0;
+		} else if (icode == 1) {
+			if (stepCount % Max (*o->period, 1) == 0) {
+				PropAccum (*o->prop);
+				if (nReplicas <= 1) BlockingAdd (&o->blk, o->prop->val);
+				++ o->nSample;
+			}
+		} else if (icode == 2) {
+			if (o->nSample > 0) PropAvg (*o->prop, o->nSample);
+		}
 	}
 }
 
@@ -339,7 +1048,7 @@ void PrintSummaryHeader(void)
 void PrintSummary(void)
 {
 	message("%5d %8.4f %7.4f %7.4f %7.4f %7.4f %7.4f %7.4f %7.4f %7.4f %7.4f %7.4f %7.4f %7.4f %7.4f %7.4f %7.4f\n",
-		 stepCount, timeNow, VCSum (vSum) / nMol, PropEst (totEnergy),
+		 stepCount, timeNow, VCSum (vSum) / nMolAll, PropEst (totEnergy),
 		 PropEst (kinEnergy), PropEst (pressure),
 		 PropEst (pressure_xx), PropEst (pressure_xy), PropEst (pressure_yx),
 		 PropEst (pressure_yy));
@@ -351,56 +1060,43 @@ void PrintNameList(void)
 	message("  # of integration steps (stepLimit) = %5d\n", stepLimit);
 	message("             time step size (deltaT) = %.6f\n", deltaT);
 	message("             average every (stepAvg) = %4d\n", stepAvg);
+	message("  stop at standard error (stopError) = %g\n", stopError);
+	message("           sample every (stepSample) = %4d\n", stepSample);
 	message("update visual every (drawing_period) = %4d\n", drawing_period);
 	message("           temperature (temperature) = %.6f\n", temperature);
 	message("                   density (density) = %.6f\n", density);
-}
-
-void write_velocities(const char *filename)
-{
-	FILE *f;
-	unsigned int n;
-	
-	f=fopen(filename, "w");
-	if (!f) {
-		message("Error: could not write velocities to %s.\n", filename);
-		return;
-	}
-	
-	fprintf(f,"  v.x     v.y     |v|\n");
-
-	DO_MOL {
-		fprintf(f,"%7.4f %7.4f %7.4f\n",mol[n].rv.x,mol[n].rv.y,VLen(mol[n].rv));
-	}
-
-	fclose(f);
-}
-
-void write_distances(const char *filename)
-{
-	FILE *f;
-	VecR dr;
-	double rr, rrCut;
-	int i, j;
-
-	f=fopen(filename, "w");
-	if (!f) {
-		message("Error: could not write distances to %s.\n", filename);
-		return;
-	}
-
-	rrCut = Sqr (0.5 * Min(region.x, region.y));
-	for (i = 0; i < nMol; i++) {
-		for (j = 0; j < nMol; j++) {
-			if (j == i) continue;
-			VSub(dr, mol[i].r, mol[j].r);
-			VWrapAll(dr);
-			rr = VLenSq(dr);
-			if (rr < rrCut) {
-				fprintf(f,"%7.4f\n", sqrt(rr));
-			}
-		}
-	}
-
-	fclose(f);
+	message("       initial lattice (initLattice) = %4d\n", initLattice);
+	message("                 molecules (initMol) = %d\n", initMol);
+	message("              huge pages (hugePages) = %4d\n", hugePages);
+	message("                  threads (nThreads) = %4d\n", nThreads);
+	message("            pin threads (pinThreads) = %4d\n", pinThreads);
+	message("       balance every (balancePeriod) = %4d\n", balancePeriod);
+	message("              random seed (randSeed) = %d\n", randSeed);
+	message("       reproducible sums (reproSums) = %4d\n", reproSums);
+	message("               trajectory (trajName) = %s\n", trajName[0] ? trajName : "(none)");
+	message("            frame every (trajPeriod) = %4d\n", trajPeriod);
+	message("     key frame every (trajKeyPeriod) = %4d\n", trajKeyPeriod);
+	message("        grid spacing (trajPrecision) = %g\n", trajPrecision);
+	message("   velocity quantum (trajVelQuantum) = %g\n", trajVelQuantum);
+	message("        coding threads (trajThreads) = %4d\n", trajThreads);
+	message("                    cache (cacheDir) = %s\n", cacheDir[0] ? cacheDir : "(none)");
+	message("         settling steps (cacheEquil) = %4d\n", cacheEquil);
+	message("       cache final state (cacheSave) = %4d\n", cacheSave);
+	message("             shared memory (shmName) = %s\n", shmName[0] ? shmName : "(none)");
+	message("            export every (shmPeriod) = %4d\n", shmPeriod);
+	message("        correlate every (corrPeriod) = %4d\n", corrPeriod);
+	message("      correlator levels (corrLevels) = %4d\n", corrLevels);
+	message("        MSD sample every (msdPeriod) = %4d\n", msdPeriod);
+	message("               S(k) every (skPeriod) = %4d\n", skPeriod);
+	message("                  S(k) grid (skGrid) = %4d\n", skGrid);
+	message("      clusters every (clusterPeriod) = %4d\n", clusterPeriod);
+	message("      bonding distance (clusterDist) = %.6f\n", clusterDist);
+	message("              psi6 every (hexPeriod) = %4d\n", hexPeriod);
+	message("            psi6 neighbours (hexCut) = %.6f\n", hexCut);
+	message("              g6(r) range (hexRange) = %.6f\n", hexRange);
+	message("                replicas (nReplicas) = %4d\n", nReplicas);
+	message("          swap every (replicaPeriod) = %4d\n", replicaPeriod);
+	message("       top temperature (replicaTMax) = %.6f\n", replicaTMax);
+	message("              shear rate (shearRate) = %.6f\n", shearRate);
+	message("              hard discs (hardDisks) = %4d\n", hardDisks);
 }
@@ -5,6 +5,8 @@
 #define __SIMULATION_H__
 
 #include "in_vdefs.h"
+#include "in_mddefs.h"
+#include "logger.h"
 
 /*
  * Simulation constants
@@ -18,8 +20,46 @@ extern unsigned int n_t_steps;
 
 extern VecI initUcell;
 extern double deltaT, density, rCut, rMin, temperature, timeNow, uSum, velMag, vvSum;
-extern int nMol, stepAvg, stepCount, stepLimit;
+extern int nMol, stepAvg, stepCount, stepLimit, stepSample;
+// Molecules on all ranks, those of this rank (the first nMolOwn of mol[],
+// the rest up to nMol are ghosts) and the room in mol[], see domain.h;
+// with a single rank all are nMol
+extern int nMolAll, nMolOwn, nMolMax;
 extern double virSum;
+extern int hugePages, nThreads, pinThreads;
+// Random seed, 0 to take one from the clock, and whether the sums are
+// independent of the number of threads, see SumProps()
+extern int randSeed, reproSums;
+// Standard error of the means at which a run stops early, 0 for never;
+// see Converged()
+extern double stopError;
+
+// Whether the current step samples the observables; set forceSample to
+// have the next step sample them all
+extern int sampleStep, forceSample;
+
+/*
+ * Simulation state, shared with the analysis and output modules
+ */
+typedef struct {
+	VecR r, rv, ra;
+} Mol;
+
+extern Mol *mol;
+extern VecI *molImage;
+extern VecR region, vSum;
+
+extern Prop kinEnergy, totEnergy;
+extern Prop pressure;
+extern Prop pressure_xx, pressure_xy, pressure_yx, pressure_yy;
+
+// Cell subdivision, see BuildCells()
+extern VecI cells;
+extern int *cellList;
+
+// Called by VisitPairs() for a pair of molecules j1, j2 at squared distance
+// rr, with dr = r(j1) - r(j2)
+typedef void (*PairVisitor) (int j1, int j2, VecR *dr, double rr, void *arg);
 
 
 /*
@@ -32,8 +72,15 @@ double get_y_region(void);
 
 void   simulation_init(void);
 void   simulation_run(void);
+int    simulation_steps(int nSteps);
 void   simulation_step(void);
+void   simulation_report(void);
 
+void   Decompose (void);
+void   SetTimeStep (double dt);
+void   BuildCells (void);
+int    CellRow (VecR *r);
+void   VisitPairs (int tid, double rc, PairVisitor visit, void *arg);
 void   AccumProps (int icode);
 void   PrintSummaryHeader(void);
 void   PrintSummary(void);
@@ -47,7 +94,6 @@ extern unsigned int disc_size, drawing_period;
 
 void discs_clear(void);
 void discs_draw(void);
-void message(const char *msg, ...);
 void gui_simulation_step(void);
 
 void gui_draw_begin(void);
@@ -0,0 +1,73 @@
+/*
+ * Triple-buffered snapshots of the particle positions and velocities
+ *
+ * Of the three buffers one is written by the integrator, one is being read
+ * by the consumer and the third holds the latest complete frame. Publishing
+ * swaps the written buffer with the middle one in a single atomic exchange;
+ * the SNAP_FRESH bit tells the consumer the middle buffer is newer than the
+ * one it has.
+ */
+#include <stdlib.h>
+
+#include "in_vdefs.h"
+#include "in_mddefs.h"
+#include "simulation.h"
+#include "threads.h"
+#include "snapshot.h"
+
+#define SNAP_INDEX  3
+#define SNAP_FRESH  4
+
+Snapshot snapBuf[3];
+int snapWrite, snapMiddle, snapRead;
+
+
+// Allocate the buffers for the current number of molecules
+void SnapshotInit (Arena *a)
+{
+	int k;
+
+	for (k = 0; k < 3; k ++) {
+		AllocMemArena (a, snapBuf[k].r, nMolMax, VecR);
+		AllocMemArena (a, snapBuf[k].rv, nMolMax, VecR);
+		snapBuf[k].nMol = 0;
+	}
+	snapWrite = 0;
+	snapMiddle = 1;
+	snapRead = 2;
+}
+
+// Copy the molecules of thread tid
+static void SnapshotCopy (int tid)
+{
+	VecR *r = snapBuf[snapWrite].r, *rv = snapBuf[snapWrite].rv;
+	int n;
+
+	DO_MOL_OF (tid) {
+		r[n] = mol[n].r;
+		rv[n] = mol[n].rv;
+	}
+}
+
+// Make the current state available to the consumer
+void SnapshotPublish (void)
+{
+	Snapshot *s = &snapBuf[snapWrite];
+
+	ThreadsRun (SnapshotCopy);
+	s->region = region;
+	s->nMol = nMolOwn;
+	s->stepCount = stepCount;
+	s->timeNow = timeNow;
+	snapWrite = AtomicExchange (&snapMiddle, snapWrite | SNAP_FRESH) & SNAP_INDEX;
+}
+
+// Return: the most recently published snapshot, *fresh tells whether it
+// is newer than the one returned by the previous call. The snapshot stays
+// valid until the next call. Only one thread may call this.
+Snapshot *SnapshotAcquire (int *fresh)
+{
+	*fresh = (AtomicLoad (&snapMiddle) & SNAP_FRESH) != 0;
+	if (*fresh) snapRead = AtomicExchange (&snapMiddle, snapRead) & SNAP_INDEX;
+	return &snapBuf[snapRead];
+}
@@ -0,0 +1,26 @@
+/*
+ * Triple-buffered snapshots of the particle positions and velocities
+ *
+ * The integrator publishes a copy of its state with SnapshotPublish(),
+ * a single consumer (e.g. a drawing thread) picks up the most recent one
+ * with SnapshotAcquire(). Neither side ever waits for the other, and the
+ * consumer never sees a frame that is still being written.
+ */
+#ifndef __MD_SNAPSHOT_H__
+#define __MD_SNAPSHOT_H__
+
+#include "in_vdefs.h"
+#include "arena.h"
+
+typedef struct {
+	VecR *r, *rv;    // positions and velocities of the molecules
+	VecR region;
+	int nMol, stepCount;
+	double timeNow;
+} Snapshot;
+
+void      SnapshotInit (Arena *a);
+void      SnapshotPublish (void);
+Snapshot *SnapshotAcquire (int *fresh);
+
+#endif /* __MD_SNAPSHOT_H__ */
@@ -0,0 +1,239 @@
+/*
+ * Steering a run
+ *
+ * The queue is a ring of STEER_QUEUE commands under steerLock; steerQueued
+ * counts them and is read without the lock. Commands are taken out one at
+ * a time and applied after the lock is released, so posting never waits
+ * for a command that rescales all velocities.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "in_vdefs.h"
+#include "in_mddefs.h"
+#include "threads.h"
+#include "simulation.h"
+#include "snapshot.h"
+#include "shmexport.h"
+#include "trajectory.h"
+#include "transport.h"
+#include "replica.h"
+#include "harddisk.h"
+#include "domain.h"
+#include "steer.h"
+
+typedef struct {
+	int cmd;
+	double value;
+} SteerCommand;
+
+// Command names for SteerParse(), by number, and whether they take a value
+static const char *steerName[] = {
+	"temperature", "deltaT", "stepAvg", "stepSample", "trajPeriod",
+	"pause", "resume", "snapshot", "stop"
+};
+static const int steerHasValue[] = { 1, 1, 1, 1, 1, 0, 0, 0, 0 };
+
+#define N_STEER  (sizeof (steerName) / sizeof (steerName[0]))
+
+SteerCommand steerQueue[STEER_QUEUE];
+int steerHead, steerQueued, steerUp;
+int steerPaused;
+Mutex steerLock;
+
+// Sums of v^2 of each thread and the velocity factor, for the threads
+static double steerVv[MAX_THREADS], steerFac;
+
+
+// Set up the queue, or empty it: commands meant for the previous system
+// are dropped. simulation_init() does this
+void SteerInit (void)
+{
+	if (!steerUp) {
+		MutexInit (&steerLock);
+		steerUp = 1;
+	}
+	MutexLock (&steerLock);
+	steerHead = 0;
+	AtomicStore (&steerQueued, 0);
+	MutexUnlock (&steerLock);
+	steerPaused = 0;
+}
+
+// Queue command cmd (one of STEER_*) with value, from any thread.
+// Return: 0 on success, -1 if the queue is full or not set up
+int SteerPost (int cmd, double value)
+{
+	SteerCommand *c;
+
+	if (!steerUp) return -1;
+	MutexLock (&steerLock);
+	if (steerQueued == STEER_QUEUE) {
+		MutexUnlock (&steerLock);
+		return -1;
+	}
+	c = &steerQueue[(steerHead + steerQueued) % STEER_QUEUE];
+	c->cmd = cmd;
+	c->value = value;
+	AtomicAdd (&steerQueued, 1);
+	MutexUnlock (&steerLock);
+	return 0;
+}
+
+// Post the command in text, a name and a value if it takes one.
+// Return: 0 on success, -1 if it is not understood or cannot be queued
+int SteerParse (const char *text)
+{
+	char name[32];
+	double value = 0.;
+	unsigned int k;
+	int n;
+
+	n = sscanf (text, "%31s %lf", name, &value);
+	if (n < 1) return -1;
+	for (k = 0; k < N_STEER; k ++) {
+		if (strcmp (name, steerName[k]) != 0) continue;
+		if (steerHasValue[k] && n < 2) return -1;
+		return SteerPost (k, value);
+	}
+	return -1;
+}
+
+static void SumVv (int tid)
+{
+	double vv = 0.;
+	int n;
+
+	DO_MOL_OF (tid) vv += VLenSq (mol[n].rv);
+	steerVv[tid] = vv;
+}
+
+static void ScaleVels (int tid)
+{
+	int n;
+
+	DO_MOL_OF (tid) VScale (mol[n].rv, steerFac);
+}
+
+// Rescale the velocities to temperature t and make that the target
+static void SetTemperature (double t)
+{
+	double vv;
+	int k;
+
+	if (hardDisks || nReplicas > 1) {
+		LogWarn("Warning: the temperature cannot be changed during a run of %s\n",
+			hardDisks ? "hard discs" : "replicas");
+		return;
+	}
+	temperature = t;
+	velMag = sqrt (n_dimensions * (1. - 1. / nMolAll) * temperature);
+	ThreadsRun (SumVv);
+	vv = 0.;
+	for (k = 0; k < nThreadsUsed; k ++) vv += steerVv[k];
+	DomainSum (&vv, 1);
+	if (vv <= 0.) return;
+	steerFac = velMag * sqrt (nMolAll / vv);
+	ThreadsRun (ScaleVels);
+}
+
+static void Apply (SteerCommand *c)
+{
+	int n = (int) c->value;
+
+	switch (c->cmd) {
+	case STEER_TEMPERATURE:
+		if (c->value <= 0.) break;
+		SetTemperature (c->value);
+		message("Step %d: temperature %.6f\n", stepCount, temperature);
+		return;
+	case STEER_DELTA_T:
+		if (c->value <= 0.) break;
+		// The correlators have a time axis of lags in units of deltaT
+		if (msdPeriod || corrPeriod) {
+			LogWarn("Warning: the time step cannot be changed while the MSD or the "
+				"correlations are sampled, ignored\n");
+			return;
+		}
+		SetTimeStep (c->value);
+		message("Step %d: time step %.6f, the means and errors start again\n",
+			stepCount, deltaT);
+		return;
+	case STEER_STEP_AVG:
+		if (n < 0) break;
+		stepAvg = n;
+		return;
+	case STEER_STEP_SAMPLE:
+		if (n < 1) break;
+		stepSample = n;
+		return;
+	case STEER_TRAJ_PERIOD:
+		if (n < 0) break;
+		trajPeriod = n;
+		return;
+	case STEER_PAUSE:
+		if (!steerPaused) message("Step %d: paused\n", stepCount);
+		steerPaused = 1;
+		return;
+	case STEER_RESUME:
+		if (steerPaused) message("Step %d: resumed\n", stepCount);
+		steerPaused = 0;
+		return;
+	case STEER_SNAPSHOT:
+		// Trajectory frames stay on the trajPeriod grid, the analysis
+		// expects them evenly spaced
+		SnapshotPublish ();
+		ShmExportPublish ();
+		message("Step %d: snapshot taken\n", stepCount);
+		return;
+	case STEER_STOP:
+		AtomicStore (&running, 0);
+		steerPaused = 0;
+		return;
+	}
+	LogWarn("Warning: %s %g is out of range, ignored\n", steerName[c->cmd], c->value);
+}
+
+// Take the oldest command out of the queue into *c.
+// Return: 1 if there was one, 0 otherwise
+static int Take (SteerCommand *c)
+{
+	if (!AtomicLoad (&steerQueued)) return 0;
+	MutexLock (&steerLock);
+	if (!steerQueued) {
+		MutexUnlock (&steerLock);
+		return 0;
+	}
+	*c = steerQueue[steerHead];
+	steerHead = (steerHead + 1) % STEER_QUEUE;
+	AtomicAdd (&steerQueued, -1);
+	MutexUnlock (&steerLock);
+	return 1;
+}
+
+// Apply the commands queued so far, between two steps; while paused, wait
+// here for more until resumed or stopped
+void SteerPoll (void)
+{
+	SteerCommand c;
+
+	if (!AtomicLoad (&steerQueued) && !steerPaused) return;
+	for (;;) {
+		while (Take (&c)) Apply (&c);
+		if (!AtomicLoad (&running)) steerPaused = 0;
+		if (!steerPaused) return;
+		ThreadSleep (STEER_PAUSE_POLL);
+	}
+}
+
+// Apply the commands left in the queue when a run has ended, so none of
+// them waits for the next run; there is nothing to pause then
+void SteerFlush (void)
+{
+	SteerCommand c;
+
+	if (!steerUp) return;
+	while (Take (&c)) Apply (&c);
+	steerPaused = 0;
+}
@@ -0,0 +1,52 @@
+/*
+ * Steering a run
+ *
+ * Commands posted from any thread (the GUI, a thread reading the terminal,
+ * a program using md_api) are queued and applied by the simulation between
+ * two steps, so a run can be changed as it goes instead of starting afresh:
+ *
+ *   temperature T  rescale the velocities to temperature T, the new target
+ *   deltaT dt      go on with time step dt; the blocking errors start
+ *                  again, and it is refused while the MSD or the
+ *                  correlations are sampled
+ *   stepAvg n      summary every n steps
+ *   stepSample n   sample the observables every n steps
+ *   trajPeriod n   trajectory frame every n steps, if one is written
+ *   pause, resume  hold the run between two steps, and let it go on
+ *   snapshot       hand the state to the display and shared memory now
+ *   stop           end the run after the current step
+ *
+ * SteerParse() reads a command from text like the above. simulation_init()
+ * drops the commands still queued, and SteerFlush() applies them at once
+ * when a run ends. Posting takes a lock; the simulation only reads an
+ * atomic count on every step and takes the lock when something is queued.
+ * Temperature changes are ignored for hard discs and replica exchange,
+ * which have dynamics of their own.
+ */
+#ifndef __MD_STEER_H__
+#define __MD_STEER_H__
+
+#define STEER_TEMPERATURE  0
+#define STEER_DELTA_T      1
+#define STEER_STEP_AVG     2
+#define STEER_STEP_SAMPLE  3
+#define STEER_TRAJ_PERIOD  4
+#define STEER_PAUSE        5
+#define STEER_RESUME       6
+#define STEER_SNAPSHOT     7
+#define STEER_STOP         8
+
+// Commands that can wait in the queue, and ms between looks while paused
+#define STEER_QUEUE       64
+#define STEER_PAUSE_POLL  10
+
+// Whether the run is held by a pause command
+extern int steerPaused;
+
+void SteerInit (void);
+int  SteerPost (int cmd, double value);
+int  SteerParse (const char *text);
+void SteerPoll (void);
+void SteerFlush (void);
+
+#endif /* __MD_STEER_H__ */
@@ -0,0 +1,288 @@
+/*
+ * Static structure factor
+ *
+ * With cloud-in-cell assignment every particle is shared among the four
+ * nearest grid points, which multiplies rho(k) by W(k), the product over
+ * the directions of sinc^2(k h / 2) for grid spacing h; dividing |rho(k)|^2
+ * by W(k)^2 undoes that. Aliasing is kept small by using only k up to 2/3
+ * of the Nyquist wave number of the grid.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "in_vdefs.h"
+#include "in_mddefs.h"
+#include "threads.h"
+#include "simulation.h"
+#include "fft.h"
+#include "structure.h"
+
+// Inputs: steps between samples (0 for none) and grid points along x,
+// 0 for SkGridPoints()
+int skPeriod = 0, skGrid = 0;
+
+// The sampler: the engine copies the positions to skPos when the S(k)
+// thread is idle, and the thread adds them to sk
+StructureFactor sk;
+VecR *skPos;
+int skN, skBusy, skQuit, skSkipped, skThreadUp, skLockUp;
+Thread skThread;
+Mutex skLock;
+Cond skCond;
+
+
+// Set up for grid points along x (along y so that the spacing is about the
+// same) in a box of size region, taking the memory from arena a
+void StructureInit (StructureFactor *sf, Arena *a, int grid, VecR region)
+{
+	double kMax;
+
+	sf->region = region;
+	sf->grid.x = FftSize (grid);
+	sf->grid.y = FftSize ((int) (grid * region.y / region.x + 0.5));
+	kMax = 2. / 3. * M_PI * Min (sf->grid.x / region.x, sf->grid.y / region.y);
+	sf->dk = 2. * M_PI / Max (region.x, region.y);
+	sf->nBin = (int) (kMax / sf->dk) + 1;
+	AllocMemArena (a, sf->rho, 2 * VProd (sf->grid), double);
+	AllocMemArena (a, sf->sSum, sf->nBin, double);
+	AllocMemArena (a, sf->kSum, sf->nBin, double);
+	AllocMemArena (a, sf->nSum, sf->nBin, double);
+	StructureZero (sf);
+}
+
+void StructureZero (StructureFactor *sf)
+{
+	int b;
+
+	for (b = 0; b < sf->nBin; b ++) sf->sSum[b] = sf->kSum[b] = sf->nSum[b] = 0.;
+	sf->nSample = 0;
+}
+
+// sin(x) / x
+static double Sinc (double x)
+{
+	return fabs (x) < 1e-8 ? 1. : sin (x) / x;
+}
+
+// Add the S(k) of the n particles at r
+void StructureAdd (StructureFactor *sf, VecR *r, int n)
+{
+	VecI g = sf->grid, c, m;
+	VecR h, u, f, k;
+	double *rho = sf->rho, kMax, kk, w, s;
+	int j, b, x0, x1, y0, y1;
+
+	VDiv (h, sf->region, g);
+	memset (rho, 0, 2 * VProd (g) * sizeof (double));
+	for (j = 0; j < n; j ++) {
+		// Position in grid units in [0, g), and the fraction past point c
+		VSAdd (u, r[j], 0.5, sf->region);
+		VDiv (u, u, h);
+		c.x = (int) floor (u.x);
+		c.y = (int) floor (u.y);
+		VSet (f, u.x - c.x, u.y - c.y);
+		x0 = (c.x % g.x + g.x) % g.x;
+		y0 = (c.y % g.y + g.y) % g.y;
+		x1 = (x0 + 1) % g.x;
+		y1 = (y0 + 1) % g.y;
+		rho[2 * (y0 * g.x + x0)] += (1. - f.x) * (1. - f.y);
+		rho[2 * (y0 * g.x + x1)] += f.x * (1. - f.y);
+		rho[2 * (y1 * g.x + x0)] += (1. - f.x) * f.y;
+		rho[2 * (y1 * g.x + x1)] += f.x * f.y;
+	}
+	Fft2D (rho, g.x, g.y);
+
+	kMax = sf->nBin * sf->dk;
+	for (c.y = 0; c.y < g.y; c.y ++) {
+		m.y = c.y < g.y / 2 ? c.y : c.y - g.y;
+		k.y = 2. * M_PI * m.y / sf->region.y;
+		for (c.x = 0; c.x < g.x; c.x ++) {
+			m.x = c.x < g.x / 2 ? c.x : c.x - g.x;
+			k.x = 2. * M_PI * m.x / sf->region.x;
+			kk = VLen (k);
+			if ((m.x == 0 && m.y == 0) || kk >= kMax) continue;
+			w = Sqr (Sinc (0.5 * k.x * h.x) * Sinc (0.5 * k.y * h.y));
+			s = (Sqr (rho[2 * (c.y * g.x + c.x)]) + Sqr (rho[2 * (c.y * g.x + c.x) + 1])) /
+				(Sqr (w) * n);
+			b = (int) (kk / sf->dk);
+			sf->sSum[b] += s;
+			sf->kSum[b] += kk;
+			sf->nSum[b] += 1.;
+		}
+	}
+	++ sf->nSample;
+}
+
+// Add the S(k) of the n particles at r summed over them directly, for the
+// same k vectors and shells as StructureAdd(); n times the work per k, for
+// checking the assignment and the transform
+void StructureDirect (StructureFactor *sf, VecR *r, int n)
+{
+	VecI g = sf->grid, c, m;
+	VecR k;
+	double kMax, kk, re, im, phase;
+	int j, b;
+
+	kMax = sf->nBin * sf->dk;
+	for (c.y = 0; c.y < g.y; c.y ++) {
+		m.y = c.y < g.y / 2 ? c.y : c.y - g.y;
+		k.y = 2. * M_PI * m.y / sf->region.y;
+		for (c.x = 0; c.x < g.x; c.x ++) {
+			m.x = c.x < g.x / 2 ? c.x : c.x - g.x;
+			k.x = 2. * M_PI * m.x / sf->region.x;
+			kk = VLen (k);
+			if ((m.x == 0 && m.y == 0) || kk >= kMax) continue;
+			re = im = 0.;
+			for (j = 0; j < n; j ++) {
+				phase = VDot (k, r[j]);
+				re += cos (phase);
+				im += sin (phase);
+			}
+			b = (int) (kk / sf->dk);
+			sf->sSum[b] += (Sqr (re) + Sqr (im)) / n;
+			sf->kSum[b] += kk;
+			sf->nSum[b] += 1.;
+		}
+	}
+	++ sf->nSample;
+}
+
+// Write the averaged S(k) to a file, and give the position and height of
+// its highest peak.
+// Return: 0 on success, -1 if the file could not be written
+int StructureWrite (StructureFactor *sf, const char *filename, double *kPeak, double *sPeak)
+{
+	FILE *f;
+	double s;
+	int b;
+
+	*kPeak = *sPeak = 0.;
+	for (b = 0; b < sf->nBin; b ++) {
+		if (sf->nSum[b] == 0.) continue;
+		s = sf->sSum[b] / sf->nSum[b];
+		if (s > *sPeak) {
+			*sPeak = s;
+			*kPeak = sf->kSum[b] / sf->nSum[b];
+		}
+	}
+	if (!(f = fopen (filename, "w"))) return -1;
+	fprintf (f, "   k         S(k)        vectors\n");
+	for (b = 0; b < sf->nBin; b ++) {
+		if (sf->nSum[b] == 0.) continue;
+		fprintf (f, "%9.4f %11.4e %8.0f\n", sf->kSum[b] / sf->nSum[b],
+			sf->sSum[b] / sf->nSum[b], sf->nSum[b] / Max (sf->nSample, 1));
+	}
+	fclose (f);
+	return 0;
+}
+
+
+/*
+ * Sampling during a run
+ */
+// Grid points along x for a box of size region: skGrid, or for 0 a grid
+// spacing of about SK_SPACING (but at most SK_GRID_MAX points)
+int SkGridPoints (VecR region)
+{
+	return skGrid ? skGrid : Min ((int) (region.x / SK_SPACING), SK_GRID_MAX);
+}
+
+// Add every sample handed over, until told to quit with none pending
+static void SkThread (void *arg)
+{
+	MutexLock (&skLock);
+	for (;;) {
+		while (!skBusy && !skQuit) CondWait (&skCond, &skLock);
+		if (!skBusy) break;
+		MutexUnlock (&skLock);
+		StructureAdd (&sk, skPos, skN);
+		MutexLock (&skLock);
+		AtomicStore (&skBusy, 0);
+		CondBroadcast (&skCond);
+	}
+	MutexUnlock (&skLock);
+}
+
+// Let the S(k) thread finish its last sample and join it
+static void SkStop (void)
+{
+	if (!skThreadUp) return;
+	MutexLock (&skLock);
+	skQuit = 1;
+	CondBroadcast (&skCond);
+	MutexUnlock (&skLock);
+	ThreadJoin (skThread);
+	skThreadUp = skQuit = 0;
+}
+
+static void SkStart (void)
+{
+	if (!skLockUp) {
+		MutexInit (&skLock);
+		CondInit (&skCond);
+		skLockUp = 1;
+	}
+	if (ThreadCreate (&skThread, SkThread, NULL) != 0) {
+		LogError("Error: could not start the S(k) thread\n");
+		return;
+	}
+	skThreadUp = 1;
+}
+
+// Set up for the current system, taking the memory from arena a
+void SkSamplerInit (Arena *a)
+{
+	int grid;
+
+	SkStop ();
+	skSkipped = 0;
+	if (!skPeriod) return;
+	grid = SkGridPoints (region);
+	StructureInit (&sk, a, grid, region);
+	AllocMemArena (a, skPos, nMol, VecR);
+	SkStart ();
+	message("S(k) on a %d x %d grid%s, k up to %.2f\n", sk.grid.x, sk.grid.y,
+		sk.grid.x != grid ? " (rounded up to powers of 2)" : "", sk.nBin * sk.dk);
+}
+
+static void SkCopy (int tid)
+{
+	int n;
+
+	DO_MOL_OF (tid) skPos[n] = mol[n].r;
+}
+
+// Hand the current positions to the S(k) thread, unless it is still busy
+// with the previous ones
+void SkSamplerSample (void)
+{
+	if (!skThreadUp) return;
+	if (AtomicLoad (&skBusy)) {
+		++ skSkipped;
+		return;
+	}
+	ThreadsRun (SkCopy);
+	skN = nMol;
+	MutexLock (&skLock);
+	AtomicStore (&skBusy, 1);
+	CondSignal (&skCond);
+	MutexUnlock (&skLock);
+}
+
+// Wait for the last sample, joining the S(k) thread, and write the
+// averaged S(k); a run continued afterwards gets a new thread
+void SkSamplerReport (const char *filename)
+{
+	double kPeak, sPeak;
+
+	if (!skPeriod || !skThreadUp) return;
+	SkStop ();
+	SkStart ();
+	if (StructureWrite (&sk, filename, &kPeak, &sPeak) != 0) {
+		LogError("Error: could not write S(k) to %s.\n", filename);
+		return;
+	}
+	message("S(k) over %d samples (%d skipped): peak %.3f at k = %.3f\n",
+		sk.nSample, skSkipped, sPeak, kPeak);
+}
@@ -0,0 +1,42 @@
+/*
+ * Static structure factor
+ *
+ * S(k) = |rho(k)|^2 / N from the particle density assigned to a periodic
+ * grid (cloud in cell), transformed by FFT, corrected for the assignment
+ * and averaged over shells of |k|. During a run a sample is taken every
+ * skPeriod steps and worked out on a thread of its own.
+ */
+#ifndef __MD_STRUCTURE_H__
+#define __MD_STRUCTURE_H__
+
+#include "in_vdefs.h"
+#include "arena.h"
+
+extern int skPeriod, skGrid;
+
+// With this spacing k goes up to about 10, beyond the main peak near 2 pi
+#define SK_SPACING   0.2
+#define SK_GRID_MAX  4096
+
+typedef struct {
+	VecI grid;          // grid points in each direction, powers of 2 (rounded up)
+	VecR region;
+	int nBin;           // shells of width dk, up to 2/3 of the grid's Nyquist k
+	double dk;
+	double *rho;        // [grid.y][grid.x] complex
+	double *sSum, *kSum, *nSum;  // [nBin] sums of S, |k| and count
+	int nSample;
+} StructureFactor;
+
+void StructureInit (StructureFactor *sf, Arena *a, int grid, VecR region);
+void StructureZero (StructureFactor *sf);
+void StructureAdd (StructureFactor *sf, VecR *r, int n);
+void StructureDirect (StructureFactor *sf, VecR *r, int n);
+int  StructureWrite (StructureFactor *sf, const char *filename, double *kPeak, double *sPeak);
+
+int  SkGridPoints (VecR region);
+void SkSamplerInit (Arena *a);
+void SkSamplerSample (void);
+void SkSamplerReport (const char *filename);
+
+#endif /* __MD_STRUCTURE_H__ */
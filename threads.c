@@ -0,0 +1,434 @@
+/*
+ * Worker threads and thread placement
+ *
+ * Threads are placed according to the spatial decomposition: thread t owns
+ * the t-th slab of cell rows, and consecutive slabs are put on the same NUMA
+ * node so that most neighbouring cells are read from local memory.
+ */
+#ifndef _WINDOWS
+#	define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifndef _WINDOWS
+#	include <sched.h>
+#	include <unistd.h>
+#endif
+
+#include "in_vdefs.h"
+#include "simulation.h"
+#include "threads.h"
+
+// Maximum number of NUMA nodes we keep track of
+#define MAX_NODES  64
+
+int        nThreadsUsed = 1;
+ThreadInfo threadInfo[MAX_THREADS];
+
+// Processors we may run on, ordered by NUMA node
+int cpuOrder[MAX_CPUS], nCpus;
+int nodeFirst[MAX_NODES], nodeCount[MAX_NODES], nNodes;
+
+// The worker pool; thread 0 is whoever calls ThreadsRun()
+Thread   worker[MAX_THREADS];
+Mutex    poolLock;
+Cond     poolStart, poolDone;
+void   (*poolFunc) (int tid);
+unsigned poolGen, poolGenInit;
+int      poolBusy, poolQuit, poolSize = 1;
+
+// Whether the thread calling ThreadsRun() is pinned too: only a program
+// that owns it (main-cli, md-analyse) sets this, a host program such as
+// the GUI or Python keeps the affinity of its own thread
+int      pinCaller = 0;
+
+#ifdef _WINDOWS
+DWORD    pinnedCaller;
+#else
+pthread_t pinnedCaller;
+int      havePinnedCaller;
+#endif
+
+
+/*
+ * Portable threads, mutexes and condition variables
+ */
+typedef struct {
+	void (*func) (void *);
+	void *arg;
+} ThreadStart;
+
+#ifdef _WINDOWS
+
+static DWORD WINAPI ThreadEntry (LPVOID p)
+{
+	ThreadStart s = *(ThreadStart *) p;
+
+	free (p);
+	s.func (s.arg);
+	return 0;
+}
+
+int ThreadCreate (Thread *t, void (*func) (void *), void *arg)
+{
+	ThreadStart *s;
+
+	if (!(s = malloc (sizeof (ThreadStart)))) return -1;
+	s->func = func;
+	s->arg = arg;
+	*t = CreateThread (NULL, 0, ThreadEntry, s, 0, NULL);
+	if (*t) return 0;
+	free (s);
+	return -1;
+}
+
+void ThreadJoin (Thread t)
+{
+	WaitForSingleObject (t, INFINITE);
+	CloseHandle (t);
+}
+
+void ThreadSleep (int ms)
+{
+	Sleep (ms);
+}
+
+double WallClock (void)
+{
+	LARGE_INTEGER t, f;
+
+	QueryPerformanceCounter (&t);
+	QueryPerformanceFrequency (&f);
+	return (double) t.QuadPart / f.QuadPart;
+}
+
+void MutexInit (Mutex *m)         { InitializeCriticalSection (m); }
+void MutexFree (Mutex *m)         { DeleteCriticalSection (m); }
+void MutexLock (Mutex *m)         { EnterCriticalSection (m); }
+void MutexUnlock (Mutex *m)       { LeaveCriticalSection (m); }
+void CondInit (Cond *c)           { InitializeConditionVariable (c); }
+void CondFree (Cond *c)           { }
+void CondWait (Cond *c, Mutex *m) { SleepConditionVariableCS (c, m, INFINITE); }
+void CondSignal (Cond *c)         { WakeConditionVariable (c); }
+void CondBroadcast (Cond *c)      { WakeAllConditionVariable (c); }
+
+#else
+
+static void *ThreadEntry (void *p)
+{
+	ThreadStart s = *(ThreadStart *) p;
+
+	free (p);
+	s.func (s.arg);
+	return NULL;
+}
+
+int ThreadCreate (Thread *t, void (*func) (void *), void *arg)
+{
+	ThreadStart *s;
+
+	if (!(s = malloc (sizeof (ThreadStart)))) return -1;
+	s->func = func;
+	s->arg = arg;
+	if (pthread_create (t, NULL, ThreadEntry, s) == 0) return 0;
+	free (s);
+	return -1;
+}
+
+void ThreadJoin (Thread t)
+{
+	pthread_join (t, NULL);
+}
+
+void ThreadSleep (int ms)
+{
+	usleep (ms * 1000);
+}
+
+double WallClock (void)
+{
+	struct timespec t;
+
+	clock_gettime (CLOCK_MONOTONIC, &t);
+	return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+void MutexInit (Mutex *m)         { pthread_mutex_init (m, NULL); }
+void MutexFree (Mutex *m)         { pthread_mutex_destroy (m); }
+void MutexLock (Mutex *m)         { pthread_mutex_lock (m); }
+void MutexUnlock (Mutex *m)       { pthread_mutex_unlock (m); }
+void CondInit (Cond *c)           { pthread_cond_init (c, NULL); }
+void CondFree (Cond *c)           { pthread_cond_destroy (c); }
+void CondWait (Cond *c, Mutex *m) { pthread_cond_wait (c, m); }
+void CondSignal (Cond *c)         { pthread_cond_signal (c); }
+void CondBroadcast (Cond *c)      { pthread_cond_broadcast (c); }
+
+#endif
+
+
+/*
+ * Topology
+ */
+
+// Fill cpuOrder/nodeFirst/nodeCount from cpuNode[], which gives the node of
+// every processor we may run on (-1 for the others)
+static void OrderCpus (const int *cpuNode, int maxCpu)
+{
+	int cpu, node;
+
+	nCpus = nNodes = 0;
+	for (node = 0; node < MAX_NODES; node ++) {
+		nodeFirst[node] = nCpus;
+		nodeCount[node] = 0;
+		for (cpu = 0; cpu < maxCpu; cpu ++) {
+			if (cpuNode[cpu] != node) continue;
+			cpuOrder[nCpus ++] = cpu;
+			++ nodeCount[node];
+		}
+		if (nodeCount[node]) nNodes = node + 1;
+	}
+}
+
+#ifdef _WINDOWS
+
+// Windows only reports the processors of our own processor group (<= 64)
+static void ReadTopology (void)
+{
+	static int cpuNode[64];
+	DWORD_PTR procMask, sysMask;
+	ULONGLONG nodeMask;
+	ULONG highest, node;
+	int cpu;
+
+	GetProcessAffinityMask (GetCurrentProcess (), &procMask, &sysMask);
+	for (cpu = 0; cpu < 64; cpu ++)
+		cpuNode[cpu] = ((procMask >> cpu) & 1) ? 0 : -1;
+	if (GetNumaHighestNodeNumber (&highest)) {
+		for (node = 0; node <= highest && node < MAX_NODES; node ++) {
+			if (!GetNumaNodeProcessorMask ((UCHAR) node, &nodeMask)) continue;
+			for (cpu = 0; cpu < 64; cpu ++) {
+				if (cpuNode[cpu] >= 0 && ((nodeMask >> cpu) & 1)) cpuNode[cpu] = node;
+			}
+		}
+	}
+	OrderCpus (cpuNode, 64);
+}
+
+static void PinThread (Thread t, int cpu)
+{
+	SetThreadAffinityMask (t, (DWORD_PTR) 1 << cpu);
+}
+
+#else
+
+// Read the processors of a node from sysfs, e.g. "0-7,16-23"
+static void ReadNodeCpus (int node, int *cpuNode)
+{
+	char name[64];
+	FILE *f;
+	int lo, hi, cpu;
+	char sep;
+
+	sprintf (name, "/sys/devices/system/node/node%d/cpulist", node);
+	if (!(f = fopen (name, "r"))) return;
+	while (fscanf (f, "%d", &lo) == 1) {
+		hi = lo;
+		if ((sep = fgetc (f)) == '-') {
+			if (fscanf (f, "%d", &hi) != 1) break;
+			sep = fgetc (f);
+		}
+		for (cpu = lo; cpu <= hi && cpu < MAX_CPUS; cpu ++) {
+			if (cpuNode[cpu] >= 0) cpuNode[cpu] = node;
+		}
+		if (sep != ',') break;
+	}
+	fclose (f);
+}
+
+static void ReadTopology (void)
+{
+	static int cpuNode[MAX_CPUS];
+	cpu_set_t set;
+	int cpu, node;
+
+	CPU_ZERO (&set);
+	if (sched_getaffinity (0, sizeof (set), &set) != 0) {
+		for (cpu = 0; cpu < sysconf (_SC_NPROCESSORS_ONLN) && cpu < CPU_SETSIZE; cpu ++)
+			CPU_SET (cpu, &set);
+	}
+	for (cpu = 0; cpu < MAX_CPUS; cpu ++)
+		cpuNode[cpu] = (cpu < CPU_SETSIZE && CPU_ISSET (cpu, &set)) ? 0 : -1;
+	for (node = 1; node < MAX_NODES; node ++) ReadNodeCpus (node, cpuNode);
+	OrderCpus (cpuNode, MAX_CPUS);
+}
+
+static void PinThread (Thread t, int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO (&set);
+	CPU_SET (cpu, &set);
+	pthread_setaffinity_np (t, sizeof (set), &set);
+}
+
+#endif
+
+// Spread the threads over the nodes in order, so that thread t (and with it
+// slab t) shares a node with the neighbouring slabs t-1 and t+1
+static void PlaceThreads (void)
+{
+	int node, t, tFirst, used[MAX_NODES], nUsed;
+
+	nUsed = 0;
+	for (node = 0; node < nNodes; node ++) {
+		if (nodeCount[node]) used[nUsed ++] = node;
+	}
+	tFirst = 0;
+	for (t = 0; t < nThreadsUsed; t ++) {
+		threadInfo[t].node = threadInfo[t].cpu = -1;
+		if (!pinThreads || nCpus == 0) continue;
+		node = used[(long) t * nUsed / nThreadsUsed];
+		if (t == 0 || node != threadInfo[t - 1].node) tFirst = t;
+		threadInfo[t].node = node;
+		threadInfo[t].cpu = cpuOrder[nodeFirst[node] + (t - tFirst) % nodeCount[node]];
+	}
+}
+
+
+/*
+ * Worker pool
+ */
+static void Worker (void *arg)
+{
+	int tid = (int) (intptr_t) arg;
+	unsigned gen;
+
+	gen = poolGenInit;
+	MutexLock (&poolLock);
+	for (;;) {
+		while (poolGen == gen && !poolQuit) CondWait (&poolStart, &poolLock);
+		if (poolQuit) break;
+		gen = poolGen;
+		MutexUnlock (&poolLock);
+
+		poolFunc (tid);
+
+		MutexLock (&poolLock);
+		if (-- poolBusy == 0) CondSignal (&poolDone);
+	}
+	MutexUnlock (&poolLock);
+}
+
+// Start the worker threads, unless the pool already has the right size
+void ThreadsInit (void)
+{
+	int t;
+
+	ReadTopology ();
+	t = nThreads > 0 ? nThreads : Max (nCpus, 1);
+	t = Min (t, MAX_THREADS);
+	if (t != poolSize) ThreadsFree ();
+	nThreadsUsed = t;
+	PlaceThreads ();
+	if (poolSize == nThreadsUsed) {
+		// Same pool, but the placement may have changed
+		for (t = 1; t < poolSize; t ++) {
+			if (threadInfo[t].cpu >= 0) PinThread (worker[t], threadInfo[t].cpu);
+		}
+		return;
+	}
+
+	MutexInit (&poolLock);
+	CondInit (&poolStart);
+	CondInit (&poolDone);
+	poolQuit = 0;
+	poolGenInit = poolGen;
+	for (t = 1; t < nThreadsUsed; t ++) {
+		if (ThreadCreate (&worker[t], Worker, (void *) (intptr_t) t) != 0) {
+			LogError("Error: could not start worker thread %d\n", t);
+			break;
+		}
+		if (threadInfo[t].cpu >= 0) PinThread (worker[t], threadInfo[t].cpu);
+	}
+	poolSize = t;
+	nThreadsUsed = t;
+}
+
+// Stop the worker threads
+void ThreadsFree (void)
+{
+	int t;
+
+	if (poolSize <= 1) return;
+	MutexLock (&poolLock);
+	poolQuit = 1;
+	CondBroadcast (&poolStart);
+	MutexUnlock (&poolLock);
+	for (t = 1; t < poolSize; t ++) ThreadJoin (worker[t]);
+	CondFree (&poolStart);
+	CondFree (&poolDone);
+	MutexFree (&poolLock);
+	poolSize = nThreadsUsed = 1;
+#ifndef _WINDOWS
+	havePinnedCaller = 0;
+#else
+	pinnedCaller = 0;
+#endif
+}
+
+// Pin the calling thread, which acts as thread 0, when it is a new one
+static void PinCaller (void)
+{
+	if (!pinCaller || threadInfo[0].cpu < 0) return;
+#ifdef _WINDOWS
+	if (pinnedCaller == GetCurrentThreadId ()) return;
+	pinnedCaller = GetCurrentThreadId ();
+	PinThread (GetCurrentThread (), threadInfo[0].cpu);
+#else
+	if (havePinnedCaller && pthread_equal (pinnedCaller, pthread_self ())) return;
+	pinnedCaller = pthread_self ();
+	havePinnedCaller = 1;
+	PinThread (pinnedCaller, threadInfo[0].cpu);
+#endif
+}
+
+void ThreadsRun (void (*func) (int tid))
+{
+	PinCaller ();
+	if (nThreadsUsed == 1) {
+		func (0);
+		return;
+	}
+
+	MutexLock (&poolLock);
+	poolFunc = func;
+	poolBusy = nThreadsUsed - 1;
+	++ poolGen;
+	CondBroadcast (&poolStart);
+	MutexUnlock (&poolLock);
+
+	func (0);
+
+	MutexLock (&poolLock);
+	while (poolBusy > 0) CondWait (&poolDone, &poolLock);
+	MutexUnlock (&poolLock);
+}
+
+// Print the topology and where each thread and its part of the system went
+void ThreadsReport (void)
+{
+	ThreadInfo *ti;
+	int t;
+
+	message("Topology: %d processor(s) on %d NUMA node(s), %d thread(s)%s\n",
+		nCpus, Max (nNodes, 1), nThreadsUsed, pinThreads ? "" : ", not pinned");
+	for (t = 0; t < nThreadsUsed; t ++) {
+		ti = &threadInfo[t];
+		message("  thread %3d: node %2d cpu %4d, molecules %8d-%8d, cell rows %5d-%5d\n",
+			t, ti->node, t == 0 && !pinCaller ? -1 : ti->cpu, ti->molLo, ti->molHi - 1, ti->rowLo, ti->rowHi - 1);
+	}
+}
@@ -0,0 +1,101 @@
+/*
+ * Worker threads and thread placement
+ */
+#ifndef __MD_THREADS_H__
+#define __MD_THREADS_H__
+
+#ifdef _WINDOWS
+#	ifndef _WIN32_WINNT
+#		define _WIN32_WINNT 0x0600  // condition variables need Vista or later
+#	endif
+#	include <windows.h>
+#else
+#	include <pthread.h>
+#endif
+
+// Maximum number of worker threads and of processors we keep track of
+#define MAX_THREADS  256
+#define MAX_CPUS     1024
+
+/*
+ * Portable threads, mutexes and condition variables
+ */
+#ifdef _WINDOWS
+typedef HANDLE             Thread;
+typedef CRITICAL_SECTION   Mutex;
+typedef CONDITION_VARIABLE Cond;
+#else
+typedef pthread_t          Thread;
+typedef pthread_mutex_t    Mutex;
+typedef pthread_cond_t     Cond;
+#endif
+
+/*
+ * Atomic operations on int, all with a full memory barrier.
+ * AtomicExchange() returns the old value, AtomicCAS() whether it succeeded.
+ * MemoryFence() orders the memory accesses before it with those after it.
+ */
+#ifdef _WINDOWS
+#	define AtomicLoad(p)          InterlockedCompareExchange ((volatile LONG *) (p), 0, 0)
+#	define AtomicStore(p, v)      (void) InterlockedExchange ((volatile LONG *) (p), (v))
+#	define AtomicExchange(p, v)   InterlockedExchange ((volatile LONG *) (p), (v))
+#	define AtomicAdd(p, v)        InterlockedExchangeAdd ((volatile LONG *) (p), (v))
+#	define AtomicCAS(p, o, v)     (InterlockedCompareExchange ((volatile LONG *) (p), (v), (o)) == (o))
+#	define MemoryFence()          MemoryBarrier ()
+#else
+#	define AtomicLoad(p)          __atomic_load_n ((p), __ATOMIC_SEQ_CST)
+#	define AtomicStore(p, v)      __atomic_store_n ((p), (v), __ATOMIC_SEQ_CST)
+#	define AtomicExchange(p, v)   __atomic_exchange_n ((p), (v), __ATOMIC_SEQ_CST)
+#	define AtomicAdd(p, v)        __atomic_fetch_add ((p), (v), __ATOMIC_SEQ_CST)
+#	define AtomicCAS(p, o, v)     __sync_bool_compare_and_swap ((p), (o), (v))
+#	define MemoryFence()          __atomic_thread_fence (__ATOMIC_SEQ_CST)
+#endif
+
+// Storage class of variables with a copy per thread
+#ifdef _WINDOWS
+#	define THREAD_LOCAL  __declspec(thread)
+#else
+#	define THREAD_LOCAL  __thread
+#endif
+
+int  ThreadCreate (Thread *t, void (*func) (void *), void *arg);
+void ThreadJoin (Thread t);
+void ThreadSleep (int ms);
+double WallClock (void);  // seconds since some fixed moment
+void MutexInit (Mutex *m);
+void MutexFree (Mutex *m);
+void MutexLock (Mutex *m);
+void MutexUnlock (Mutex *m);
+void CondInit (Cond *c);
+void CondFree (Cond *c);
+void CondWait (Cond *c, Mutex *m);
+void CondSignal (Cond *c);
+void CondBroadcast (Cond *c);
+
+/*
+ * Worker pool
+ *
+ * ThreadsRun(func) calls func(tid) on every thread tid = 0 .. nThreadsUsed-1,
+ * where the calling thread acts as thread 0, and returns when all are done.
+ * Each thread owns a range of molecules (which it initialises first, so the
+ * memory ends up on its NUMA node) and a slab of cell rows for the forces,
+ * which BalanceRows() resizes by their work.
+ */
+typedef struct {
+	int molLo, molHi;  // molecules [molLo, molHi) owned by the thread
+	int rowLo, rowHi;  // cell rows [rowLo, rowHi) owned by the thread
+	int node, cpu;     // NUMA node and processor the thread runs on, -1 if not pinned
+} ThreadInfo;
+
+extern int        nThreadsUsed;
+extern ThreadInfo threadInfo[MAX_THREADS];
+// Whether ThreadsRun() pins its caller as thread 0 (0 by default, for a
+// program that owns the thread calling it)
+extern int        pinCaller;
+
+void ThreadsInit (void);
+void ThreadsFree (void);
+void ThreadsRun (void (*func) (int tid));
+void ThreadsReport (void);
+
+#endif /* __MD_THREADS_H__ */
@@ -0,0 +1,383 @@
+/*
+ * Trajectory files, engine side
+ *
+ * TrajSample() copies the state into a free slot, already rounded to the
+ * grid when compressing, on all threads of the pool. The writer thread then
+ * codes the chunks of the slot on trajThreads threads of its own and writes
+ * the frame, while the integrator carries on.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "in_vdefs.h"
+#include "in_mddefs.h"
+#include "threads.h"
+#include "simulation.h"
+#include "shear.h"
+#include "trajectory.h"
+
+// Velocities are rounded to at most this many quanta, so that differences
+// fit in an int
+#define TRAJ_VEL_MAX  (1 << 29)
+
+// Inputs: file name (no trajectory if empty), steps between frames, frames
+// between key frames and threads for the coding; grid spacing over the
+// region size (0 for full precision) and velocity quantum (0 for no
+// velocities)
+char   trajName[TRAJ_NAME_MAX] = "";
+int    trajPeriod = 100, trajKeyPeriod = 50, trajThreads = 2;
+double trajPrecision = 0., trajVelQuantum = 0.001;
+
+typedef struct {
+	TrajHeader h;
+	void *data;        // VecR r[nMol] and rv[nMol], or int q[nMol][trajComp]
+} TrajSlot;
+
+// Slots trajHead onwards, trajQueued of them, wait for the writer thread
+TrajSlot trajSlot[TRAJ_SLOTS];
+int trajHead, trajQueued, trajThreadUp;
+Thread trajThread;
+Mutex trajLock;
+Cond trajCond;
+
+FILE *trajFile;
+// Components per molecule and grid points per side; the slot being filled
+int trajComp, trajGrid;
+TrajSlot *trajFill;
+
+// Coding: the previous frame, the chunk buffers of trajChunkMax bytes and
+// the bytes used in each, the slot being coded and its next chunk
+int *trajPrev;
+unsigned char *trajChunk;
+int *trajChunkBytes, trajChunkMax;
+TrajSlot *trajCoding;
+int trajNextChunk;
+
+// Frames sampled and written, bytes written, times the integrator waited
+int trajFrame, trajWritten, trajWaits, trajError;
+long long trajBytes;
+
+
+/*
+ * Coding
+ */
+typedef struct {
+	unsigned char *p;
+	unsigned long long acc;
+	int nBits;
+} BitWriter;
+
+// Append the n low bits of v, n at most 32
+static void PutBits (BitWriter *w, unsigned int v, int n)
+{
+	w->acc |= (unsigned long long) v << w->nBits;
+	w->nBits += n;
+	while (w->nBits >= 8) {
+		*w->p ++ = (unsigned char) w->acc;
+		w->acc >>= 8;
+		w->nBits -= 8;
+	}
+}
+
+// The quotient u >> k in unary (ones ended by a zero), then the k low bits
+static void PutRice (BitWriter *w, unsigned int u, int k)
+{
+	unsigned int q = u >> k;
+
+	if (q >= TRAJ_ESCAPE) {
+		PutBits (w, (1u << TRAJ_ESCAPE) - 1, TRAJ_ESCAPE);
+		PutBits (w, u, 32);
+		return;
+	}
+	PutBits (w, (1u << q) - 1, q + 1);
+	if (k) PutBits (w, u & ((1u << k) - 1), k);
+}
+
+// Difference of component c of molecule n from the one it is coded
+// against, the positions across the periodic boundary if that is shorter,
+// folded to an unsigned number (0, -1, 1, -2, ... to 0, 1, 2, 3, ...)
+static unsigned int Residual (const int *q, int n, int lo, int c, int key)
+{
+	int d, ref;
+
+	if (! key) ref = trajPrev[n * trajComp + c];
+	else if (n > lo) ref = q[(n - 1) * trajComp + c];
+	else ref = c < 2 ? trajGrid / 2 : 0;
+	d = q[n * trajComp + c] - ref;
+	if (c < 2) {
+		if (2 * d > trajGrid) d -= trajGrid;
+		else if (2 * d <= - trajGrid) d += trajGrid;
+	}
+	return ((unsigned int) d << 1) ^ (unsigned int) (d >> 31);
+}
+
+// Code chunk i of slot s into out.
+// Return: the bytes used
+static int CodeChunk (TrajSlot *s, int i, unsigned char *out)
+{
+	const int *q = s->data;
+	BitWriter w;
+	unsigned long long sum;
+	int c, hi, k[4], key, lo, n;
+
+	key = s->h.flags & TRAJ_KEY;
+	lo = i * TRAJ_CHUNK;
+	hi = Min (lo + TRAJ_CHUNK, s->h.nMol);
+	// The Rice parameter near the optimum for a geometric distribution,
+	// from the mean
+	for (c = 0; c < trajComp; c ++) {
+		sum = 0;
+		for (n = lo; n < hi; n ++) sum += Residual (q, n, lo, c, key);
+		sum /= hi - lo;
+		for (k[c] = 0; k[c] < 31 && sum >> (k[c] + 1); k[c] ++);
+		out[c] = (unsigned char) k[c];
+	}
+	w.p = out + trajComp;
+	w.acc = 0;
+	w.nBits = 0;
+	for (n = lo; n < hi; n ++) {
+		for (c = 0; c < trajComp; c ++) PutRice (&w, Residual (q, n, lo, c, key), k[c]);
+	}
+	if (w.nBits > 0) *w.p ++ = (unsigned char) w.acc;
+	return (int) (w.p - out);
+}
+
+static void CodeWorker (void *arg)
+{
+	int i;
+
+	while ((i = AtomicAdd (&trajNextChunk, 1)) < trajCoding->h.nChunk)
+		trajChunkBytes[i] = CodeChunk (trajCoding, i, trajChunk + (size_t) i * trajChunkMax);
+}
+
+// Code the chunks of slot s, the writer thread being one of the threads
+static void CodeFrame (TrajSlot *s)
+{
+	Thread t[MAX_THREADS];
+	int k, n;
+
+	trajCoding = s;
+	trajNextChunk = 0;
+	n = Clamp (trajThreads, 1, Min (s->h.nChunk, MAX_THREADS));
+	for (k = 1; k < n; k ++) {
+		if (ThreadCreate (&t[k], CodeWorker, NULL) != 0) break;
+	}
+	CodeWorker (NULL);
+	while (-- k > 0) ThreadJoin (t[k]);
+}
+
+
+/*
+ * Writer thread
+ */
+static void WriteFrame (TrajSlot *s)
+{
+	size_t size;
+	int i, ok;
+
+	if (! (s->h.flags & TRAJ_QUANTISED)) {
+		size = (size_t) s->h.nMol * sizeof (VecR) * (s->h.flags & TRAJ_VEL ? 2 : 1);
+		s->h.bytes = size;
+		ok = fwrite (&s->h, sizeof (TrajHeader), 1, trajFile) == 1 &&
+			fwrite (s->data, 1, size, trajFile) == size;
+	} else {
+		CodeFrame (s);
+		s->h.bytes = (long long) s->h.nChunk * sizeof (int);
+		for (i = 0; i < s->h.nChunk; i ++) s->h.bytes += trajChunkBytes[i];
+		ok = fwrite (&s->h, sizeof (TrajHeader), 1, trajFile) == 1 &&
+			fwrite (trajChunkBytes, sizeof (int), s->h.nChunk, trajFile) == (size_t) s->h.nChunk;
+		for (i = 0; ok && i < s->h.nChunk; i ++) {
+			ok = fwrite (trajChunk + (size_t) i * trajChunkMax, 1, trajChunkBytes[i],
+				trajFile) == (size_t) trajChunkBytes[i];
+		}
+		memcpy (trajPrev, s->data, (size_t) s->h.nMol * trajComp * sizeof (int));
+	}
+	if (! ok) trajError = 1;
+	trajBytes += sizeof (TrajHeader) + s->h.bytes;
+	++ trajWritten;
+}
+
+static void TrajThread (void *arg)
+{
+	TrajSlot *s;
+
+	MutexLock (&trajLock);
+	for (;;) {
+		while (!trajQueued) CondWait (&trajCond, &trajLock);
+		s = &trajSlot[trajHead];
+		MutexUnlock (&trajLock);
+		WriteFrame (s);
+		MutexLock (&trajLock);
+		trajHead = (trajHead + 1) % TRAJ_SLOTS;
+		-- trajQueued;
+		CondBroadcast (&trajCond);
+	}
+}
+
+// Wait until the writer thread has written every frame
+static void TrajWait (void)
+{
+	if (!trajThreadUp) return;
+	MutexLock (&trajLock);
+	while (trajQueued) CondWait (&trajCond, &trajLock);
+	MutexUnlock (&trajLock);
+}
+
+
+/*
+ * Engine side
+ */
+
+// Open the file for the current system, taking the memory from arena a
+void TrajInit (Arena *a)
+{
+	TrajFileHeader fh;
+	size_t size;
+	int k, nChunk;
+
+	TrajFree ();
+	trajFrame = trajWritten = trajWaits = trajError = 0;
+	trajBytes = 0;
+	if (!trajName[0] || trajPeriod <= 0) return;
+
+	trajComp = trajVelQuantum > 0. ? 4 : 2;
+	nChunk = (nMol + TRAJ_CHUNK - 1) / TRAJ_CHUNK;
+	if (trajPrecision > 0.) {
+		trajGrid = (int) Min (ceil (1. / trajPrecision), (double) (1 << 30));
+		size = (size_t) nMol * trajComp * sizeof (int);
+		// A value takes at most TRAJ_ESCAPE + 32 bits
+		trajChunkMax = trajComp + TRAJ_CHUNK * trajComp * 7 + 1;
+		AllocMemArena (a, trajPrev, nMol * trajComp, int);
+		AllocMemArena (a, trajChunk, (size_t) nChunk * trajChunkMax, unsigned char);
+		AllocMemArena (a, trajChunkBytes, nChunk, int);
+	} else {
+		trajGrid = 0;
+		size = (size_t) nMol * sizeof (VecR) * (trajComp / 2);
+	}
+	for (k = 0; k < TRAJ_SLOTS; k ++) {
+		AllocMemArena (a, trajSlot[k].data, size, char);
+		trajSlot[k].h.nChunk = trajGrid ? nChunk : 0;
+	}
+	trajHead = trajQueued = 0;
+
+	if (!(trajFile = fopen (trajName, "wb"))) {
+		LogError("Error: could not write the trajectory to %s\n", trajName);
+		return;
+	}
+	fh.magic = TRAJ_MAGIC;
+	fh.version = TRAJ_VERSION;
+	fh.nMol = nMol;
+	fh.pad = 0;
+	if (fwrite (&fh, sizeof (fh), 1, trajFile) != 1) trajError = 1;
+	if (!trajThreadUp) {
+		MutexInit (&trajLock);
+		CondInit (&trajCond);
+		if (ThreadCreate (&trajThread, TrajThread, NULL) != 0) {
+			LogError("Error: could not start the trajectory thread\n");
+			fclose (trajFile);
+			trajFile = NULL;
+			return;
+		}
+		trajThreadUp = 1;
+	}
+	if (trajGrid)
+		message("Trajectory to %s every %d steps, on a grid of %d points, velocities %s\n",
+			trajName, trajPeriod, trajGrid, trajComp == 4 ? "kept" : "left out");
+	else
+		message("Trajectory to %s every %d steps, full precision\n", trajName, trajPeriod);
+}
+
+// Copy the molecules of thread tid into the slot being filled
+static void TrajCopy (int tid)
+{
+	VecR *r, *rv, f;
+	double v;
+	int c, n, *q, x;
+
+	if (!trajGrid) {
+		r = trajFill->data;
+		rv = r + nMol;
+		DO_MOL_OF (tid) {
+			r[n] = mol[n].r;
+			if (trajComp == 4) rv[n] = mol[n].rv;
+		}
+		return;
+	}
+	q = trajFill->data;
+	VSetAll (f, trajGrid);
+	VDiv (f, f, region);
+	DO_MOL_OF (tid) {
+		x = (int) ((mol[n].r.x + 0.5 * region.x) * f.x);
+		q[n * trajComp] = Clamp (x, 0, trajGrid - 1);
+		x = (int) ((mol[n].r.y + 0.5 * region.y) * f.y);
+		q[n * trajComp + 1] = Clamp (x, 0, trajGrid - 1);
+		for (c = 2; c < trajComp; c ++) {
+			v = floor ((c == 2 ? mol[n].rv.x : mol[n].rv.y) / trajVelQuantum + 0.5);
+			q[n * trajComp + c] = (int) Clamp (v, - TRAJ_VEL_MAX, TRAJ_VEL_MAX);
+		}
+	}
+}
+
+// Hand the current state to the writer thread, waiting for a free slot if
+// it is TRAJ_SLOTS frames behind
+void TrajSample (void)
+{
+	TrajHeader *h;
+
+	if (!trajFile) return;
+	MutexLock (&trajLock);
+	if (trajQueued == TRAJ_SLOTS) {
+		++ trajWaits;
+		while (trajQueued == TRAJ_SLOTS) CondWait (&trajCond, &trajLock);
+	}
+	trajFill = &trajSlot[(trajHead + trajQueued) % TRAJ_SLOTS];
+	MutexUnlock (&trajLock);
+
+	h = &trajFill->h;
+	h->magic = TRAJ_MAGIC;
+	h->flags = trajComp == 4 ? TRAJ_VEL : 0;
+	if (trajGrid) {
+		h->flags |= TRAJ_QUANTISED;
+		if (trajKeyPeriod <= 1 || trajFrame % trajKeyPeriod == 0) h->flags |= TRAJ_KEY;
+	}
+	h->stepCount = stepCount;
+	h->nMol = nMol;
+	h->grid = trajGrid;
+	h->timeNow = timeNow;
+	h->region[0] = region.x;
+	h->region[1] = region.y;
+	h->velQuantum = trajVelQuantum;
+	h->shearRate = shearRate;
+	h->shearShift = shearShift;
+	ThreadsRun (TrajCopy);
+	++ trajFrame;
+
+	MutexLock (&trajLock);
+	++ trajQueued;
+	CondBroadcast (&trajCond);
+	MutexUnlock (&trajLock);
+}
+
+// Write out the frames still queued and tell how much was written
+void TrajReport (void)
+{
+	double full;
+
+	if (!trajFile) return;
+	TrajWait ();
+	fflush (trajFile);
+	if (trajError) LogError("Error: could not write all of the trajectory to %s\n", trajName);
+	if (!trajWritten) return;
+	full = (double) nMol * trajWritten * sizeof (VecR) * (trajComp / 2);
+	message("Trajectory: %d frames, %.2f bytes per molecule, %.1f times less than "
+		"doubles; the integrator waited %d times\n", trajWritten,
+		trajBytes / ((double) nMol * trajWritten), full / trajBytes, trajWaits);
+}
+
+void TrajFree (void)
+{
+	TrajWait ();
+	if (trajFile) fclose (trajFile);
+	trajFile = NULL;
+}
@@ -0,0 +1,101 @@
+/*
+ * Trajectory files
+ *
+ * With trajName set, the engine writes a frame with the positions (and
+ * the velocities, unless trajVelQuantum is 0) to that file every trajPeriod
+ * steps, starting with the initial state. Frames are written by a thread
+ * of their own, so the integrator only waits when it gets TRAJ_SLOTS
+ * frames ahead of the disc.
+ *
+ * With trajPrecision = 0 the frames hold the doubles as they are. Otherwise
+ * they are compressed with loss: the positions are rounded to a grid of
+ * 1 / trajPrecision points along each side of the region, the velocities
+ * to multiples of trajVelQuantum. Every trajKeyPeriod-th frame is a key
+ * frame, where each molecule is taken relative to the one before it; in the
+ * others each is taken relative to itself in the previous frame, across the
+ * periodic boundary where that is shorter. These differences are Rice
+ * coded. The molecules are cut into chunks of TRAJ_CHUNK, which are coded
+ * and decoded independently by several threads.
+ *
+ * A file is a TrajFileHeader followed by the frames, each a TrajHeader and
+ * its data (version 1 files lack the shear fields at the end of the header): for full precision the nMol positions and then the nMol
+ * velocities, as x,y pairs of doubles; compressed, nChunk chunk sizes
+ * (ints) and then the chunks. A chunk starts with the Rice parameter of
+ * each component (x, y, vx, vy) as a byte, then a bit stream with the
+ * components of every molecule in turn, least significant bit first.
+ */
+#ifndef __MD_TRAJECTORY_H__
+#define __MD_TRAJECTORY_H__
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "in_vdefs.h"
+#include "arena.h"
+
+#define TRAJ_MAGIC     0x4a52544d  // "MTRJ"
+#define TRAJ_VERSION   2
+#define TRAJ_NAME_MAX  256
+
+// Flags of a frame
+#define TRAJ_KEY        1  // compressed key frame
+#define TRAJ_QUANTISED  2  // compressed, otherwise doubles
+#define TRAJ_VEL        4  // with velocities
+
+// Molecules per chunk, frames queued for the writer
+#define TRAJ_CHUNK  16384
+#define TRAJ_SLOTS  3
+
+// A Rice quotient of this many ones is followed by the value in 32 bits
+#define TRAJ_ESCAPE  24
+
+typedef struct {
+	unsigned int magic, version;
+	int nMol, pad;
+} TrajFileHeader;
+
+typedef struct {
+	unsigned int magic;
+	int flags, stepCount, nMol, nChunk;
+	int grid;                  // grid points along each side, compressed
+	double timeNow;
+	double region[2];
+	double velQuantum;         // compressed
+	long long bytes;           // of the data after this header
+	double shearRate;          // 0 unless sheared, see shear.h
+	double shearShift;
+} TrajHeader;
+
+// Size of the header of a version 1 frame
+#define TRAJ_HEADER_V1  offsetof (TrajHeader, shearRate)
+
+// Engine side
+extern char   trajName[TRAJ_NAME_MAX];
+extern int    trajPeriod, trajKeyPeriod, trajThreads;
+extern double trajPrecision, trajVelQuantum;
+
+void TrajInit (Arena *a);
+void TrajSample (void);
+void TrajReport (void);
+void TrajFree (void);
+
+// Reader side, in trajreader.c
+typedef struct {
+	FILE *f;
+	int nMol, nFrame, frame;   // frame: the one TrajReaderNext() reads
+	int nThreads;
+	int headSize;              // of a frame header in this file
+	long long *offset;         // [nFrame] file position of each frame
+	int *q;                    // quantised state of frame last, -1 if none
+	int last;
+	unsigned char *buf;
+	long long bufSize;
+	TrajHeader h;              // of the last frame read
+} TrajReader;
+
+int  TrajReaderOpen (TrajReader *rd, const char *name, int nThreads);
+int  TrajReaderSeek (TrajReader *rd, int frame);
+int  TrajReaderNext (TrajReader *rd, VecR *r, VecR *rv);
+void TrajReaderClose (TrajReader *rd);
+
+#endif /* __MD_TRAJECTORY_H__ */
@@ -0,0 +1,296 @@
+/*
+ * Reading trajectory files
+ *
+ * This is the reading side of trajectory.c, kept apart so that players and
+ * analysis programs (like md-analyse.c) need not write trajectories. See trajectory.h for the
+ * file layout.
+ *
+ * On opening, the frame headers are read to index the file; a frame that
+ * is still being written is left out. A compressed frame that is not a key
+ * frame needs the one before it, so TrajReaderNext() decodes from the last
+ * key frame when it is not read in order. Chunks are decoded on nThreads
+ * threads.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "in_vdefs.h"
+#include "threads.h"
+#include "trajectory.h"
+
+#ifdef _WINDOWS
+#	define FileSeek(f, pos)  _fseeki64 ((f), (pos), SEEK_SET)
+#	define FileTell(f)       _ftelli64 (f)
+#else
+#	define FileSeek(f, pos)  fseeko ((f), (off_t) (pos), SEEK_SET)
+#	define FileTell(f)       ((long long) ftello (f))
+#endif
+
+// Bytes read beyond the end of the data by the bit reader
+#define TRAJ_PAD  8
+
+typedef struct {
+	const unsigned char *p;
+	unsigned long long acc;
+	int nBits;
+} BitReader;
+
+// The frame being decoded, for the threads
+static TrajReader *tRd;
+static VecR *tR, *tRv;
+static long long *tChunkAt;
+static int tNextChunk;
+
+
+// Number of trailing one bits of x, which has a zero among its low 32
+static int TrailingOnes (unsigned long long x)
+{
+#if defined (__GNUC__)
+	return __builtin_ctzll (~x);
+#else
+	int n = 0;
+
+	while (x & 1) {
+		x >>= 1;
+		++ n;
+	}
+	return n;
+#endif
+}
+
+// Have at least 57 bits in the accumulator
+static void Refill (BitReader *b)
+{
+	while (b->nBits <= 56) {
+		b->acc |= (unsigned long long) *b->p ++ << b->nBits;
+		b->nBits += 8;
+	}
+}
+
+static unsigned int GetBits (BitReader *b, int n)
+{
+	unsigned int v;
+
+	if (n == 0) return 0;
+	Refill (b);
+	v = (unsigned int) (b->acc & ((1ULL << n) - 1));
+	b->acc >>= n;
+	b->nBits -= n;
+	return v;
+}
+
+static unsigned int GetRice (BitReader *b, int k)
+{
+	unsigned int q;
+
+	Refill (b);
+	q = TrailingOnes (b->acc & ~(1ULL << TRAJ_ESCAPE));
+	if (q >= TRAJ_ESCAPE) {
+		b->acc >>= TRAJ_ESCAPE;
+		b->nBits -= TRAJ_ESCAPE;
+		return GetBits (b, 32);
+	}
+	b->acc >>= q + 1;
+	b->nBits -= q + 1;
+	return (q << k) | GetBits (b, k);
+}
+
+// Decode chunk i of the frame in the buffer; the inverse of CodeChunk() in
+// trajectory.c
+static void DecodeChunk (int i)
+{
+	TrajReader *rd = tRd;
+	TrajHeader *h = &rd->h;
+	BitReader b;
+	VecR wid;
+	const unsigned char *p;
+	unsigned int u;
+	int c, d, hi, k[4], key, lo, n, nComp, ref, v, *q = rd->q;
+
+	nComp = h->flags & TRAJ_VEL ? 4 : 2;
+	key = h->flags & TRAJ_KEY;
+	lo = i * TRAJ_CHUNK;
+	hi = Min (lo + TRAJ_CHUNK, h->nMol);
+	p = rd->buf + tChunkAt[i];
+	for (c = 0; c < nComp; c ++) k[c] = p[c];
+	b.p = p + nComp;
+	b.acc = 0;
+	b.nBits = 0;
+	for (n = lo; n < hi; n ++) {
+		for (c = 0; c < nComp; c ++) {
+			u = GetRice (&b, k[c]);
+			d = (int) (u >> 1) ^ - (int) (u & 1);
+			if (! key) ref = q[n * nComp + c];
+			else if (n > lo) ref = q[(n - 1) * nComp + c];
+			else ref = c < 2 ? h->grid / 2 : 0;
+			v = ref + d;
+			if (c < 2) {
+				if (v < 0) v += h->grid;
+				else if (v >= h->grid) v -= h->grid;
+			}
+			q[n * nComp + c] = v;
+		}
+	}
+	if (!tR) return;
+	VSet (wid, h->region[0] / h->grid, h->region[1] / h->grid);
+	for (n = lo; n < hi; n ++) {
+		tR[n].x = (q[n * nComp] + 0.5) * wid.x - 0.5 * h->region[0];
+		tR[n].y = (q[n * nComp + 1] + 0.5) * wid.y - 0.5 * h->region[1];
+		if (tRv && nComp == 4) {
+			tRv[n].x = q[n * nComp + 2] * h->velQuantum;
+			tRv[n].y = q[n * nComp + 3] * h->velQuantum;
+		}
+	}
+}
+
+static void DecodeWorker (void *arg)
+{
+	int i;
+
+	while ((i = AtomicAdd (&tNextChunk, 1)) < tRd->h.nChunk) DecodeChunk (i);
+}
+
+// Decode the compressed frame in the buffer into r and rv (either may be
+// NULL), on rd->nThreads threads
+static int DecodeFrame (TrajReader *rd, VecR *r, VecR *rv)
+{
+	Thread t[MAX_THREADS];
+	long long at;
+	int i, k, n;
+
+	if (!(tChunkAt = malloc ((rd->h.nChunk + 1) * sizeof (long long)))) return -1;
+	at = (long long) rd->h.nChunk * sizeof (int);
+	for (i = 0; i < rd->h.nChunk; i ++) {
+		tChunkAt[i] = at;
+		at += ((int *) rd->buf)[i];
+	}
+	tRd = rd;
+	tR = r;
+	tRv = rv;
+	tNextChunk = 0;
+	n = Clamp (rd->nThreads, 1, Min (rd->h.nChunk, MAX_THREADS));
+	for (k = 1; k < n; k ++) {
+		if (ThreadCreate (&t[k], DecodeWorker, NULL) != 0) break;
+	}
+	DecodeWorker (NULL);
+	while (-- k > 0) ThreadJoin (t[k]);
+	free (tChunkAt);
+	return 0;
+}
+
+// Return: 0 when the file called name was opened and indexed, -1 otherwise
+int TrajReaderOpen (TrajReader *rd, const char *name, int nThreads)
+{
+	TrajFileHeader fh;
+	TrajHeader h;
+	long long at, end, *p;
+	int max = 0;
+
+	memset (rd, 0, sizeof (*rd));
+	rd->nThreads = nThreads;
+	rd->last = -1;
+	if (!(rd->f = fopen (name, "rb"))) return -1;
+	if (fread (&fh, sizeof (fh), 1, rd->f) != 1 || fh.magic != TRAJ_MAGIC ||
+			fh.version < 1 || fh.version > TRAJ_VERSION || fh.nMol <= 0) {
+		TrajReaderClose (rd);
+		return -1;
+	}
+	rd->nMol = fh.nMol;
+	rd->headSize = fh.version == 1 ? TRAJ_HEADER_V1 : sizeof (TrajHeader);
+	fseek (rd->f, 0, SEEK_END);
+	end = FileTell (rd->f);
+	at = sizeof (fh);
+	while (at + rd->headSize <= end) {
+		if (FileSeek (rd->f, at) != 0 || fread (&h, rd->headSize, 1, rd->f) != 1 ||
+				h.magic != TRAJ_MAGIC || h.nMol != rd->nMol || h.bytes < 0 ||
+				at + rd->headSize + h.bytes > end)
+			break;
+		if (rd->nFrame == max) {
+			max = Max (2 * max, 1024);
+			if (!(p = realloc (rd->offset, max * sizeof (long long)))) break;
+			rd->offset = p;
+		}
+		rd->offset[rd->nFrame ++] = at;
+		at += rd->headSize + h.bytes;
+	}
+	if (!(rd->q = malloc ((size_t) rd->nMol * 4 * sizeof (int)))) {
+		TrajReaderClose (rd);
+		return -1;
+	}
+	return 0;
+}
+
+// Read frame rd->frame into the buffer, and its header into rd->h
+static int ReadFrame (TrajReader *rd)
+{
+	unsigned char *p;
+
+	if (rd->frame < 0 || rd->frame >= rd->nFrame) return -1;
+	if (FileSeek (rd->f, rd->offset[rd->frame]) != 0 ||
+			fread (&rd->h, rd->headSize, 1, rd->f) != 1)
+		return -1;
+	if (rd->h.bytes + TRAJ_PAD > rd->bufSize) {
+		if (!(p = realloc (rd->buf, rd->h.bytes + TRAJ_PAD))) return -1;
+		rd->buf = p;
+		rd->bufSize = rd->h.bytes + TRAJ_PAD;
+	}
+	if (fread (rd->buf, 1, rd->h.bytes, rd->f) != (size_t) rd->h.bytes) return -1;
+	memset (rd->buf + rd->h.bytes, 0, TRAJ_PAD);
+	return 0;
+}
+
+// Make frame the one read next
+int TrajReaderSeek (TrajReader *rd, int frame)
+{
+	if (frame < 0 || frame > rd->nFrame) return -1;
+	rd->frame = frame;
+	return 0;
+}
+
+// Read the next frame into r and rv (either may be NULL, rv is left alone
+// when the frame has no velocities); the header is in rd->h afterwards.
+// Return: 0 on success, -1 at the end or on an error
+int TrajReaderNext (TrajReader *rd, VecR *r, VecR *rv)
+{
+	size_t size;
+	int frame = rd->frame, key;
+
+	if (ReadFrame (rd) != 0) return -1;
+	if (! (rd->h.flags & TRAJ_QUANTISED)) {
+		size = (size_t) rd->nMol * sizeof (VecR);
+		if (r) memcpy (r, rd->buf, size);
+		if (rv && rd->h.flags & TRAJ_VEL) memcpy (rv, rd->buf + size, size);
+		rd->last = -1;
+		++ rd->frame;
+		return 0;
+	}
+	if (! (rd->h.flags & TRAJ_KEY) && rd->last != frame - 1) {
+		// Decode from the last key frame on
+		for (key = frame - 1; key >= 0; key --) {
+			rd->frame = key;
+			if (ReadFrame (rd) != 0) return -1;
+			if (rd->h.flags & TRAJ_KEY) break;
+		}
+		if (key < 0) return -1;
+		for (; key < frame; key ++) {
+			rd->frame = key;
+			if (ReadFrame (rd) != 0 || DecodeFrame (rd, NULL, NULL) != 0) return -1;
+		}
+		rd->frame = frame;
+		if (ReadFrame (rd) != 0) return -1;
+	}
+	if (DecodeFrame (rd, r, rv) != 0) return -1;
+	rd->last = frame;
+	rd->frame = frame + 1;
+	return 0;
+}
+
+void TrajReaderClose (TrajReader *rd)
+{
+	if (rd->f) fclose (rd->f);
+	free (rd->offset);
+	free (rd->q);
+	free (rd->buf);
+	memset (rd, 0, sizeof (*rd));
+}
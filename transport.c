@@ -0,0 +1,193 @@
+/*
+ * Transport coefficients from Green-Kubo relations
+ *
+ * The viscosity is V/T times the integral of <P_xy(0) P_xy(t)>, where the
+ * xy and yx components are averaged; the diffusion coefficient is the
+ * integral of the velocity autocorrelation of one component. Each thread
+ * correlates the velocities of its own molecules, so sampling them needs
+ * no communication; the correlation functions are added up at the end.
+ * The mean squared displacement is done the same way, with the positions
+ * unwrapped by the image counters; the diffusion coefficient is fitted to
+ * its long-time part.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "in_vdefs.h"
+#include "in_mddefs.h"
+#include "threads.h"
+#include "simulation.h"
+#include "correlator.h"
+#include "transport.h"
+
+// Inputs: steps between samples (0 for none) and number of correlator levels
+int corrPeriod = 0, corrLevels = 10;
+int msdPeriod = 0;
+
+Correlator stressCorr, *vacfCorr, *msdCorr;
+double tempSum;
+int nTempSum;
+
+
+static void ZeroCorrelators (int tid)
+{
+	if (corrPeriod) CorrelatorZero (&vacfCorr[tid]);
+	if (msdPeriod) CorrelatorZero (&msdCorr[tid]);
+}
+
+// Set up the correlators, taking their memory from arena a
+void TransportInit (Arena *a)
+{
+	ThreadInfo *ti;
+	int t;
+
+	nTempSum = 0;
+	tempSum = 0.;
+	if (corrPeriod) {
+		CorrelatorInit (&stressCorr, a, 2, corrLevels, CORR_PRODUCT);
+		CorrelatorZero (&stressCorr);
+		AllocMemArena (a, vacfCorr, nThreadsUsed, Correlator);
+	}
+	if (msdPeriod) AllocMemArena (a, msdCorr, nThreadsUsed, Correlator);
+	for (t = 0; t < nThreadsUsed; t ++) {
+		ti = &threadInfo[t];
+		if (corrPeriod) CorrelatorInit (&vacfCorr[t], a,
+			n_dimensions * (ti->molHi - ti->molLo), corrLevels, CORR_PRODUCT);
+		if (msdPeriod) CorrelatorInit (&msdCorr[t], a,
+			n_dimensions * (ti->molHi - ti->molLo), corrLevels, CORR_MSD);
+	}
+	// Cleared by their own threads, for NUMA placement
+	ThreadsRun (ZeroCorrelators);
+}
+
+// Return: whether the current step is sampled
+int TransportDue (void)
+{
+	return (corrPeriod && stepCount % corrPeriod == 0) ||
+		(msdPeriod && stepCount % msdPeriod == 0);
+}
+
+// Sample the velocities and positions of the molecules of thread tid
+void TransportSample (int tid)
+{
+	Correlator *c;
+	VecR r;
+	int n, molLo = threadInfo[tid].molLo;
+
+	if (corrPeriod && stepCount % corrPeriod == 0) {
+		c = &vacfCorr[tid];
+		DO_MOL_OF (tid) VToLin (c->in, n_dimensions * (n - molLo), mol[n].rv);
+		CorrelatorPush (c);
+	}
+	if (msdPeriod && stepCount % msdPeriod == 0) {
+		c = &msdCorr[tid];
+		DO_MOL_OF (tid) {
+			VMul (r, molImage[n], region);
+			VVAdd (r, mol[n].r);
+			VToLin (c->in, n_dimensions * (n - molLo), r);
+		}
+		CorrelatorPush (c);
+	}
+}
+
+// Sample the pressure, after SumProps()
+void TransportSampleSum (void)
+{
+	if (!corrPeriod || stepCount % corrPeriod != 0) return;
+	stressCorr.in[0] = pressure_xy.val;
+	stressCorr.in[1] = pressure_yx.val;
+	CorrelatorPush (&stressCorr);
+	tempSum += 2. * kinEnergy.val / n_dimensions;
+	++ nTempSum;
+}
+
+// Diffusion coefficient from the mean squared displacement, by a least
+// squares fit of its last 7/8 in time, and write the MSD to a file
+static void ReportMsd (const char *filename)
+{
+	FILE *f;
+	double *lag, *msd, sx, sy, sxx, sxy, t0, diff;
+	int k, n, nFit;
+
+	lag = malloc (2 * corrLevels * CORR_P * sizeof (double));
+	if (!lag) return;
+	msd = lag + corrLevels * CORR_P;
+	n = CorrelatorResult (msdCorr, nThreadsUsed, lag, msd);
+	for (k = 0; k < n; k ++) {
+		lag[k] *= msdPeriod * deltaT;
+		msd[k] *= n_dimensions;
+	}
+	if (n < 3) {
+		free (lag);
+		return;
+	}
+
+	sx = sy = sxx = sxy = 0.;
+	nFit = 0;
+	t0 = lag[n - 1] / 8.;
+	for (k = 1; k < n; k ++) {
+		if (lag[k] < t0 && n - k > 2) continue;
+		sx += lag[k];
+		sy += msd[k];
+		sxx += Sqr (lag[k]);
+		sxy += lag[k] * msd[k];
+		++ nFit;
+	}
+	diff = (nFit * sxy - sx * sy) / (nFit * sxx - Sqr (sx)) / (2. * n_dimensions);
+	message("MSD up to t = %.2f: diffusion coefficient %.4f\n", lag[n - 1], diff);
+
+	if ((f = fopen (filename, "w"))) {
+		fprintf (f, "   t         MSD\n");
+		for (k = 0; k < n; k ++) fprintf (f, "%9.4f %11.4e\n", lag[k], msd[k]);
+		fclose (f);
+	} else {
+		LogError("Error: could not write the MSD to %s.\n", filename);
+	}
+	free (lag);
+}
+
+// Print the transport coefficients and write the correlation functions,
+// with their running integrals, and the MSD to files
+void TransportReport (const char *corrFile, const char *msdFile)
+{
+	FILE *f;
+	double *lag, *cs, *cv, dt, temp, visc, diff, is, iv;
+	int k, nMax, ns, nv;
+
+	if (msdPeriod) ReportMsd (msdFile);
+	if (!corrPeriod || nTempSum == 0) return;
+	nMax = corrLevels * CORR_P;
+	lag = malloc (3 * nMax * sizeof (double));
+	if (!lag) return;
+	cs = lag + nMax;
+	cv = cs + nMax;
+	nv = CorrelatorResult (vacfCorr, nThreadsUsed, lag, cv);
+	ns = CorrelatorResult (&stressCorr, 1, lag, cs);
+	dt = corrPeriod * deltaT;
+	for (k = 0; k < ns; k ++) lag[k] *= dt;
+
+	temp = tempSum / nTempSum;
+	visc = VProd (region) / temp * CorrelatorIntegral (ns, lag, cs);
+	diff = CorrelatorIntegral (nv, lag, cv);
+	message("Green-Kubo over %d samples at T = %.4f, t up to %.2f:\n",
+		nTempSum, temp, ns > 0 ? lag[ns - 1] : 0.);
+	message("  shear viscosity %.4f, diffusion coefficient %.4f\n", visc, diff);
+
+	if (!(f = fopen (corrFile, "w"))) {
+		LogError("Error: could not write correlations to %s.\n", corrFile);
+		free (lag);
+		return;
+	}
+	fprintf (f, "   t         C_Pxy       viscosity   C_vv        diffusion\n");
+	is = iv = 0.;
+	for (k = 0; k < ns && k < nv; k ++) {
+		if (k > 0) {
+			is += 0.5 * (cs[k] + cs[k - 1]) * (lag[k] - lag[k - 1]);
+			iv += 0.5 * (cv[k] + cv[k - 1]) * (lag[k] - lag[k - 1]);
+		}
+		fprintf (f, "%9.4f %11.4e %11.4e %11.4e %11.4e\n", lag[k], cs[k],
+			VProd (region) / temp * is, cv[k], iv);
+	}
+	fclose (f);
+	free (lag);
+}
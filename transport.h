@@ -0,0 +1,24 @@
+/*
+ * Transport coefficients from Green-Kubo relations
+ *
+ * Every corrPeriod steps the off-diagonal pressure and the velocities go
+ * into multi-tau correlators; the shear viscosity and the self-diffusion
+ * coefficient are the integrals of their autocorrelation functions.
+ * Every msdPeriod steps the unwrapped positions go into a correlator for
+ * the mean squared displacement, which gives the diffusion coefficient
+ * from its slope.
+ */
+#ifndef __MD_TRANSPORT_H__
+#define __MD_TRANSPORT_H__
+
+#include "arena.h"
+
+extern int corrPeriod, corrLevels, msdPeriod;
+
+void TransportInit (Arena *a);
+int  TransportDue (void);
+void TransportSample (int tid);
+void TransportSampleSum (void);
+void TransportReport (const char *corrFile, const char *msdFile);
+
+#endif /* __MD_TRANSPORT_H__ */